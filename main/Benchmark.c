@@ -0,0 +1,202 @@
+// SWD/JTAG timing benchmark
+// Runs a burst of DP IDCODE reads on the core of the DAP task and measures each of them with the
+// Test Domain Timer. The spread between the fastest and the slowest transfer shows how much the
+// SWD timing is disturbed by preemption (e.g. by the BLE host and controller on the same core), so
+// task affinity and priority settings can be compared on real hardware.
+// With the JTAG port connected, each transfer is a long DR scan through the BYPASS registers of
+// the chain instead, which measures the raw shift rate of the JTAG engine.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// Transfers taking longer than this multiple of the fastest one count as disturbed
+#define BENCH_SLOW_FACTOR       2U
+
+// Transfers run before the measurement to find the undisturbed transfer time
+#define BENCH_WARMUP            8U
+
+// Length of the DR scan of a JTAG transfer in bits
+#define BENCH_DR_BITS           1024U
+
+// Transfers between pauses of one tick, which let lower priority tasks run (not measured)
+#define BENCH_CHUNK             256U
+
+#if (DAP_JTAG != 0)
+// Load BYPASS into the IR of all devices of the chain (all IR bits 1), from Run-Test/Idle back
+// to Run-Test/Idle
+static void Benchmark_BypassIR (void) {
+  static const uint8_t ones[8] = { 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU };
+  uint8_t  tdo[8];
+  uint32_t bits;
+  uint32_t n;
+
+  bits = 0U;
+  for (n = 0U; n < DAP_Data.jtag_dev.count; n++) {
+    bits += DAP_Data.jtag_dev.ir_length[n];
+  }
+
+  JTAG_Sequence(2U | JTAG_SEQUENCE_TMS, ones, tdo);           // Select-DR-Scan, Select-IR-Scan
+  JTAG_Sequence(2U, ones, tdo);                               // Capture-IR, Shift-IR
+  for (n = (bits != 0U) ? (bits - 1U) : 0U; n >= 64U; n -= 64U) {
+    JTAG_Sequence(0U, ones, tdo);                             // 64 bits (TCK count 0 = 64)
+  }
+  if (n) {
+    JTAG_Sequence(n, ones, tdo);
+  }
+  JTAG_Sequence(1U | JTAG_SEQUENCE_TMS, ones, tdo);           // Last bit & Exit1-IR
+  JTAG_Sequence(1U | JTAG_SEQUENCE_TMS, ones, tdo);           // Update-IR
+  JTAG_Sequence(1U, ones, tdo);                               // Idle
+}
+
+// Long DR scan from Run-Test/Idle back to Run-Test/Idle
+//   return: ACK of the scan (always OK, JTAG has no handshake)
+static uint8_t Benchmark_ScanDR (void) {
+  static const uint8_t ones[8] = { 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU };
+  static const uint8_t pattern[8] = { 0x55U, 0xAAU, 0x0FU, 0xF0U, 0x33U, 0xCCU, 0x00U, 0xFFU };
+  uint8_t  tdo[8];
+  uint32_t n;
+
+  JTAG_Sequence(1U | JTAG_SEQUENCE_TMS, ones, tdo);           // Select-DR-Scan
+  JTAG_Sequence(2U, ones, tdo);                               // Capture-DR, Shift-DR
+  for (n = BENCH_DR_BITS - 1U; n >= 64U; n -= 64U) {
+    JTAG_Sequence(0U | JTAG_SEQUENCE_TDO, pattern, tdo);      // 64 bits (TCK count 0 = 64)
+  }
+  if (n) {
+    JTAG_Sequence(n | JTAG_SEQUENCE_TDO, pattern, tdo);
+  }
+  JTAG_Sequence(1U | JTAG_SEQUENCE_TMS | JTAG_SEQUENCE_TDO, pattern, tdo);  // Last bit & Exit1-DR
+  JTAG_Sequence(1U | JTAG_SEQUENCE_TMS, ones, tdo);           // Update-DR
+  JTAG_Sequence(1U, ones, tdo);                               // Idle
+
+  return (DAP_TRANSFER_OK);
+}
+#endif
+
+// Benchmark transfer on the connected debug port
+//   data:   pointer to read data
+//   return: ACK of the transfer
+static uint8_t Benchmark_Transfer (uint32_t *data) {
+#if (DAP_JTAG != 0)
+  if (DAP_Data.debug_port == DAP_PORT_JTAG) {
+    return (Benchmark_ScanDR());
+  }
+#endif
+  return (SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, data));
+}
+
+// Process Benchmark command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  number of transfers (2)
+// Response: status (1), core of the DAP task (1), task priority (1), executed transfers (2),
+//           total time (4), fastest transfer (4), slowest transfer (4), disturbed transfers (2)
+//           (times in Test Domain Timer ticks, see DAP_Info DAP_ID_TIMESTAMP_CLOCK)
+// A transfer is a DP IDCODE read on SWD and a DR scan of BENCH_DR_BITS bits on JTAG (all IR bits
+// of the chain are set to 1 first, which is BYPASS for any IR length, so the scan has no side
+// effects).
+uint32_t Benchmark_Process (const uint8_t *request, uint8_t *response) {
+  uint32_t count;
+  uint32_t done;
+  uint32_t start, begin, time, pause;
+  uint32_t total, fastest, slowest, slow;
+  uint32_t data;
+  uint32_t n;
+  uint8_t  ack;
+
+  count   = (uint32_t)(*(request+0) <<  0) |
+            (uint32_t)(*(request+1) <<  8);
+  done    = 0U;
+  total   = 0U;
+  fastest = 0xFFFFFFFFU;
+  slowest = 0U;
+  slow    = 0U;
+  ack     = DAP_TRANSFER_OK;
+
+  *response = DAP_ERROR;
+  if (DAP_Data.debug_port == DAP_PORT_SWD) {
+    DAP_TransferAbort = 0U;
+#if (DAP_JTAG != 0)
+  } else if ((DAP_Data.debug_port == DAP_PORT_JTAG) && (DAP_Data.jtag_dev.count != 0U)) {
+    DAP_TransferAbort = 0U;
+    Benchmark_BypassIR();
+#endif
+  } else {
+    ack = DAP_TRANSFER_ERROR;
+  }
+
+  if (ack == DAP_TRANSFER_OK) {
+    // Warm-up transfers (not counted) give a first estimate of the undisturbed transfer time
+    for (n = 0U; (n < BENCH_WARMUP) && (ack == DAP_TRANSFER_OK); n++) {
+      begin = TIMESTAMP_GET();
+      ack   = Benchmark_Transfer(&data);
+      time  = TIMESTAMP_GET() - begin;
+      if (time < fastest) {
+        fastest = time;
+      }
+    }
+
+    start = TIMESTAMP_GET();
+    for (done = 0U; (done < count) && (ack == DAP_TRANSFER_OK); done++) {
+      if (DAP_TransferAbort) {
+        break;
+      }
+      if ((done != 0U) && ((done % BENCH_CHUNK) == 0U)) {
+        pause = TIMESTAMP_GET();
+        vTaskDelay(1);
+        start += TIMESTAMP_GET() - pause;
+      }
+      begin = TIMESTAMP_GET();
+      ack   = Benchmark_Transfer(&data);
+      time  = TIMESTAMP_GET() - begin;
+      if (ack != DAP_TRANSFER_OK) {
+        break;
+      }
+      if (time < fastest) {
+        fastest = time;
+      }
+      if (time > slowest) {
+        slowest = time;
+      }
+      if (time > (fastest * BENCH_SLOW_FACTOR)) {
+        slow++;
+      }
+    }
+    total = TIMESTAMP_GET() - start;
+    if ((ack == DAP_TRANSFER_OK) && (done == count)) {
+      *response = DAP_OK;
+    }
+  }
+  if (fastest == 0xFFFFFFFFU) {
+    fastest = 0U;
+  }
+
+  *(response+1)  = (uint8_t)xPortGetCoreID();
+  *(response+2)  = (uint8_t)uxTaskPriorityGet(NULL);
+  *(response+3)  = (uint8_t)(done >>  0);
+  *(response+4)  = (uint8_t)(done >>  8);
+  *(response+5)  = (uint8_t)(total >>  0);
+  *(response+6)  = (uint8_t)(total >>  8);
+  *(response+7)  = (uint8_t)(total >> 16);
+  *(response+8)  = (uint8_t)(total >> 24);
+  *(response+9)  = (uint8_t)(fastest >>  0);
+  *(response+10) = (uint8_t)(fastest >>  8);
+  *(response+11) = (uint8_t)(fastest >> 16);
+  *(response+12) = (uint8_t)(fastest >> 24);
+  *(response+13) = (uint8_t)(slowest >>  0);
+  *(response+14) = (uint8_t)(slowest >>  8);
+  *(response+15) = (uint8_t)(slowest >> 16);
+  *(response+16) = (uint8_t)(slowest >> 24);
+  *(response+17) = (uint8_t)(slow >>  0);
+  *(response+18) = (uint8_t)(slow >>  8);
+
+  return ((2U << 16) | 19U);
+}
+
+#endif  /* (DAP_SWD != 0) */
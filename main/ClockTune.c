@@ -0,0 +1,227 @@
+// SWD clock discovery
+// Sweeps the SWCLK settings of the I/O engine from the fastest one downward and tests each with a
+// line reset and bursts of DP IDCODE reads, TAR write/readback and an optional RAM pattern test.
+// The fastest setting without errors is reported together with a slower one which keeps a safety
+// margin; the latter can be kept as the clock of the session.
+
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// Maximum number of RAM words used by the pattern test
+#define TUNE_RAM_WORDS          64U
+
+// Slowest tested clock (in Hz)
+#define TUNE_MIN_CLOCK          100000U
+
+// Clock Tune Flags
+#define TUNE_KEEP               (1U<<0)         // Keep the selected clock
+
+// Clock setting of the I/O engine (delay 0 = fast clock)
+//   delay:  clock delay
+//   return: SWCLK frequency in Hz
+static uint32_t Tune_Clock (uint32_t delay) {
+  if (delay == 0U) {
+    return ((CPU_CLOCK/2U) / (IO_PORT_WRITE_CYCLES + DELAY_FAST_CYCLES));
+  }
+  return ((CPU_CLOCK/2U) / (IO_PORT_WRITE_CYCLES + (delay * DELAY_SLOW_CYCLES)));
+}
+
+// Apply clock setting
+//   delay:  clock delay (0 = fast clock)
+static void Tune_SetClock (uint32_t delay) {
+  DAP_Data.fast_clock  = (delay == 0U) ? 1U : 0U;
+  DAP_Data.clock_delay = (delay == 0U) ? 1U : delay;
+}
+
+// Line reset followed by the mandatory IDCODE read and the SELECT of the host
+// (MEM-AP accesses need a known SELECT)
+//   idcode: IDCODE value
+//   select: SELECT of the host
+//   return: ACK[2:0]
+static uint8_t Tune_LineReset (uint32_t *idcode, uint32_t select) {
+  static const uint8_t reset[8] = { 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0x00U };
+  uint8_t ack;
+
+  SWJ_Sequence(64U, reset);
+  ack = SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, idcode);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = SWD_Transfer(DP_SELECT, &select);
+  }
+  return (ack);
+}
+
+// Test current clock setting
+//   ap:     index of the MEM-AP
+//   burst:  number of IDCODE reads and TAR checks
+//   idcode: expected IDCODE
+//   select: SELECT of the host
+//   addr:   RAM address of the pattern test
+//   words:  number of RAM words (0 = no RAM test)
+//   return: 1 when all accesses passed
+static uint32_t Tune_Test (uint32_t ap, uint32_t burst, uint32_t idcode, uint32_t select,
+                           uint32_t addr, uint32_t words) {
+  static uint32_t pattern[TUNE_RAM_WORDS];
+  static uint32_t readback[TUNE_RAM_WORDS];
+  uint32_t data;
+  uint32_t n;
+  uint8_t  ack;
+
+  if ((Tune_LineReset(&data, select) != DAP_TRANSFER_OK) || (data != idcode)) {
+    return (0U);
+  }
+  for (n = 0U; n < burst; n++) {
+    if ((SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, &data) != DAP_TRANSFER_OK) || (data != idcode)) {
+      return (0U);
+    }
+  }
+
+  ack = MEM_Open(ap);
+  for (n = 0U; (n < burst) && (ack == DAP_TRANSFER_OK); n++) {
+    // Alternating and walking bits (TAR may not implement the lowest bits)
+    ack = MEM_CheckTAR(((n & 1U) ? 0x55555554U : 0xAAAAAAA8U) ^ ((1U << (n & 31U)) & ~3U));
+  }
+  if ((ack == DAP_TRANSFER_OK) && (words != 0U)) {
+    for (n = 0U; n < words; n++) {
+      pattern[n] = ((n & 1U) ? 0x55555555U : 0xAAAAAAAAU) ^ (n * 0x01010101U);
+    }
+    ack = MEM_WriteBlock(addr, pattern, words);
+    if (ack == DAP_TRANSFER_OK) {
+      ack = MEM_ReadBlock(addr, readback, words);
+    }
+    if ((ack == DAP_TRANSFER_OK) && (memcmp(pattern, readback, words * 4U) != 0)) {
+      ack = DAP_TRANSFER_ERROR;
+    }
+  }
+  if (MEM_Close() != DAP_TRANSFER_OK) {
+    ack = DAP_TRANSFER_ERROR;
+  }
+
+  return ((ack == DAP_TRANSFER_OK) ? 1U : 0U);
+}
+
+
+// Process Clock Tune command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  AP index (1), flags (1, TUNE_KEEP), margin in percent (1), burst count (1),
+//           RAM address (4), RAM words (1, 0 = no RAM test; contents are restored)
+// Response: status (1), fastest passing clock in Hz (4), selected clock in Hz (4),
+//           margin to the fastest passing clock in percent (1), number of tested settings (1)
+uint32_t ClockTune_Process (const uint8_t *request, uint8_t *response) {
+  static uint32_t saved[TUNE_RAM_WORDS];
+  uint32_t ap, flags, margin, burst, addr, words;
+  uint32_t host_fast, host_delay, host_select;
+  uint32_t idcode;
+  uint32_t delay;
+  uint32_t best, selected, target;
+  uint32_t steps;
+  uint8_t  ack;
+
+  ap     = *(request+0);
+  flags  = *(request+1);
+  margin = *(request+2);
+  burst  = *(request+3);
+  addr   = (uint32_t)(*(request+4) <<  0) |
+           (uint32_t)(*(request+5) <<  8) |
+           (uint32_t)(*(request+6) << 16) |
+           (uint32_t)(*(request+7) << 24);
+  words  = *(request+8);
+
+  best     = 0U;
+  selected = 0U;
+  steps    = 0U;
+  *response = DAP_ERROR;
+
+  // The line resets lose SELECT, which can only be restored when the host SELECT is known
+  if ((DAP_Data.debug_port != DAP_PORT_SWD) || (words > TUNE_RAM_WORDS) || (margin > 90U) ||
+      ((addr & 3U) != 0U) || ((DAP_Data.shadow.valid & DAP_SHADOW_SELECT) == 0U)) {
+    goto end;
+  }
+
+  host_fast   = DAP_Data.fast_clock;
+  host_delay  = DAP_Data.clock_delay;
+  host_select = DAP_Data.shadow.select;
+
+  // Reference values at the clock of the host
+  ack = Tune_LineReset(&idcode, host_select);
+  if ((ack == DAP_TRANSFER_OK) && (words != 0U)) {
+    ack = MEM_Open(ap);
+    if (ack == DAP_TRANSFER_OK) {
+      ack = MEM_ReadBlock(addr, saved, words);
+    }
+    if (MEM_Close() != DAP_TRANSFER_OK) {
+      ack = DAP_TRANSFER_ERROR;
+    }
+  }
+  if (ack != DAP_TRANSFER_OK) {
+    goto end;
+  }
+
+  // Sweep downward until a setting passes which keeps the margin to the fastest passing one
+  target = 0U;
+  for (delay = 0U; Tune_Clock(delay) >= TUNE_MIN_CLOCK; delay += (delay / 8U) + 1U) {
+    if (DAP_TransferAbort) {
+      break;
+    }
+    if ((best != 0U) && (Tune_Clock(delay) > target)) {
+      continue;
+    }
+    Tune_SetClock(delay);
+    steps++;
+    if (!Tune_Test(ap, burst, idcode, host_select, addr, words)) {
+      continue;
+    }
+    if (best == 0U) {
+      best   = Tune_Clock(delay);
+      target = (uint32_t)(((uint64_t)best * (100U - margin)) / 100U);
+    }
+    if (Tune_Clock(delay) <= target) {
+      selected = Tune_Clock(delay);
+      break;
+    }
+  }
+
+  if ((selected == 0U) || ((flags & TUNE_KEEP) == 0U)) {
+    DAP_Data.fast_clock  = (uint8_t)host_fast;
+    DAP_Data.clock_delay = host_delay;
+  } else {
+    Tune_SetClock(delay);
+  }
+
+  // Leave the DP in a known state with the SELECT of the host and restore RAM contents
+  ack = Tune_LineReset(&idcode, host_select);
+  if ((ack == DAP_TRANSFER_OK) && (words != 0U)) {
+    ack = MEM_Open(ap);
+    if (ack == DAP_TRANSFER_OK) {
+      ack = MEM_WriteBlock(addr, saved, words);
+    }
+    if (MEM_Close() != DAP_TRANSFER_OK) {
+      ack = DAP_TRANSFER_ERROR;
+    }
+  }
+  if ((ack == DAP_TRANSFER_OK) && (selected != 0U)) {
+    *response = DAP_OK;
+  }
+
+end:
+  *(response+1) = (uint8_t)(best >>  0);
+  *(response+2) = (uint8_t)(best >>  8);
+  *(response+3) = (uint8_t)(best >> 16);
+  *(response+4) = (uint8_t)(best >> 24);
+  *(response+5) = (uint8_t)(selected >>  0);
+  *(response+6) = (uint8_t)(selected >>  8);
+  *(response+7) = (uint8_t)(selected >> 16);
+  *(response+8) = (uint8_t)(selected >> 24);
+  *(response+9) = (selected != 0U) ? (uint8_t)(((best - selected) * 100U) / best) : 0U;
+  *(response+10) = (uint8_t)steps;
+
+  return ((9U << 16) | 11U);
+}
+
+#endif  /* (DAP_SWD != 0) */
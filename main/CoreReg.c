@@ -0,0 +1,159 @@
+// Bulk Cortex-M core register access
+// Runs the DCRSR/DHCSR/DCRDR handshake for every selected register on the probe,
+// so that a whole register set is transferred in one command instead of several packets.
+// DHCSR, DCRSR and DCRDR share one 16-byte block and are accessed through the MEM-AP banked data registers.
+
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// DCRSR fields
+#define DCRSR_REGWnR            (1U<<16)
+
+// Number of DHCSR reads while waiting for S_REGRDY
+#define REGRDY_RETRY            100U
+
+// Maximum number of registers in one command
+#define COREREG_READ_MAX        ((DAP_PACKET_SIZE - 3U) / 4U)
+#define COREREG_WRITE_MAX       ((DAP_PACKET_SIZE - 8U) / 4U)
+
+
+// Wait for completion of a core register transfer
+//   return: ACK[2:0] (DAP_TRANSFER_ERROR on timeout)
+static uint8_t CoreReg_WaitReady (void) {
+  uint32_t dhcsr;
+  uint32_t retry;
+  uint8_t  ack;
+
+  retry = REGRDY_RETRY;
+  do {
+    ack = MEM_ReadBanked(DHCSR, &dhcsr);
+    if (ack != DAP_TRANSFER_OK) {
+      return (ack);
+    }
+    if ((dhcsr & DHCSR_S_REGRDY) != 0U) {
+      return (DAP_TRANSFER_OK);
+    }
+  } while (--retry);
+
+  return (DAP_TRANSFER_ERROR);
+}
+
+
+// Process Core Register Transfer command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  AP index (1), control (1: bit0 = write), REGSEL base (1), register mask (4),
+//           write data for every set bit of the mask (4 each, write only)
+// Response: number of transferred registers (1), transfer response (1),
+//           read data for every transferred register (4 each, read only)
+// Registers are transferred in order of the mask bits (REGSEL = base + bit number).
+// A read stops when the response is full; the host repeats the command for the remaining bits.
+uint32_t CoreReg_Transfer (const uint8_t *request, uint8_t *response) {
+  const uint8_t *request_data;
+        uint8_t *response_data;
+  uint32_t request_count;
+  uint32_t response_count;
+  uint32_t write;
+  uint32_t regsel;
+  uint32_t mask;
+  uint32_t count;
+  uint32_t data;
+  uint8_t  ack;
+
+  write  = *(request+1) & 0x01U;
+  regsel = *(request+2);
+  mask   = (uint32_t)(*(request+3) <<  0) |
+           (uint32_t)(*(request+4) <<  8) |
+           (uint32_t)(*(request+5) << 16) |
+           (uint32_t)(*(request+6) << 24);
+
+  request_data   = request  + 7;
+  response_data  = response + 2;
+  request_count  = 7U;
+  response_count = 0U;
+
+  count = 0U;
+  for (data = mask; data != 0U; data &= data - 1U) {
+    count++;
+  }
+  if (write) {
+    // The request holds write data for every bit of the mask, also when it is rejected
+    request_count += count * 4U;
+    if (count > COREREG_WRITE_MAX) {
+      ack = DAP_TRANSFER_ERROR;
+      goto end;
+    }
+  }
+
+  ack = MEM_Open(*request);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetBanked(DHCSR);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    // Core registers are only accessible in Debug state
+    ack = MEM_ReadBanked(DHCSR, &data);
+    if ((ack == DAP_TRANSFER_OK) && ((data & DHCSR_S_HALT) == 0U)) {
+      ack = DAP_TRANSFER_ERROR;
+    }
+  }
+
+  for (; (mask != 0U) && (ack == DAP_TRANSFER_OK); mask >>= 1, regsel++) {
+    if ((mask & 1U) == 0U) {
+      continue;
+    }
+    if (!write && (response_count == COREREG_READ_MAX)) {
+      break;
+    }
+    if (write) {
+      data = (uint32_t)(*(request_data+0) <<  0) |
+             (uint32_t)(*(request_data+1) <<  8) |
+             (uint32_t)(*(request_data+2) << 16) |
+             (uint32_t)(*(request_data+3) << 24);
+      request_data += 4;
+      ack = MEM_WriteBanked(DCRDR, data);
+      if (ack == DAP_TRANSFER_OK) {
+        ack = MEM_WriteBanked(DCRSR, DCRSR_REGWnR | regsel);
+      }
+      if (ack == DAP_TRANSFER_OK) {
+        ack = CoreReg_WaitReady();
+      }
+    } else {
+      ack = MEM_WriteBanked(DCRSR, regsel);
+      if (ack == DAP_TRANSFER_OK) {
+        ack = CoreReg_WaitReady();
+      }
+      if (ack == DAP_TRANSFER_OK) {
+        ack = MEM_ReadBanked(DCRDR, &data);
+      }
+      if (ack == DAP_TRANSFER_OK) {
+        *response_data++ = (uint8_t) data;
+        *response_data++ = (uint8_t)(data >>  8);
+        *response_data++ = (uint8_t)(data >> 16);
+        *response_data++ = (uint8_t)(data >> 24);
+      }
+    }
+    if (ack == DAP_TRANSFER_OK) {
+      response_count++;
+    }
+  }
+
+  if ((MEM_Close() != DAP_TRANSFER_OK) && (ack == DAP_TRANSFER_OK)) {
+    ack = DAP_TRANSFER_ERROR;
+  }
+
+end:
+  *(response+0) = (uint8_t)response_count;
+  *(response+1) = (uint8_t)ack;
+
+  if (write) {
+    return ((request_count << 16) | 2U);
+  }
+  return ((request_count << 16) | (2U + (response_count * 4U)));
+}
+
+#endif  /* (DAP_SWD != 0) */
@@ -49,8 +49,7 @@
   ((CPU_CLOCK/2U) / (IO_PORT_WRITE_CYCLES + delay_cycles))
 
 
-         DAP_Data_t DAP_Data;           // DAP Data
-volatile uint8_t    DAP_TransferAbort;  // Transfer Abort Flag
+__thread DAP_Instance_t *DAP_Instance;  // DAP Instance of the calling task
 
 
 static const char DAP_FW_Ver [] = DAP_FW_VER;
@@ -174,6 +173,10 @@ static uint8_t DAP_Info(uint8_t id, uint8_t *info) {
       info[0] = DAP_PACKET_COUNT;
       length = 1U;
       break;
+    case DAP_ID_VENDOR_CAPABILITIES:
+      info[0] = ((DAP_SWD != 0) ? DAP_VENDOR_CAP_PIPELINE : 0U);
+      length = 1U;
+      break;
     default:
       break;
   }
@@ -251,11 +254,19 @@ static uint32_t DAP_Connect(const uint8_t *request, uint8_t *response) {
 #if (DAP_SWD != 0)
     case DAP_PORT_SWD:
       DAP_Data.debug_port = DAP_PORT_SWD;
+      DAP_Data.shadow.valid = 0U;
+      DAP_Data.multidrop.selected = 0U;
+      memset(&DAP_Data.wait, 0, sizeof(DAP_Data.wait));
+      MultiDrop_Reset();
       PORT_SWD_SETUP();
       break;
 #endif
 #if (DAP_JTAG != 0)
     case DAP_PORT_JTAG:
+      if (PORT_JTAG_AVAILABLE() == 0U) {
+        port = DAP_PORT_DISABLED;
+        break;
+      }
       DAP_Data.debug_port = DAP_PORT_JTAG;
       PORT_JTAG_SETUP();
       break;
@@ -276,6 +287,10 @@ static uint32_t DAP_Connect(const uint8_t *request, uint8_t *response) {
 static uint32_t DAP_Disconnect(uint8_t *response) {
 
   DAP_Data.debug_port = DAP_PORT_DISABLED;
+  DAP_Data.transfer.pipeline = 0U;
+#if (DAP_SWD != 0)
+  DAP_Data.shadow.valid = 0U;
+#endif
   PORT_OFF();
 
   *response = DAP_OK;
@@ -288,6 +303,9 @@ static uint32_t DAP_Disconnect(uint8_t *response) {
 //   return:   number of bytes in response
 static uint32_t DAP_ResetTarget(uint8_t *response) {
 
+#if (DAP_SWD != 0)
+  DAP_Data.shadow.valid &= ~(DAP_SHADOW_CSW | DAP_SHADOW_TAR);
+#endif
   *(response+1) = RESET_TARGET();
   *(response+0) = DAP_OK;
   return (2U);
@@ -672,6 +690,59 @@ static uint32_t DAP_TransferConfigure(const uint8_t *request, uint8_t *response)
 }
 
 
+#if (DAP_SWD != 0)
+// Check if a Transfer command starts with an AP read which can complete a carried posted read
+//   request:  pointer to request data (after Command ID)
+//   return:   1 when the posted read can be carried into the command
+static uint32_t DAP_TransferCanCarry(const uint8_t *request) {
+  if (*(request+1) == 0U) {
+    return (0U);
+  }
+  return ((*(request+2) & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_VALUE)) ==
+          (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW));
+}
+#endif
+
+
+// Complete a posted read which was carried over from the last Transfer command
+void DAP_TransferFlush(void) {
+#if (DAP_SWD != 0)
+  uint32_t retry;
+  uint32_t data;
+  uint8_t  ack;
+
+  if (DAP_Instance->carry == NULL) {
+    return;
+  }
+
+  retry = DAP_Data.transfer.retry_count;
+  do {
+    ack = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
+  } while ((ack == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+  if (ack == DAP_TRANSFER_OK) {
+    *(DAP_Instance->carry+0) = (uint8_t) data;
+    *(DAP_Instance->carry+1) = (uint8_t)(data >>  8);
+    *(DAP_Instance->carry+2) = (uint8_t)(data >> 16);
+    *(DAP_Instance->carry+3) = (uint8_t)(data >> 24);
+  } else {
+    *(DAP_Instance->carry_head+1) = ack;
+  }
+  DAP_Instance->carry = NULL;
+#endif
+}
+
+
+// Check if the last response waits for a posted read carried into the next command
+//   return:   1 when the response must be held until the next command was executed
+uint32_t DAP_TransferCarried(void) {
+#if (DAP_SWD != 0)
+  return ((DAP_Instance->carry != NULL) ? 1U : 0U);
+#else
+  return (0U);
+#endif
+}
+
+
 // Process SWD Transfer command and prepare response
 //   request:  pointer to request data
 //   response: pointer to response data
@@ -692,6 +763,10 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
   uint32_t  match_retry;
   uint32_t  retry;
   uint32_t  data;
+  uint8_t  *carry;
+  uint8_t  *carry_head;
+  const
+  uint8_t  *next;
 #if (TIMESTAMP_CLOCK != 0U)
   uint32_t  timestamp;
 #endif
@@ -707,6 +782,20 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
 
   post_read   = 0U;
   check_write = 0U;
+  carry       = NULL;
+  carry_head  = NULL;
+
+  if (DAP_Instance->carry != NULL) {
+    if (DAP_TransferCanCarry(request_head)) {
+      // Read posted by the previous Transfer command completes with the first AP read
+      carry               = DAP_Instance->carry;
+      carry_head          = DAP_Instance->carry_head;
+      DAP_Instance->carry = NULL;
+      post_read           = 1U;
+    } else {
+      DAP_TransferFlush();
+    }
+  }
 
   request++;            // Ignore DAP index
 
@@ -734,11 +823,20 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
         if (response_value != DAP_TRANSFER_OK) {
           break;
         }
-        // Store previous AP data
-        *response++ = (uint8_t) data;
-        *response++ = (uint8_t)(data >>  8);
-        *response++ = (uint8_t)(data >> 16);
-        *response++ = (uint8_t)(data >> 24);
+        if (carry != NULL) {
+          // Store previous AP data in the response of the previous Transfer command
+          *(carry+0) = (uint8_t) data;
+          *(carry+1) = (uint8_t)(data >>  8);
+          *(carry+2) = (uint8_t)(data >> 16);
+          *(carry+3) = (uint8_t)(data >> 24);
+          carry = NULL;
+        } else {
+          // Store previous AP data
+          *response++ = (uint8_t) data;
+          *response++ = (uint8_t)(data >>  8);
+          *response++ = (uint8_t)(data >> 16);
+          *response++ = (uint8_t)(data >> 24);
+        }
 #if (TIMESTAMP_CLOCK != 0U)
         if (post_read) {
           // Store Timestamp of next AP read
@@ -893,6 +991,11 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
     }
   }
 
+  if (carry != NULL) {
+    // Carried read failed, report it in the previous Transfer command as well
+    *(carry_head+1) = (uint8_t)response_value;
+  }
+
   for (; request_count != 0U; request_count--) {
     // Process canceled requests
     request_value = *request++;
@@ -909,7 +1012,13 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
   }
 
   if (response_value == DAP_TRANSFER_OK) {
-    if (post_read) {
+    if (post_read && DAP_Data.transfer.pipeline && (DAP_Instance->depth == 1U) &&
+        ((next = DAP_PeekRequest()) != NULL) && (*next == ID_DAP_Transfer) && DAP_TransferCanCarry(next+1)) {
+      // Next Transfer command is already queued, its first AP read returns the data
+      DAP_Instance->carry      = response;
+      DAP_Instance->carry_head = response_head;
+      response += 4;
+    } else if (post_read) {
       // Read previous data
       retry = DAP_Data.transfer.retry_count;
       do {
@@ -933,6 +1042,9 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
   }
 
 end:
+  if ((response_value == DAP_TRANSFER_WAIT) && !DAP_TransferAbort) {
+    DAP_Stats.wait_exhausted++;
+  }
   *(response_head+0) = (uint8_t)response_count;
   *(response_head+1) = (uint8_t)response_value;
 
@@ -1373,6 +1485,9 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
   }
 
 end:
+  if ((response_value == DAP_TRANSFER_WAIT) && !DAP_TransferAbort) {
+    DAP_Stats.wait_exhausted++;
+  }
   *(response_head+0) = (uint8_t)(response_count >> 0);
   *(response_head+1) = (uint8_t)(response_count >> 8);
   *(response_head+2) = (uint8_t) response_value;
@@ -1639,6 +1754,11 @@ __WEAK uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *respon
 uint32_t DAP_ProcessCommand(const uint8_t *request, uint8_t *response) {
   uint32_t num;
 
+  if (*request != ID_DAP_Transfer) {
+    // Only a Transfer command can pick up a carried posted read
+    DAP_TransferFlush();
+  }
+
   if ((*request >= ID_DAP_Vendor0) && (*request <= ID_DAP_Vendor31)) {
     return DAP_ProcessVendorCommand(request, response);
   }
@@ -1770,6 +1890,8 @@ uint32_t DAP_ProcessCommand(const uint8_t *request, uint8_t *response) {
 uint32_t DAP_ExecuteCommand(const uint8_t *request, uint8_t *response) {
   uint32_t cnt, num, n;
 
+  DAP_Instance->depth++;
+
   if (*request == ID_DAP_ExecuteCommands) {
     *response++ = *request++;
     cnt = *request++;
@@ -1781,10 +1903,12 @@ uint32_t DAP_ExecuteCommand(const uint8_t *request, uint8_t *response) {
       request  += (uint16_t)(n >> 16);
       response += (uint16_t) n;
     }
-    return (num);
+  } else {
+    num = DAP_ProcessCommand(request, response);
   }
 
-  return DAP_ProcessCommand(request, response);
+  DAP_Instance->depth--;
+  return (num);
 }
 
 
@@ -1794,12 +1918,16 @@ void DAP_Setup(void) {
   // Default settings
   DAP_Data.debug_port  = 0U;
   DAP_Data.transfer.idle_cycles = 0U;
+  DAP_Data.transfer.pipeline    = 0U;
   DAP_Data.transfer.retry_count = 100U;
   DAP_Data.transfer.match_retry = 0U;
   DAP_Data.transfer.match_mask  = 0x00000000U;
 #if (DAP_SWD != 0)
   DAP_Data.swd_conf.turnaround  = 1U;
   DAP_Data.swd_conf.data_phase  = 0U;
+  DAP_Data.shadow.valid         = 0U;
+  DAP_Data.multidrop.selected   = 0U;
+  memset(&DAP_Data.wait, 0, sizeof(DAP_Data.wait));
 #endif
 #if (DAP_JTAG != 0)
   DAP_Data.jtag_dev.count = 0U;
@@ -108,6 +108,24 @@
 
 #define ID_DAP_Invalid                  0xFFU
 
+// bluedap Vendor Command IDs
+#define ID_DAP_Monitor                  ID_DAP_Vendor0
+#define ID_DAP_CoreRegTransfer          ID_DAP_Vendor1
+#define ID_DAP_RTT                      ID_DAP_Vendor2
+#define ID_DAP_PCSample                 ID_DAP_Vendor3
+#define ID_DAP_Logger                   ID_DAP_Vendor4
+#define ID_DAP_Script                   ID_DAP_Vendor5
+#define ID_DAP_Macro                    ID_DAP_Vendor6
+#define ID_DAP_Statistics               ID_DAP_Vendor7
+#define ID_DAP_TransferPipeline         ID_DAP_Vendor8
+#define ID_DAP_ClockTune                ID_DAP_Vendor9
+#define ID_DAP_TargetSelect             ID_DAP_Vendor10
+#define ID_DAP_Gang                     ID_DAP_Vendor11
+#define ID_DAP_Benchmark                ID_DAP_Vendor12
+#define ID_DAP_ITMFilter                ID_DAP_Vendor13
+#define ID_DAP_UARTBridge               ID_DAP_Vendor14
+#define ID_DAP_Trace                    ID_DAP_Vendor15
+
 // DAP Status Code
 #define DAP_OK                          0U
 #define DAP_ERROR                       0xFFU
@@ -130,6 +148,12 @@
 #define DAP_ID_PACKET_COUNT             0xFEU
 #define DAP_ID_PACKET_SIZE              0xFFU
 
+// bluedap Vendor DAP Info IDs
+#define DAP_ID_VENDOR_CAPABILITIES      0x80U
+
+// Vendor Capabilities
+#define DAP_VENDOR_CAP_PIPELINE         (1U<<0) // Posted reads carried across Transfer commands
+
 // DAP Host Status
 #define DAP_DEBUGGER_CONNECTED          0U
 #define DAP_TARGET_RUNNING              1U
@@ -209,6 +233,32 @@
 #define DP_RESEND                       0x08U   // Resend (SW Read Only)
 #define DP_RDBUFF                       0x0CU   // Read Buffer (Read Only)
 
+// DP SELECT Fields
+#define DP_SELECT_APSEL                 0xFF000000U
+#define DP_SELECT_APBANKSEL             0x000000F0U
+
+// MEM-AP Register Addresses (Bank 0)
+#define AP_CSW                          0x00U   // Control/Status Word
+#define AP_TAR                          0x04U   // Transfer Address
+#define AP_DRW                          0x0CU   // Data Read/Write
+
+// MEM-AP CSW Fields
+#define AP_CSW_ADDRINC                  0x00000030U
+
+// Cortex-M Debug Register Addresses
+#define DHCSR                           0xE000EDF0U     // Debug Halting Control and Status
+#define DCRSR                           0xE000EDF4U     // Debug Core Register Selector
+#define DCRDR                           0xE000EDF8U     // Debug Core Register Data
+#define DEMCR                           0xE000EDFCU     // Debug Exception and Monitor Control
+
+// Cortex-M DHCSR Status Bits
+#define DHCSR_S_REGRDY                  (1U<<16)
+#define DHCSR_S_HALT                    (1U<<17)
+#define DHCSR_S_SLEEP                   (1U<<18)
+#define DHCSR_S_LOCKUP                  (1U<<19)
+#define DHCSR_S_RETIRE_ST               (1U<<24)
+#define DHCSR_S_RESET_ST                (1U<<25)
+
 // JTAG IR Codes
 #define JTAG_ABORT                      0x08U
 #define JTAG_DPACC                      0x0AU
@@ -230,6 +280,9 @@
 #include <stdint.h>
 #include "cmsis_compiler.h"
 
+// Number of APs (APSEL 0..n-1) with learned idle cycles
+#define DAP_WAIT_AP_COUNT               8U
+
 // DAP Data structure
 typedef struct {
   uint8_t     debug_port;                       // Debug Port
@@ -239,7 +292,8 @@ typedef struct {
   uint32_t     timestamp;                       // Last captured Timestamp
   struct {                                      // Transfer Configuration
     uint8_t   idle_cycles;                      // Idle cycles after transfer
-    uint8_t    padding[3];
+    uint8_t   pipeline;                         // Carry posted reads into the next Transfer command
+    uint8_t    padding[2];
     uint16_t  retry_count;                      // Number of retries after WAIT response
     uint16_t  match_retry;                      // Number of retries if read value does not match
     uint32_t  match_mask;                       // Match Mask
@@ -249,6 +303,24 @@ typedef struct {
     uint8_t    turnaround;                      // Turnaround period
     uint8_t    data_phase;                      // Always generate Data Phase
   } swd_conf;
+  struct {                                      // Shadow copies of DP/AP registers
+    uint8_t   valid;                            // Valid flags (DAP_SHADOW_xxx)
+    uint8_t   padding[3];
+    uint32_t  select;                           // DP SELECT
+    uint32_t  csw;                              // AP CSW (last written value)
+    uint32_t  tar;                              // AP TAR
+  } shadow;
+  struct {                                      // Adaptive WAIT handling
+    uint8_t   idle[DAP_WAIT_AP_COUNT];          // Learned idle cycles after accesses of AP 0..7
+    uint8_t   extra;                            // Idle cycles added to the current transfer
+    uint8_t   streak;                           // Consecutive WAIT responses
+    uint16_t  calm;                             // AP transfers without WAIT since the last change
+  } wait;
+  struct {                                      // SWD multi-drop
+    uint8_t   selected;                         // Target selected since the last line reset
+    uint8_t   padding[3];
+    uint32_t  targetsel;                        // TARGETSEL of the selected target
+  } multidrop;
 #endif
 #if (DAP_JTAG != 0)
   struct {                                      // JTAG Device Chain
@@ -263,8 +335,52 @@ typedef struct {
 #endif
 } DAP_Data_t;
 
-extern          DAP_Data_t DAP_Data;            // DAP Data
-extern volatile uint8_t    DAP_TransferAbort;   // Transfer Abort Flag
+// DAP Shadow Valid Flags
+#define DAP_SHADOW_SELECT               (1U<<0)
+#define DAP_SHADOW_CSW                  (1U<<1)
+#define DAP_SHADOW_TAR                  (1U<<2)
+
+// DAP Statistics
+typedef struct {
+  uint32_t elided_select;                       // Elided DP SELECT writes
+  uint32_t elided_csw;                          // Elided AP CSW writes
+  uint32_t elided_tar;                          // Elided AP TAR writes
+  uint32_t waits;                               // WAIT responses
+  uint32_t wait_exhausted;                      // Transfers failed after all WAIT retries
+  uint32_t wait_streak_max;                     // Longest run of WAIT responses
+  uint32_t wait_idle;                           // Learned idle cycles of the last adapted AP
+} DAP_Stats_t;
+
+// Poll interval returned when no background job is active
+#define DAP_POLL_IDLE                   0xFFFFFFFFU
+
+// Trace multiplexer sources
+#define TRACE_SOURCE_SWO                0x00U
+#define TRACE_SOURCE_UART               0x01U
+#define TRACE_SOURCE_RTT                0x10U   // RTT up buffer n is TRACE_SOURCE_RTT + n
+
+// Test Domain Timer ticks per microsecond (used to schedule background jobs)
+#define TIMESTAMP_TICKS_PER_US          (TIMESTAMP_CLOCK / 1000000U)
+
+// DAP Instance (one per DAP endpoint, each is served by its own task)
+typedef struct {
+  DAP_Data_t        data;                       // DAP Data
+  DAP_Stats_t       stats;                      // DAP Statistics
+  volatile uint8_t  abort;                      // Transfer Abort Flag
+  uint8_t           index;                      // Instance index (vendor modules run on instance 0)
+  uint8_t           padding[2];
+  uint32_t          depth;                      // Nesting level of DAP_ExecuteCommand (macros and scripts)
+#if (DAP_SWD != 0)
+  uint8_t          *carry;                      // Response data of a posted read carried into the next command
+  uint8_t          *carry_head;                 // Response head (count, value) of the carried Transfer command
+#endif
+} DAP_Instance_t;
+
+extern __thread DAP_Instance_t *DAP_Instance;   // DAP Instance of the calling task
+
+#define DAP_Data                        (DAP_Instance->data)
+#define DAP_Stats                       (DAP_Instance->stats)
+#define DAP_TransferAbort               (DAP_Instance->abort)
 
 
 #ifdef  __cplusplus
@@ -281,6 +397,7 @@ extern uint32_t JTAG_ReadIDCode (void);
 extern void     JTAG_WriteAbort (uint32_t data);
 extern uint8_t  JTAG_Transfer   (uint32_t request, uint32_t *data);
 extern uint8_t  SWD_Transfer    (uint32_t request, uint32_t *data);
+extern uint8_t  SWD_TargetSelect(uint32_t targetsel, uint32_t *idcode);
 
 extern void     Delayms         (uint32_t delay);
 
@@ -313,10 +430,64 @@ extern uint32_t UART_Configure (const uint8_t *request, uint8_t *response);
 extern uint32_t UART_Control   (const uint8_t *request, uint8_t *response);
 extern uint32_t UART_Status                            (uint8_t *response);
 extern uint32_t UART_Transfer  (const uint8_t *request, uint8_t *response);
+extern void     UART_Setup     (void);
+extern uint32_t UART_Bridge    (const uint8_t *request, uint8_t *response);
 
 extern uint8_t  USB_COM_PORT_Activate (uint32_t cmd);
 
+extern uint8_t  MEM_Open       (uint32_t apsel);
+extern uint8_t  MEM_Close      (void);
+extern uint8_t  MEM_Read       (uint32_t addr, uint32_t *data);
+extern uint8_t  MEM_Write      (uint32_t addr, uint32_t  data);
+extern uint8_t  MEM_ReadBlock  (uint32_t addr, uint32_t *data, uint32_t count);
+extern uint8_t  MEM_WriteBlock (uint32_t addr, const uint32_t *data, uint32_t count);
+extern uint8_t  MEM_WriteBytes (uint32_t addr, const uint8_t  *data, uint32_t count);
+extern uint8_t  MEM_CheckTAR   (uint32_t addr);
+extern uint8_t  MEM_SetBanked  (uint32_t addr);
+extern uint8_t  MEM_ReadBanked (uint32_t addr, uint32_t *data);
+extern uint8_t  MEM_WriteBanked(uint32_t addr, uint32_t  data);
+
+extern uint32_t Monitor_Configure (const uint8_t *request, uint8_t *response);
+extern uint32_t Monitor_Poll      (void);
+
+extern uint32_t CoreReg_Transfer  (const uint8_t *request, uint8_t *response);
+
+extern uint32_t RTT_Configure     (const uint8_t *request, uint8_t *response);
+extern uint32_t RTT_Poll          (void);
+
+extern uint32_t PCSample_Configure(const uint8_t *request, uint8_t *response);
+extern uint32_t PCSample_Poll     (void);
+
+extern uint32_t Logger_Configure  (const uint8_t *request, uint8_t *response);
+extern uint32_t Logger_Poll       (void);
+
+extern uint32_t Script_Process    (const uint8_t *request, uint8_t *response);
+
+extern uint32_t Macro_Process     (const uint8_t *request, uint8_t *response);
+
+extern uint32_t ClockTune_Process (const uint8_t *request, uint8_t *response);
+
+extern uint32_t MultiDrop_Select  (const uint8_t *request, uint8_t *response);
+extern void     MultiDrop_Reset   (void);
+
+extern uint32_t Gang_Process      (const uint8_t *request, uint8_t *response);
+
+extern uint32_t Benchmark_Process (const uint8_t *request, uint8_t *response);
+
+extern uint32_t ITM_Configure     (const uint8_t *request, uint8_t *response);
+extern uint32_t ITM_Filter        (const uint8_t *data, uint32_t num, uint8_t *out, uint32_t size, uint32_t *count);
+extern uint32_t ITM_Active        (void);
+extern void     ITM_Reset         (void);
+extern uint32_t Trace_Configure   (const uint8_t *request, uint8_t *response);
+extern uint32_t Trace_Routed      (uint32_t source);
+extern uint32_t Trace_Put         (uint32_t source, const uint8_t *data, uint32_t num, uint32_t time);
+
+extern void     DAP_TransferFlush        (void);
+extern uint32_t DAP_TransferCarried      (void);
+extern const uint8_t *DAP_PeekRequest    (void);
+
 extern uint32_t DAP_ProcessVendorCommand (const uint8_t *request, uint8_t *response);
+extern uint32_t DAP_ProcessVendorPoll    (void);
 extern uint32_t DAP_ProcessCommand       (const uint8_t *request, uint8_t *response);
 extern uint32_t DAP_ExecuteCommand       (const uint8_t *request, uint8_t *response);
 
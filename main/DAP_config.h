@@ -55,8 +55,11 @@ This information includes:
 #include "cmsis_compiler.h"
 #include "sdkconfig.h"
 #include "esp_timer.h"
+#include "esp_attr.h"
 #include "driver/gpio.h"
 #include "driver/gptimer.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
 #include "esp_log.h"
 
 /// Processor Clock of the Cortex-M MCU used in the Debug Unit.
@@ -77,7 +80,20 @@ This information includes:
 
 /// Indicate that JTAG communication mode is available at the Debug Port.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_DAP_JTAG
+#define DAP_JTAG                1               ///< JTAG Mode: 1 = available, 0 = not available.
+#else
 #define DAP_JTAG                0               ///< JTAG Mode: 1 = available, 0 = not available.
+#endif
+
+/// Shift long constant-TMS JTAG segments through the SPI peripheral (TCK = SCLK, TDI = MOSI, TDO = MISO).
+#if (DAP_JTAG != 0) && defined(CONFIG_DAP_JTAG_SPI)
+#define DAP_JTAG_SPI            1               ///< JTAG SPI shifts: 1 = enabled, 0 = bit-bang only.
+#define JTAG_SPI_MIN_BITS       ((uint32_t)CONFIG_DAP_JTAG_SPI_MIN_BITS) ///< Shorter segments are bit-banged.
+#define JTAG_SPI_CLOCK_MAX      ((uint32_t)CONFIG_DAP_JTAG_SPI_CLOCK_MAX * 1000U) ///< SPI clock used for the fast SWJ clock in Hz.
+#else
+#define DAP_JTAG_SPI            0               ///< JTAG SPI shifts: 1 = enabled, 0 = bit-bang only.
+#endif
 
 /// Configure maximum number of JTAG devices on the scan chain connected to the Debug Access Port.
 /// This setting impacts the RAM requirements of the Debug Unit. Valid range is 1 .. 255.
@@ -106,43 +122,83 @@ This information includes:
 
 /// Indicate that UART Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_SWO_UART
+#define SWO_UART                1               ///< SWO UART:  1 = available, 0 = not available.
+#else
 #define SWO_UART                0               ///< SWO UART:  1 = available, 0 = not available.
+#endif
 
-/// USART Driver instance number for the UART SWO.
-#define SWO_UART_DRIVER         0               ///< USART Driver instance number (Driver_USART#).
+/// UART port number for the UART SWO.
+#ifdef CONFIG_SWO_UART
+#define SWO_UART_DRIVER         CONFIG_SWO_UART_NUM ///< UART port number of the ESP-IDF UART driver (UART_NUM_x).
+#endif
 
 /// Maximum SWO UART Baudrate.
-#define SWO_UART_MAX_BAUDRATE   10000000U       ///< SWO UART Maximum Baudrate in Hz.
+#define SWO_UART_MAX_BAUDRATE   5000000U        ///< SWO UART Maximum Baudrate in Hz.
 
 /// Indicate that Manchester Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_SWO_MANCHESTER
+#define SWO_MANCHESTER          1               ///< SWO Manchester:  1 = available, 0 = not available.
+#else
 #define SWO_MANCHESTER          0               ///< SWO Manchester:  1 = available, 0 = not available.
+#endif
 
 /// SWO Trace Buffer Size.
+#ifdef CONFIG_SWO_BUFFER_SIZE
+#define SWO_BUFFER_SIZE         ((uint32_t)CONFIG_SWO_BUFFER_SIZE) ///< SWO Trace Buffer Size in bytes (must be 2^n).
+#else
 #define SWO_BUFFER_SIZE         4096U           ///< SWO Trace Buffer Size in bytes (must be 2^n).
+#endif
+
+/// Placement of the SWO Trace Buffer and the UART Receive Buffer.
+/// With PSRAM, the buffers are placed in external RAM, which allows megabyte sizes.
+#ifdef CONFIG_TRACE_BUFFERS_PSRAM
+#define TRACE_BUFFER_ATTR       EXT_RAM_BSS_ATTR
+#else
+#define TRACE_BUFFER_ATTR
+#endif
 
 /// SWO Streaming Trace.
+/// Trace data is sent as notifications on the SWO characteristic of the BLE stream service.
+#if ((SWO_UART != 0) || (SWO_MANCHESTER != 0))
+#define SWO_STREAM              1               ///< SWO Streaming Trace: 1 = available, 0 = not available.
+#else
 #define SWO_STREAM              0               ///< SWO Streaming Trace: 1 = available, 0 = not available.
+#endif
 
 /// Clock frequency of the Test Domain Timer. Timer value is returned with \ref TIMESTAMP_GET.
 #define TIMESTAMP_CLOCK         (CPU_CLOCK / 4)     ///< Timestamp clock in Hz (0 = timestamps not supported).
 
 /// Indicate that UART Communication Port is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#ifdef CONFIG_DAP_UART
+#define DAP_UART                1               ///< DAP UART:  1 = available, 0 = not available.
+#else
 #define DAP_UART                0               ///< DAP UART:  1 = available, 0 = not available.
+#endif
 
-/// USART Driver instance number for the UART Communication Port.
-#define DAP_UART_DRIVER         1               ///< USART Driver instance number (Driver_USART#).
+/// UART port number for the UART Communication Port.
+#ifdef CONFIG_DAP_UART
+#define DAP_UART_DRIVER         CONFIG_DAP_UART_NUM ///< UART port number of the ESP-IDF UART driver (UART_NUM_x).
+#else
+#define DAP_UART_DRIVER         1               ///< UART port number of the ESP-IDF UART driver (UART_NUM_x).
+#endif
 
 /// UART Receive Buffer Size.
-#define DAP_UART_RX_BUFFER_SIZE 1024U           ///< Uart Receive Buffer Size in bytes (must be 2^n).
+#ifdef CONFIG_DAP_UART_RX_BUFFER_SIZE
+#define DAP_UART_RX_BUFFER_SIZE ((uint32_t)CONFIG_DAP_UART_RX_BUFFER_SIZE) ///< Uart Receive Buffer Size in bytes (must be 2^n).
+#else
+#define DAP_UART_RX_BUFFER_SIZE 4096U           ///< Uart Receive Buffer Size in bytes (must be 2^n).
+#endif
 
 /// UART Transmit Buffer Size.
-#define DAP_UART_TX_BUFFER_SIZE 1024U           ///< Uart Transmit Buffer Size in bytes (must be 2^n).
+#define DAP_UART_TX_BUFFER_SIZE 1024U           ///< Uart Transmit Buffer Size in bytes (ring buffer of the UART driver).
 
 /// Indicate that UART Communication via USB COM Port is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
-#define DAP_UART_USB_COM_PORT   0               ///< USB COM Port:  1 = available, 0 = not available.
+/// The COM port is the Nordic UART Service (NUS) of the BLE connection.
+#define DAP_UART_USB_COM_PORT   DAP_UART        ///< USB COM Port:  1 = available, 0 = not available.
 
 /// Debug Unit is connected to fixed Target Device.
 /// The Debug Unit may be part of an evaluation board and always connected to a fixed
@@ -165,6 +221,114 @@ static const char TargetBoardName    [] = TARGET_BOARD_NAME;
 
 extern gptimer_handle_t gptimer;  // Defined in hid_dap.c
 
+// I/O pins of a DAP instance
+typedef struct {
+  uint8_t swclk;                                // SWCLK/TCK
+  uint8_t swdio;                                // SWDIO/TMS
+  uint8_t nreset;
+  uint8_t tdi;                                  // DAP_PIN_NONE: no JTAG on this instance
+  uint8_t tdo;
+  uint8_t ntrst;                                // DAP_PIN_NONE: not connected
+} DAP_Pins_t;
+
+#define DAP_PIN_NONE            0xFFU
+
+// JTAG pins of the first DAP instance (TDI, TDO, nTRST)
+#if (DAP_JTAG != 0)
+#if (CONFIG_PIN_NTRST >= 0)
+#define DAP_PINS_JTAG           CONFIG_PIN_TDI, CONFIG_PIN_TDO, CONFIG_PIN_NTRST
+#else
+#define DAP_PINS_JTAG           CONFIG_PIN_TDI, CONFIG_PIN_TDO, DAP_PIN_NONE
+#endif
+#else
+#define DAP_PINS_JTAG           DAP_PIN_NONE, DAP_PIN_NONE, DAP_PIN_NONE
+#endif
+
+// GPIOs of the configured functions (a different negative number for a function which is not used)
+#define DAP_GPIO_SWCLK          CONFIG_PIN_SWCLK
+#define DAP_GPIO_SWDIO          CONFIG_PIN_SWDIO
+#define DAP_GPIO_NRESET         CONFIG_PIN_NRESET
+#if (DAP_JTAG != 0)
+#define DAP_GPIO_TDI            CONFIG_PIN_TDI
+#define DAP_GPIO_TDO            CONFIG_PIN_TDO
+#else
+#define DAP_GPIO_TDI            (-2)
+#define DAP_GPIO_TDO            (-3)
+#endif
+#if (DAP_JTAG != 0) && (CONFIG_PIN_NTRST >= 0)
+#define DAP_GPIO_NTRST          CONFIG_PIN_NTRST
+#else
+#define DAP_GPIO_NTRST          (-4)
+#endif
+#ifdef  CONFIG_PIN_SWO
+#define DAP_GPIO_SWO            CONFIG_PIN_SWO
+#else
+#define DAP_GPIO_SWO            (-5)
+#endif
+#ifdef  CONFIG_PIN_UART_TX
+#define DAP_GPIO_UART_TX        CONFIG_PIN_UART_TX
+#define DAP_GPIO_UART_RX        CONFIG_PIN_UART_RX
+#else
+#define DAP_GPIO_UART_TX        (-6)
+#define DAP_GPIO_UART_RX        (-7)
+#endif
+#ifdef  CONFIG_PIN_SWCLK_1
+#define DAP_GPIO_SWCLK_1        CONFIG_PIN_SWCLK_1
+#define DAP_GPIO_SWDIO_1        CONFIG_PIN_SWDIO_1
+#define DAP_GPIO_NRESET_1       CONFIG_PIN_NRESET_1
+#else
+#define DAP_GPIO_SWCLK_1        (-8)
+#define DAP_GPIO_SWDIO_1        (-9)
+#define DAP_GPIO_NRESET_1       (-10)
+#endif
+#ifdef  CONFIG_PIN_SWCLK_2
+#define DAP_GPIO_SWCLK_2        CONFIG_PIN_SWCLK_2
+#define DAP_GPIO_SWDIO_2        CONFIG_PIN_SWDIO_2
+#define DAP_GPIO_NRESET_2       CONFIG_PIN_NRESET_2
+#else
+#define DAP_GPIO_SWCLK_2        (-11)
+#define DAP_GPIO_SWDIO_2        (-12)
+#define DAP_GPIO_NRESET_2       (-13)
+#endif
+#ifdef  CONFIG_PIN_SWDIO_GANG1
+#define DAP_GPIO_GANG1          CONFIG_PIN_SWDIO_GANG1
+#else
+#define DAP_GPIO_GANG1          (-14)
+#endif
+#ifdef  CONFIG_PIN_SWDIO_GANG2
+#define DAP_GPIO_GANG2          CONFIG_PIN_SWDIO_GANG2
+#else
+#define DAP_GPIO_GANG2          (-15)
+#endif
+#ifdef  CONFIG_PIN_SWDIO_GANG3
+#define DAP_GPIO_GANG3          CONFIG_PIN_SWDIO_GANG3
+#else
+#define DAP_GPIO_GANG3          (-16)
+#endif
+
+// Number of functions on a GPIO
+#define DAP_GPIO_USERS(gpio)                                                    \
+  (((gpio) == DAP_GPIO_SWCLK)   + ((gpio) == DAP_GPIO_SWDIO)   + ((gpio) == DAP_GPIO_NRESET)   + \
+   ((gpio) == DAP_GPIO_TDI)     + ((gpio) == DAP_GPIO_TDO)     + ((gpio) == DAP_GPIO_NTRST)    + \
+   ((gpio) == DAP_GPIO_SWO)     + ((gpio) == DAP_GPIO_UART_TX) + ((gpio) == DAP_GPIO_UART_RX)  + \
+   ((gpio) == DAP_GPIO_SWCLK_1) + ((gpio) == DAP_GPIO_SWDIO_1) + ((gpio) == DAP_GPIO_NRESET_1) + \
+   ((gpio) == DAP_GPIO_SWCLK_2) + ((gpio) == DAP_GPIO_SWDIO_2) + ((gpio) == DAP_GPIO_NRESET_2) + \
+   ((gpio) == DAP_GPIO_GANG1)   + ((gpio) == DAP_GPIO_GANG2)   + ((gpio) == DAP_GPIO_GANG3))
+
+#if (DAP_GPIO_USERS(DAP_GPIO_SWCLK)    != 1) || (DAP_GPIO_USERS(DAP_GPIO_SWDIO)    != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_NRESET)   != 1) || (DAP_GPIO_USERS(DAP_GPIO_TDI)      != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_TDO)      != 1) || (DAP_GPIO_USERS(DAP_GPIO_NTRST)    != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_SWO)      != 1) || (DAP_GPIO_USERS(DAP_GPIO_UART_TX)  != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_UART_RX)  != 1) || (DAP_GPIO_USERS(DAP_GPIO_SWCLK_1)  != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_SWDIO_1)  != 1) || (DAP_GPIO_USERS(DAP_GPIO_NRESET_1) != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_SWCLK_2)  != 1) || (DAP_GPIO_USERS(DAP_GPIO_SWDIO_2)  != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_NRESET_2) != 1) || (DAP_GPIO_USERS(DAP_GPIO_GANG1)    != 1) || \
+    (DAP_GPIO_USERS(DAP_GPIO_GANG2)    != 1) || (DAP_GPIO_USERS(DAP_GPIO_GANG3)    != 1)
+#error "Two functions are configured on the same GPIO: check the pins in menuconfig"
+#endif
+
+extern __thread const DAP_Pins_t *DAP_Pins;     // Pins of the DAP instance of the calling task (defined in hid_dap.c)
+
 /** Get Vendor Name string.
 \param str Pointer to buffer to store the string (max 60 characters).
 \return String length (including terminating NULL character) or 0 (no string).
@@ -316,7 +480,51 @@ Configures the DAP Hardware I/O pins for JTAG mode:
  - TDO to input mode.
 */
 __STATIC_INLINE void PORT_JTAG_SETUP (void) {
-  ;
+  ESP_LOGI("DAP_config", "PORT_JTAG_SETUP");
+
+  REG_WRITE(GPIO_OUT_W1TS_REG, (1U << DAP_Pins->swclk) | (1U << DAP_Pins->swdio) | (1U << DAP_Pins->tdi));
+
+  gpio_config_t conf_tck_tms_tdi = {
+    .pin_bit_mask = (1ULL << DAP_Pins->swclk) | (1ULL << DAP_Pins->swdio) | (1ULL << DAP_Pins->tdi),
+    .mode = GPIO_MODE_INPUT_OUTPUT,
+    .pull_up_en = GPIO_PULLUP_DISABLE,
+    .pull_down_en = GPIO_PULLDOWN_DISABLE,
+    .intr_type = GPIO_INTR_DISABLE
+  };
+  ESP_ERROR_CHECK(gpio_config(&conf_tck_tms_tdi));
+
+  gpio_config_t conf_tdo = {
+    .pin_bit_mask = (1ULL << DAP_Pins->tdo),
+    .mode = GPIO_MODE_INPUT,
+    .pull_up_en = GPIO_PULLUP_ENABLE,
+    .pull_down_en = GPIO_PULLDOWN_DISABLE,
+    .intr_type = GPIO_INTR_DISABLE
+  };
+  ESP_ERROR_CHECK(gpio_config(&conf_tdo));
+
+  gpio_config_t conf_ntrst_nreset = {
+    .pin_bit_mask = (1ULL << DAP_Pins->nreset),
+    .mode = GPIO_MODE_INPUT_OUTPUT_OD,
+    .pull_up_en = GPIO_PULLUP_ENABLE,
+    .pull_down_en = GPIO_PULLDOWN_DISABLE,
+    .intr_type = GPIO_INTR_DISABLE
+  };
+  if (DAP_Pins->ntrst != DAP_PIN_NONE) {
+    REG_WRITE(GPIO_OUT_W1TS_REG, 1U << DAP_Pins->ntrst);
+    conf_ntrst_nreset.pin_bit_mask |= (1ULL << DAP_Pins->ntrst);
+  }
+  ESP_ERROR_CHECK(gpio_config(&conf_ntrst_nreset));
+}
+
+/** Check if the JTAG I/O pins are available on the DAP instance of the calling task.
+JTAG pins are accessed at register level (GPIO_OUT_W1TS/W1TC, GPIO_IN), so TCK (SWCLK), TMS (SWDIO),
+TDI, TDO and nTRST must be GPIO0..31.
+\return 1 = JTAG can be used, 0 = no JTAG pins.
+*/
+__STATIC_INLINE uint32_t PORT_JTAG_AVAILABLE (void) {
+  return ((DAP_Pins->tdi < 32U) && (DAP_Pins->tdo < 32U) &&
+          (DAP_Pins->swclk < 32U) && (DAP_Pins->swdio < 32U) &&
+          ((DAP_Pins->ntrst < 32U) || (DAP_Pins->ntrst == DAP_PIN_NONE))) ? 1U : 0U;
 }
 
 /** Setup SWD I/O pins: SWCLK, SWDIO, and nRESET.
@@ -328,7 +536,7 @@ __STATIC_INLINE void PORT_SWD_SETUP (void) {
   ESP_LOGI("DAP_config", "PORT_SWD_SETUP");
 
   gpio_config_t conf_swclk_swdio = {
-    .pin_bit_mask = (1ULL << CONFIG_PIN_SWCLK) | (1ULL << CONFIG_PIN_SWDIO),
+    .pin_bit_mask = (1ULL << DAP_Pins->swclk) | (1ULL << DAP_Pins->swdio),
     .mode = GPIO_MODE_INPUT_OUTPUT,
     .pull_up_en = GPIO_PULLUP_DISABLE,
     .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -337,7 +545,7 @@ __STATIC_INLINE void PORT_SWD_SETUP (void) {
   ESP_ERROR_CHECK(gpio_config(&conf_swclk_swdio));
 
   gpio_config_t conf_nreset = {
-    .pin_bit_mask = (1ULL << CONFIG_PIN_NRESET),
+    .pin_bit_mask = (1ULL << DAP_Pins->nreset),
     .mode = GPIO_MODE_INPUT_OUTPUT_OD,
     .pull_up_en = GPIO_PULLUP_ENABLE,
     .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -355,16 +563,22 @@ __STATIC_INLINE void PORT_OFF (void) {
 
   // Initial state of SWD pins have to be HIGH
   // See: CMSIS-DAP LPC-Link2 example https://github.com/ARM-software/CMSIS_5/blob/a75f01746df18bb5b929dfb8dc6c9407fac3a0f3/CMSIS/DAP/Firmware/Examples/LPC-Link2/DAP_config.h#L408-L415
-  gpio_set_level(CONFIG_PIN_SWCLK, 1);
-  gpio_set_level(CONFIG_PIN_SWDIO, 1);
+  gpio_set_level(DAP_Pins->swclk, 1);
+  gpio_set_level(DAP_Pins->swdio, 1);
 
   gpio_config_t conf = {
-    .pin_bit_mask = (1ULL << CONFIG_PIN_SWCLK) | (1ULL << CONFIG_PIN_SWDIO) | (1ULL << CONFIG_PIN_NRESET),
+    .pin_bit_mask = (1ULL << DAP_Pins->swclk) | (1ULL << DAP_Pins->swdio) | (1ULL << DAP_Pins->nreset),
     .mode = GPIO_MODE_DISABLE,
     .pull_up_en = GPIO_PULLUP_DISABLE,
     .pull_down_en = GPIO_PULLDOWN_DISABLE,
     .intr_type = GPIO_INTR_DISABLE
   };
+  if (DAP_Pins->tdi != DAP_PIN_NONE) {
+    conf.pin_bit_mask |= (1ULL << DAP_Pins->tdi) | (1ULL << DAP_Pins->tdo);
+  }
+  if (DAP_Pins->ntrst != DAP_PIN_NONE) {
+    conf.pin_bit_mask |= (1ULL << DAP_Pins->ntrst);
+  }
   ESP_ERROR_CHECK(gpio_config(&conf));
 }
 
@@ -375,21 +589,21 @@ __STATIC_INLINE void PORT_OFF (void) {
 \return Current status of the SWCLK/TCK DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_SWCLK_TCK_IN  (void) {
-  return gpio_get_level(CONFIG_PIN_SWCLK);
+  return gpio_get_level(DAP_Pins->swclk);
 }
 
 /** SWCLK/TCK I/O pin: Set Output to High.
 Set the SWCLK/TCK DAP hardware I/O pin to high level.
 */
 __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_SET (void) {
-  gpio_set_level(CONFIG_PIN_SWCLK, 1);
+  gpio_set_level(DAP_Pins->swclk, 1);
 }
 
 /** SWCLK/TCK I/O pin: Set Output to Low.
 Set the SWCLK/TCK DAP hardware I/O pin to low level.
 */
 __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_CLR (void) {
-  gpio_set_level(CONFIG_PIN_SWCLK, 0);
+  gpio_set_level(DAP_Pins->swclk, 0);
 }
 
 
@@ -399,35 +613,35 @@ __STATIC_FORCEINLINE void     PIN_SWCLK_TCK_CLR (void) {
 \return Current status of the SWDIO/TMS DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_SWDIO_TMS_IN  (void) {
-  return gpio_get_level(CONFIG_PIN_SWDIO);
+  return gpio_get_level(DAP_Pins->swdio);
 }
 
 /** SWDIO/TMS I/O pin: Set Output to High.
 Set the SWDIO/TMS DAP hardware I/O pin to high level.
 */
 __STATIC_FORCEINLINE void     PIN_SWDIO_TMS_SET (void) {
-  gpio_set_level(CONFIG_PIN_SWDIO, 1);
+  gpio_set_level(DAP_Pins->swdio, 1);
 }
 
 /** SWDIO/TMS I/O pin: Set Output to Low.
 Set the SWDIO/TMS DAP hardware I/O pin to low level.
 */
 __STATIC_FORCEINLINE void     PIN_SWDIO_TMS_CLR (void) {
-  gpio_set_level(CONFIG_PIN_SWDIO, 0);
+  gpio_set_level(DAP_Pins->swdio, 0);
 }
 
 /** SWDIO I/O pin: Get Input (used in SWD mode only).
 \return Current status of the SWDIO DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_SWDIO_IN      (void) {
-  return gpio_get_level(CONFIG_PIN_SWDIO);
+  return gpio_get_level(DAP_Pins->swdio);
 }
 
 /** SWDIO I/O pin: Set Output (used in SWD mode only).
 \param bit Output value for the SWDIO DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT     (uint32_t bit) {
-  gpio_set_level(CONFIG_PIN_SWDIO, bit & 0x1); // Filter out junk data in non-first bits (See SWD_TransferFunction in SW_DP.c)
+  gpio_set_level(DAP_Pins->swdio, bit & 0x1); // Filter out junk data in non-first bits (See SWD_TransferFunction in SW_DP.c)
 }
 
 /** SWDIO I/O pin: Switch to Output mode (used in SWD mode only).
@@ -435,7 +649,7 @@ Configure the SWDIO DAP hardware I/O pin to output mode. This function is
 called prior \ref PIN_SWDIO_OUT function calls.
 */
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_ENABLE  (void) {
-  ESP_ERROR_CHECK(gpio_set_direction(CONFIG_PIN_SWDIO, GPIO_MODE_INPUT_OUTPUT));
+  ESP_ERROR_CHECK(gpio_set_direction(DAP_Pins->swdio, GPIO_MODE_INPUT_OUTPUT));
 }
 
 /** SWDIO I/O pin: Switch to Input mode (used in SWD mode only).
@@ -443,7 +657,7 @@ Configure the SWDIO DAP hardware I/O pin to input mode. This function is
 called prior \ref PIN_SWDIO_IN function calls.
 */
 __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_DISABLE (void) {
-  ESP_ERROR_CHECK(gpio_set_direction(CONFIG_PIN_SWDIO, GPIO_MODE_INPUT));
+  ESP_ERROR_CHECK(gpio_set_direction(DAP_Pins->swdio, GPIO_MODE_INPUT));
 }
 
 
@@ -453,14 +667,14 @@ __STATIC_FORCEINLINE void     PIN_SWDIO_OUT_DISABLE (void) {
 \return Current status of the TDI DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_TDI_IN  (void) {
-  return (0U);
+  return ((REG_READ(GPIO_OUT_REG) >> DAP_Pins->tdi) & 1U);
 }
 
 /** TDI I/O pin: Set Output.
 \param bit Output value for the TDI DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE void     PIN_TDI_OUT (uint32_t bit) {
-  ;
+  REG_WRITE((bit & 1U) ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, 1U << DAP_Pins->tdi);
 }
 
 
@@ -470,7 +684,7 @@ __STATIC_FORCEINLINE void     PIN_TDI_OUT (uint32_t bit) {
 \return Current status of the TDO DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_TDO_IN  (void) {
-  return (0U);
+  return ((REG_READ(GPIO_IN_REG) >> DAP_Pins->tdo) & 1U);
 }
 
 
@@ -480,7 +694,10 @@ __STATIC_FORCEINLINE uint32_t PIN_TDO_IN  (void) {
 \return Current status of the nTRST DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_nTRST_IN   (void) {
-  return (0U);
+  if (DAP_Pins->ntrst == DAP_PIN_NONE) {
+    return (0U);
+  }
+  return ((REG_READ(GPIO_IN_REG) >> DAP_Pins->ntrst) & 1U);
 }
 
 /** nTRST I/O pin: Set Output.
@@ -489,7 +706,9 @@ __STATIC_FORCEINLINE uint32_t PIN_nTRST_IN   (void) {
            - 1: release JTAG TRST Test Reset.
 */
 __STATIC_FORCEINLINE void     PIN_nTRST_OUT  (uint32_t bit) {
-  ;
+  if (DAP_Pins->ntrst != DAP_PIN_NONE) {
+    REG_WRITE((bit & 1U) ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, 1U << DAP_Pins->ntrst);
+  }
 }
 
 // nRESET Pin I/O------------------------------------------
@@ -498,7 +717,7 @@ __STATIC_FORCEINLINE void     PIN_nTRST_OUT  (uint32_t bit) {
 \return Current status of the nRESET DAP hardware I/O pin.
 */
 __STATIC_FORCEINLINE uint32_t PIN_nRESET_IN  (void) {
-  return gpio_get_level(CONFIG_PIN_NRESET);
+  return gpio_get_level(DAP_Pins->nreset);
 }
 
 /** nRESET I/O pin: Set Output.
@@ -507,7 +726,7 @@ __STATIC_FORCEINLINE uint32_t PIN_nRESET_IN  (void) {
            - 1: release device hardware reset.
 */
 __STATIC_FORCEINLINE void     PIN_nRESET_OUT (uint32_t bit) {
-  ESP_ERROR_CHECK(gpio_set_level(CONFIG_PIN_NRESET, bit));
+  ESP_ERROR_CHECK(gpio_set_level(DAP_Pins->nreset, bit));
 }
 
 ///@}
@@ -590,11 +809,11 @@ __STATIC_INLINE void DAP_SETUP (void) {
 
   // Initial state of SWD pins have to be HIGH
   // See: CMSIS-DAP LPC-Link2 example https://github.com/ARM-software/CMSIS_5/blob/a75f01746df18bb5b929dfb8dc6c9407fac3a0f3/CMSIS/DAP/Firmware/Examples/LPC-Link2/DAP_config.h#L408-L415
-  gpio_set_level(CONFIG_PIN_SWCLK, 1);
-  gpio_set_level(CONFIG_PIN_SWDIO, 1);
+  gpio_set_level(DAP_Pins->swclk, 1);
+  gpio_set_level(DAP_Pins->swdio, 1);
 
   gpio_config_t conf_swclk_swdio = {
-    .pin_bit_mask = (1ULL << CONFIG_PIN_SWCLK) | (1ULL << CONFIG_PIN_SWDIO),
+    .pin_bit_mask = (1ULL << DAP_Pins->swclk) | (1ULL << DAP_Pins->swdio),
     .mode = GPIO_MODE_INPUT,
     .pull_up_en = GPIO_PULLUP_DISABLE,
     .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -603,7 +822,7 @@ __STATIC_INLINE void DAP_SETUP (void) {
   ESP_ERROR_CHECK(gpio_config(&conf_swclk_swdio));
 
   gpio_config_t conf_nreset = {
-    .pin_bit_mask = (1ULL << CONFIG_PIN_NRESET),
+    .pin_bit_mask = (1ULL << DAP_Pins->nreset),
     .mode = GPIO_MODE_INPUT,
     .pull_up_en = GPIO_PULLUP_ENABLE,
     .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -611,14 +830,17 @@ __STATIC_INLINE void DAP_SETUP (void) {
   };
   ESP_ERROR_CHECK(gpio_config(&conf_nreset));
 
-  gptimer_config_t gptimer_config = {
-    .clk_src = GPTIMER_CLK_SRC_APB,
-    .direction = GPTIMER_COUNT_UP,
-    .resolution_hz = TIMESTAMP_CLOCK
-  };
-  ESP_ERROR_CHECK(gptimer_new_timer(&gptimer_config, &gptimer));
-  ESP_ERROR_CHECK(gptimer_enable(gptimer));
-  ESP_ERROR_CHECK(gptimer_start(gptimer));
+  // Timer is shared by all DAP instances (they are set up one after another)
+  if (gptimer == NULL) {
+    gptimer_config_t gptimer_config = {
+      .clk_src = GPTIMER_CLK_SRC_APB,
+      .direction = GPTIMER_COUNT_UP,
+      .resolution_hz = TIMESTAMP_CLOCK
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&gptimer_config, &gptimer));
+    ESP_ERROR_CHECK(gptimer_enable(gptimer));
+    ESP_ERROR_CHECK(gptimer_start(gptimer));
+  }
 }
 
 /** Reset Target Device with custom specific I/O pin or command sequence.
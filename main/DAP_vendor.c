@@ -25,6 +25,7 @@
  *
  *---------------------------------------------------------------------------*/
 
+#include <string.h>
 #include "DAP_config.h"
 #include "DAP.h"
 
@@ -39,6 +40,58 @@ Vendor Commands. Copy this file to the project folder of the Debug Unit and add
 file to the MDK-ARM project under the file group Configuration.
 */
 
+// Process Statistics command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1): 0 = read, 1 = read and clear
+// Response: status (1), number of counters (1), counters (4 each):
+//           elided SELECT writes, elided CSW writes, elided TAR writes, WAIT responses,
+//           transfers failed after all WAIT retries, longest WAIT run, learned idle cycles (DAP_Stats_t)
+static uint32_t DAP_Statistics(const uint8_t *request, uint8_t *response) {
+  const uint32_t *counter = (const uint32_t *)&DAP_Stats;
+  uint32_t num = sizeof(DAP_Stats) / sizeof(uint32_t);
+  uint32_t n;
+
+  *response++ = DAP_OK;
+  *response++ = (uint8_t)num;
+  for (n = 0U; n < num; n++) {
+    *response++ = (uint8_t)(counter[n] >>  0);
+    *response++ = (uint8_t)(counter[n] >>  8);
+    *response++ = (uint8_t)(counter[n] >> 16);
+    *response++ = (uint8_t)(counter[n] >> 24);
+  }
+  if (*request == 1U) {
+    memset(&DAP_Stats, 0, sizeof(DAP_Stats));
+  }
+
+  return ((1U << 16) | (2U + (4U * num)));
+}
+
+// Process Transfer Pipeline command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  enable (1): 1 = a posted AP read at the end of a Transfer command is completed by the
+//           first AP read of the next Transfer command when that one is already queued
+//           (the response is sent after the next command was executed)
+// Response: status (1)
+static uint32_t DAP_TransferPipeline(const uint8_t *request, uint8_t *response) {
+
+  if ((DAP_SWD == 0) || (*request > 1U)) {
+    *response = DAP_ERROR;
+  } else {
+    DAP_Data.transfer.pipeline = *request;
+    *response = DAP_OK;
+  }
+
+  return ((1U << 16) | 1U);
+}
+
 /** Process DAP Vendor Command and prepare Response Data
 \param request   pointer to request data
 \param response  pointer to response data
@@ -48,34 +101,89 @@ file to the MDK-ARM project under the file group Configuration.
 uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response) {
   uint32_t num = (1U << 16) | 1U;
 
+  if ((DAP_Instance->index != 0U) && (*request != ID_DAP_Statistics) &&
+      (*request != ID_DAP_TransferPipeline) && (*request != ID_DAP_Benchmark)) {
+    // Vendor modules keep their state for DAP instance 0 only
+    *response = ID_DAP_Invalid;
+    return (num);
+  }
+
   *response++ = *request;        // copy Command ID
 
   switch (*request++) {          // first byte in request is Command ID
-    case ID_DAP_Vendor0:
-#if 0                            // example user command
-      num += 1U << 16;           // increment request count
-      if (*request == 1U) {      // when first command data byte is 1
-        *response++ = 'X';       // send 'X' as response
-        num++;                   // increment response count
-      }
-#endif
+#if (DAP_SWD != 0)
+    case ID_DAP_Monitor:
+      num += Monitor_Configure(request, response);
       break;
-
+    case ID_DAP_CoreRegTransfer:
+      num += CoreReg_Transfer(request, response);
+      break;
+    case ID_DAP_RTT:
+      num += RTT_Configure(request, response);
+      break;
+    case ID_DAP_PCSample:
+      num += PCSample_Configure(request, response);
+      break;
+    case ID_DAP_Logger:
+      num += Logger_Configure(request, response);
+      break;
+    case ID_DAP_Script:
+      num += Script_Process(request, response);
+      break;
+#else
+    case ID_DAP_Vendor0:  break;
     case ID_DAP_Vendor1:  break;
     case ID_DAP_Vendor2:  break;
     case ID_DAP_Vendor3:  break;
     case ID_DAP_Vendor4:  break;
     case ID_DAP_Vendor5:  break;
-    case ID_DAP_Vendor6:  break;
-    case ID_DAP_Vendor7:  break;
-    case ID_DAP_Vendor8:  break;
+#endif
+
+    case ID_DAP_Macro:
+      num += Macro_Process(request, response);
+      break;
+    case ID_DAP_Statistics:
+      num += DAP_Statistics(request, response);
+      break;
+    case ID_DAP_TransferPipeline:
+      num += DAP_TransferPipeline(request, response);
+      break;
+#if (DAP_SWD != 0)
+    case ID_DAP_ClockTune:
+      num += ClockTune_Process(request, response);
+      break;
+    case ID_DAP_TargetSelect:
+      num += MultiDrop_Select(request, response);
+      break;
+    case ID_DAP_Gang:
+      num += Gang_Process(request, response);
+      break;
+    case ID_DAP_Benchmark:
+      num += Benchmark_Process(request, response);
+      break;
+#else
     case ID_DAP_Vendor9:  break;
     case ID_DAP_Vendor10: break;
     case ID_DAP_Vendor11: break;
     case ID_DAP_Vendor12: break;
+#endif
+#if (SWO_STREAM != 0)
+    case ID_DAP_ITMFilter:
+      num += ITM_Configure(request, response);
+      break;
+#else
     case ID_DAP_Vendor13: break;
+#endif
+#if (DAP_UART != 0)
+    case ID_DAP_UARTBridge:
+      num += UART_Bridge(request, response);
+      break;
+#else
     case ID_DAP_Vendor14: break;
-    case ID_DAP_Vendor15: break;
+#endif
+    case ID_DAP_Trace:
+      num += Trace_Configure(request, response);
+      break;
     case ID_DAP_Vendor16: break;
     case ID_DAP_Vendor17: break;
     case ID_DAP_Vendor18: break;
@@ -97,4 +205,38 @@ uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response) {
   return (num);
 }
 
+/** Run background jobs of Vendor Commands (called by the DAP task between commands)
+\return          time in microseconds until a job needs to run again
+                 (DAP_POLL_IDLE when no job is active)
+*/
+uint32_t DAP_ProcessVendorPoll(void) {
+  uint32_t wait = DAP_POLL_IDLE;
+#if (DAP_SWD != 0)
+  uint32_t n;
+
+  if (DAP_Instance->index != 0U) {
+    return (wait);
+  }
+
+  n = Monitor_Poll();
+  if (n < wait) {
+    wait = n;
+  }
+  n = RTT_Poll();
+  if (n < wait) {
+    wait = n;
+  }
+  n = PCSample_Poll();
+  if (n < wait) {
+    wait = n;
+  }
+  n = Logger_Poll();
+  if (n < wait) {
+    wait = n;
+  }
+#endif
+
+  return (wait);
+}
+
 ///@}
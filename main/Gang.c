@@ -0,0 +1,473 @@
+// Gang programming
+// Drives CONFIG_GANG_PORTS SWD ports in parallel. All ports share SWCLK and each port has its own
+// SWDIO line (port 0 uses the SWDIO pin). The SWDIO lines are written with one set and one clear
+// register access and sampled with one read of the GPIO input register, so identical targets are
+// programmed in the time of one. Ports are handled independently: a port answering WAIT is retried
+// alone while the others see idle cycles, and a port answering FAULT or not at all is left out for
+// the rest of the command.
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+
+#if (DAP_SWD != 0)
+
+#ifdef  CONFIG_GANG_PORTS
+#define GANG_PORTS              CONFIG_GANG_PORTS
+#else
+#define GANG_PORTS              1
+#endif
+
+// Gang Control
+#define GANG_INFO               0U              // Get number of ports
+#define GANG_CONNECT            1U              // Configure pins, switch to SWD and read DPIDR
+#define GANG_TRANSFER           2U              // Transfer on all selected ports
+#define GANG_DISCONNECT         3U              // Release pins
+
+#if (GANG_PORTS > 1)
+
+#if (CONFIG_PIN_SWCLK >= 32) || (CONFIG_PIN_SWDIO >= 32)
+#error "Gang programming needs SWCLK and SWDIO on GPIO0..31"
+#endif
+
+#define GANG_SWCLK              (1U << CONFIG_PIN_SWCLK)
+
+static const uint8_t GangPin[GANG_PORTS] = {
+  CONFIG_PIN_SWDIO,
+  CONFIG_PIN_SWDIO_GANG1,
+#if (GANG_PORTS > 2)
+  CONFIG_PIN_SWDIO_GANG2,
+#endif
+#if (GANG_PORTS > 3)
+  CONFIG_PIN_SWDIO_GANG3,
+#endif
+};
+
+static struct {
+  uint8_t  connected;                           // Pins are configured
+  uint32_t all;                                 // SWDIO pins of all ports
+} Gang;
+
+
+// Get SWDIO pins of ports
+//   ports:  port mask
+//   return: pin mask
+static uint32_t Gang_Pins (uint32_t ports) {
+  uint32_t pins;
+  uint32_t p;
+
+  pins = 0U;
+  for (p = 0U; p < GANG_PORTS; p++) {
+    if (ports & (1U << p)) {
+      pins |= 1U << GangPin[p];
+    }
+  }
+  return (pins);
+}
+
+// Set SWDIO outputs: pins in high to high, all other SWDIO pins to low
+//   high:   pin mask
+static void Gang_Out (uint32_t high) {
+  REG_WRITE(GPIO_OUT_W1TS_REG, high);
+  REG_WRITE(GPIO_OUT_W1TC_REG, Gang.all & ~high);
+}
+
+// Half SWCLK period of the selected clock
+static inline void Gang_Delay (void) {
+  if (DAP_Data.fast_clock) {
+    PIN_DELAY_FAST();
+  } else {
+    PIN_DELAY_SLOW(DAP_Data.clock_delay);
+  }
+}
+
+// Generate one SWCLK cycle
+static void Gang_Clock (void) {
+  REG_WRITE(GPIO_OUT_W1TC_REG, GANG_SWCLK);
+  Gang_Delay();
+  REG_WRITE(GPIO_OUT_W1TS_REG, GANG_SWCLK);
+  Gang_Delay();
+}
+
+// Generate one SWCLK cycle and sample the inputs
+//   return: GPIO input register
+static uint32_t Gang_ClockIn (void) {
+  uint32_t in;
+
+  REG_WRITE(GPIO_OUT_W1TC_REG, GANG_SWCLK);
+  Gang_Delay();
+  in = REG_READ(GPIO_IN_REG);
+  REG_WRITE(GPIO_OUT_W1TS_REG, GANG_SWCLK);
+  Gang_Delay();
+  return (in);
+}
+
+// Generate the same sequence on all ports
+//   count:  number of bits
+//   data:   pointer to sequence bit data
+static void Gang_Sequence (uint32_t count, const uint8_t *data) {
+  uint32_t val;
+  uint32_t n;
+
+  val = 0U;
+  n   = 0U;
+  while (count--) {
+    if (n == 0U) {
+      val = *data++;
+      n   = 8U;
+    }
+    Gang_Out((val & 1U) ? Gang.all : 0U);
+    Gang_Clock();
+    val >>= 1;
+    n--;
+  }
+}
+
+// Transfer on a set of ports
+//   request: A[3:2] RnW APnDP
+//   ports:   ports taking part (other ports see idle cycles)
+//   wdata:   write data
+//   rdata:   read data per port
+//   ack:     ACK[2:0] per port
+static void Gang_Transfer (uint32_t request, uint32_t ports, uint32_t wdata, uint32_t *rdata, uint8_t *ack) {
+  uint32_t val[GANG_PORTS];
+  uint32_t par[GANG_PORTS];
+  uint32_t pins, ok_pins;
+  uint32_t parity;
+  uint32_t bit;
+  uint32_t in;
+  uint32_t n, p;
+
+  pins = Gang_Pins(ports);
+
+  // Packet request
+  parity = 0U;
+  Gang_Out(pins);                       // Start bit
+  Gang_Clock();
+  for (n = 0U; n < 4U; n++) {           // APnDP, RnW, A2, A3
+    bit = (request >> n) & 1U;
+    parity += bit;
+    Gang_Out(bit ? pins : 0U);
+    Gang_Clock();
+  }
+  Gang_Out((parity & 1U) ? pins : 0U);  // Parity bit
+  Gang_Clock();
+  Gang_Out(0U);                         // Stop bit
+  Gang_Clock();
+  Gang_Out(pins);                       // Park bit
+  Gang_Clock();
+
+  // Turnaround
+  REG_WRITE(GPIO_ENABLE_W1TC_REG, pins);
+  for (n = DAP_Data.swd_conf.turnaround; n; n--) {
+    Gang_Clock();
+  }
+
+  // Acknowledge response
+  for (p = 0U; p < GANG_PORTS; p++) {
+    ack[p] = 0U;
+  }
+  for (n = 0U; n < 3U; n++) {
+    in = Gang_ClockIn();
+    for (p = 0U; p < GANG_PORTS; p++) {
+      ack[p] |= (uint8_t)(((in >> GangPin[p]) & 1U) << n);
+    }
+  }
+  ok_pins = 0U;
+  for (p = 0U; p < GANG_PORTS; p++) {
+    if ((ports & (1U << p)) && (ack[p] == DAP_TRANSFER_OK)) {
+      ok_pins |= 1U << GangPin[p];
+    }
+  }
+
+  if (request & DAP_TRANSFER_RnW) {
+    // Read data, ports without OK response get their turnaround and then idle cycles
+    for (p = 0U; p < GANG_PORTS; p++) {
+      val[p] = 0U;
+      par[p] = 0U;
+    }
+    for (n = 0U; n < 33U; n++) {
+      if (n == DAP_Data.swd_conf.turnaround) {
+        Gang_Out(0U);
+        REG_WRITE(GPIO_ENABLE_W1TS_REG, pins & ~ok_pins);
+      }
+      in = Gang_ClockIn();
+      for (p = 0U; p < GANG_PORTS; p++) {
+        bit = (in >> GangPin[p]) & 1U;
+        if (n < 32U) {
+          val[p] >>= 1;
+          val[p]  |= bit << 31;
+          par[p]  += bit;
+        } else if (((par[p] ^ bit) & 1U) && (ack[p] == DAP_TRANSFER_OK)) {
+          ack[p] = DAP_TRANSFER_ERROR;
+        }
+      }
+    }
+    for (p = 0U; p < GANG_PORTS; p++) {
+      if (ports & (1U << p)) {
+        rdata[p] = val[p];
+      }
+    }
+    // Turnaround
+    for (n = DAP_Data.swd_conf.turnaround; n; n--) {
+      Gang_Clock();
+    }
+    Gang_Out(0U);
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, pins);
+  } else {
+    // Turnaround
+    for (n = DAP_Data.swd_conf.turnaround; n; n--) {
+      Gang_Clock();
+    }
+    Gang_Out(0U);
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, pins);
+    // Write data on ports with OK response, idle cycles on the others
+    parity = 0U;
+    for (n = 32U; n; n--) {
+      bit = wdata & 1U;
+      parity += bit;
+      Gang_Out(bit ? ok_pins : 0U);
+      Gang_Clock();
+      wdata >>= 1;
+    }
+    Gang_Out((parity & 1U) ? ok_pins : 0U);
+    Gang_Clock();
+  }
+
+  // Idle cycles
+  Gang_Out(0U);
+  for (n = DAP_Data.transfer.idle_cycles; n; n--) {
+    Gang_Clock();
+  }
+  Gang_Out(Gang.all);
+}
+
+// Transfer on a set of ports with retries on WAIT response
+//   request: A[3:2] RnW APnDP
+//   ports:   ports taking part
+//   wdata:   write data
+//   rdata:   read data per port
+//   ack:     ACK[2:0] per port
+static void Gang_TransferRetry (uint32_t request, uint32_t ports, uint32_t wdata, uint32_t *rdata, uint8_t *ack) {
+  uint8_t  result[GANG_PORTS];
+  uint32_t retry;
+  uint32_t wait;
+  uint32_t p;
+
+  retry = DAP_Data.transfer.retry_count;
+  do {
+    Gang_Transfer(request, ports, wdata, rdata, result);
+    wait = 0U;
+    for (p = 0U; p < GANG_PORTS; p++) {
+      if (ports & (1U << p)) {
+        ack[p] = result[p];
+        if (result[p] == DAP_TRANSFER_WAIT) {
+          wait |= 1U << p;
+        }
+      }
+    }
+    ports = wait;
+  } while (ports && retry-- && !DAP_TransferAbort);
+}
+
+#endif  /* (GANG_PORTS > 1) */
+
+
+// Process Gang command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1)
+//           GANG_TRANSFER: port mask (1), transfer count (1),
+//                          transfer requests: request (1, A[3:2] RnW APnDP), write data (4, writes only)
+// Response: status (1), number of ports (1)
+//           GANG_CONNECT:  for each port: ACK (1), DPIDR (4)
+//           GANG_TRANSFER: executed transfers (1), for each port: completed transfers (1), ACK (1),
+//                          then for each read: data (4) of each port (0 for failed ports)
+// Transfers are raw SWD transfers: the data of a posted AP read is returned by the next read
+// (e.g. of DP RDBUFF) and completion of the last write has to be checked by a final read as well.
+uint32_t Gang_Process (const uint8_t *request, uint8_t *response) {
+#if (GANG_PORTS > 1)
+  static const uint8_t swd_switch[17] = {
+    0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU,      // Line reset
+    0x9EU, 0xE7U,                                         // JTAG-to-SWD sequence
+    0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU,      // Line reset
+    0x00U                                                 // Idle cycles
+  };
+  uint32_t rdata[GANG_PORTS];
+  uint8_t  ack[GANG_PORTS];
+  uint8_t  done[GANG_PORTS];
+  uint8_t *data;
+  uint32_t num;
+  uint32_t ports;
+  uint32_t active;
+  uint32_t count;
+  uint32_t req;
+  uint32_t wdata;
+  uint32_t executed;
+  uint32_t n, p;
+  gpio_config_t conf;
+
+  num = 1U;
+  *(response+0) = DAP_OK;
+  *(response+1) = GANG_PORTS;
+
+  // The SWD port of port 0 must not be used by the host at the same time
+  if ((*request != GANG_INFO) && (DAP_Data.debug_port != DAP_PORT_DISABLED)) {
+    *response = DAP_ERROR;
+    if (*request == GANG_TRANSFER) {
+      goto skip;
+    }
+    return ((num << 16) | 2U);
+  }
+
+  switch (*request) {
+    case GANG_INFO:
+      return ((num << 16) | 2U);
+
+    case GANG_CONNECT:
+      Gang.all = Gang_Pins((1U << GANG_PORTS) - 1U);
+      conf.pin_bit_mask = (uint64_t)(Gang.all | GANG_SWCLK);
+      conf.mode         = GPIO_MODE_INPUT_OUTPUT;
+      conf.pull_up_en   = GPIO_PULLUP_DISABLE;
+      conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+      conf.intr_type    = GPIO_INTR_DISABLE;
+      ESP_ERROR_CHECK(gpio_config(&conf));
+      REG_WRITE(GPIO_OUT_W1TS_REG, Gang.all | GANG_SWCLK);
+      Gang.connected = 1U;
+
+      Gang_Sequence(8U * sizeof(swd_switch), swd_switch);
+      Gang_TransferRetry(DP_IDCODE | DAP_TRANSFER_RnW, (1U << GANG_PORTS) - 1U, 0U, rdata, ack);
+      data = response + 2;
+      for (p = 0U; p < GANG_PORTS; p++) {
+        if (ack[p] != DAP_TRANSFER_OK) {
+          *response = DAP_ERROR;
+          rdata[p]  = 0U;
+        }
+        *data++ = ack[p];
+        *data++ = (uint8_t)(rdata[p] >>  0);
+        *data++ = (uint8_t)(rdata[p] >>  8);
+        *data++ = (uint8_t)(rdata[p] >> 16);
+        *data++ = (uint8_t)(rdata[p] >> 24);
+      }
+      return ((num << 16) | (uint32_t)(data - response));
+
+    case GANG_TRANSFER:
+      if (!Gang.connected) {
+        *response = DAP_ERROR;
+        goto skip;
+      }
+      break;
+
+    case GANG_DISCONNECT:
+      if (Gang.connected) {
+        Gang.connected = 0U;
+        REG_WRITE(GPIO_OUT_W1TS_REG, Gang.all | GANG_SWCLK);
+        conf.pin_bit_mask = (uint64_t)(Gang.all | GANG_SWCLK);
+        conf.mode         = GPIO_MODE_DISABLE;
+        conf.pull_up_en   = GPIO_PULLUP_DISABLE;
+        conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+        conf.intr_type    = GPIO_INTR_DISABLE;
+        ESP_ERROR_CHECK(gpio_config(&conf));
+      }
+      return ((num << 16) | 2U);
+
+    default:
+      *response = DAP_ERROR;
+      return ((num << 16) | 2U);
+  }
+
+  // GANG_TRANSFER
+  DAP_TransferAbort = 0U;
+  ports  = *(request+1) & ((1U << GANG_PORTS) - 1U);
+  count  = *(request+2);
+  active = ports;
+  for (p = 0U; p < GANG_PORTS; p++) {
+    ack[p]  = (ports & (1U << p)) ? DAP_TRANSFER_OK : 0U;
+    done[p] = 0U;
+  }
+  executed = 0U;
+  data = response + 3 + (2U * GANG_PORTS);
+  request += 3;
+  num = 3U;
+
+  for (n = 0U; n < count; n++) {
+    req = *request++;
+    num++;
+    wdata = 0U;
+    if ((req & DAP_TRANSFER_RnW) == 0U) {
+      wdata = (uint32_t)(*(request+0) <<  0) |
+              (uint32_t)(*(request+1) <<  8) |
+              (uint32_t)(*(request+2) << 16) |
+              (uint32_t)(*(request+3) << 24);
+      request += 4;
+      num     += 4U;
+    } else if ((uint32_t)(data - response + (4U * GANG_PORTS)) > (DAP_PACKET_SIZE - 1U)) {
+      // Read data does not fit into the response (which follows the Command ID byte)
+      active = 0U;
+    }
+    if ((active == 0U) || DAP_TransferAbort) {
+      continue;
+    }
+
+    Gang_TransferRetry(req & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3),
+                       active, wdata, rdata, ack);
+    for (p = 0U; p < GANG_PORTS; p++) {
+      if (active & (1U << p)) {
+        if (ack[p] == DAP_TRANSFER_OK) {
+          done[p]++;
+        } else {
+          active &= ~(1U << p);
+        }
+      }
+    }
+    if (req & DAP_TRANSFER_RnW) {
+      for (p = 0U; p < GANG_PORTS; p++) {
+        if ((active & (1U << p)) == 0U) {
+          rdata[p] = 0U;
+        }
+        *data++ = (uint8_t)(rdata[p] >>  0);
+        *data++ = (uint8_t)(rdata[p] >>  8);
+        *data++ = (uint8_t)(rdata[p] >> 16);
+        *data++ = (uint8_t)(rdata[p] >> 24);
+      }
+    }
+    executed++;
+  }
+
+  if ((active != ports) || (executed != count)) {
+    *response = DAP_ERROR;
+  }
+  *(response+2) = (uint8_t)executed;
+  for (p = 0U; p < GANG_PORTS; p++) {
+    *(response+3+(2U*p)) = done[p];
+    *(response+4+(2U*p)) = ack[p];
+  }
+  return ((num << 16) | (uint32_t)(data - response));
+
+skip:
+  // Skip transfer requests
+  count = *(request+2);
+  request += 3;
+  num = 3U;
+  for (n = 0U; n < count; n++) {
+    req = *request++;
+    num++;
+    if ((req & DAP_TRANSFER_RnW) == 0U) {
+      request += 4;
+      num     += 4U;
+    }
+  }
+  *(response+2) = 0U;
+  return ((num << 16) | 3U);
+#else
+  *(response+0) = (*request == GANG_INFO) ? DAP_OK : DAP_ERROR;
+  *(response+1) = 1U;
+  return ((1U << 16) | 2U);
+#endif
+}
+
+#endif  /* (DAP_SWD != 0) */
@@ -0,0 +1,405 @@
+// ITM trace filter
+// Parses the ITM/DWT packet protocol of the SWO trace (sync, overflow, instrumentation, hardware
+// source, local and global timestamp and extension packets) before it is streamed, and forwards
+// only the stimulus ports and hardware sources selected by the host. A fully loaded SWO line
+// carries more than a BLE link, so everything nobody watches is dropped on the probe.
+//
+// Output is either the selected ITM packets unchanged, or compact records:
+//   source (1), length (1), payload (length)
+//   source 0x00..0x1F: stimulus port (consecutive writes to the same port are merged)
+//   source 0x20..0x3F: hardware source 0x20 + discriminator, packet payload
+//   source 0x40:       local timestamp, 0x41: global timestamp 1, 0x42: global timestamp 2 (value (4))
+//   source 0x50:       overflow (no payload)
+
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (SWO_STREAM != 0)
+
+// ITM Filter Control
+#define ITM_DISABLE             0U              // Stream raw trace data
+#define ITM_ENABLE              1U              // Filter trace data
+#define ITM_STATUS              2U              // Get status
+
+// ITM Filter Flags
+#define ITM_FLAG_COMPACT        (1U<<0)         // Compact records instead of ITM packets
+#define ITM_FLAG_TIMESTAMP      (1U<<1)         // Forward timestamp packets
+
+// Compact record sources
+#define ITM_REC_HARDWARE        0x20U
+#define ITM_REC_LOCAL_TS        0x40U
+#define ITM_REC_GLOBAL_TS1      0x41U
+#define ITM_REC_GLOBAL_TS2      0x42U
+#define ITM_REC_OVERFLOW        0x50U
+
+// Longest packet (header and payload) and longest record added for one packet
+#define ITM_PACKET_MAX          8U
+#define ITM_RECORD_MAX          10U
+
+// Parser State
+#define ITM_STATE_HEADER        0U              // Next byte is a header
+#define ITM_STATE_PAYLOAD       1U              // Payload of fixed length
+#define ITM_STATE_CONTINUE      2U              // Payload bytes with continuation bit
+#define ITM_STATE_SYNC          3U              // Zero bytes of a sync packet
+#define ITM_STATE_LOST          4U              // Waiting for a sync packet
+
+// Parser restart
+#define ITM_RESTART_BOUNDARY    1U              // Trace data was cleared, next byte is a header
+#define ITM_RESTART_SYNC        2U              // Filter changed during capture, wait for a sync packet
+
+// Packet Type
+#define ITM_PKT_SOURCE          0U
+#define ITM_PKT_LOCAL_TS        1U
+#define ITM_PKT_GLOBAL_TS1      2U
+#define ITM_PKT_GLOBAL_TS2      3U
+#define ITM_PKT_EXTENSION       4U
+
+static struct {
+  volatile uint8_t  enabled;                    // Filter enabled
+  volatile uint8_t  restart;                    // Parser restarts at the next byte (ITM_RESTART_xxx)
+  uint8_t  flags;                               // ITM_FLAG_xxx
+  uint8_t  state;                               // ITM_STATE_xxx
+  uint8_t  type;                                // ITM_PKT_xxx of the current packet
+  uint8_t  length;                              // Collected bytes of the current packet
+  uint8_t  expect;                              // Length of a fixed length packet
+  uint8_t  zeros;                               // Zero bytes of a sync packet
+  uint32_t ports;                               // Selected stimulus ports
+  uint32_t sources;                             // Selected hardware sources (by discriminator)
+  uint32_t packets;                             // Number of parsed packets
+  uint32_t forwarded;                           // Number of forwarded packets
+  uint32_t overflows;                           // Number of overflow packets
+  uint32_t errors;                              // Number of times synchronization was lost
+  uint8_t  packet[ITM_PACKET_MAX];              // Current packet
+} ITM;
+
+// Stimulus record which later writes to the same port are appended to
+static uint8_t *ITM_Run;
+
+
+// Restart the parser (trace data cleared)
+void ITM_Reset (void) {
+  ITM.restart = ITM_RESTART_BOUNDARY;
+}
+
+
+// Check whether trace data is filtered
+//   return: 1 - filter enabled, 0 - raw trace data
+uint32_t ITM_Active (void) {
+  return (ITM.enabled);
+}
+
+
+// Add a compact record
+//   out:    output pointer
+//   source: record source
+//   data:   payload
+//   len:    payload length
+//   return: output pointer after the record
+static uint8_t *ITM_Record (uint8_t *out, uint32_t source, const uint8_t *data, uint32_t len) {
+  *out++ = (uint8_t)source;
+  *out++ = (uint8_t)len;
+  if (len != 0U) {
+    memcpy(out, data, len);
+  }
+  return (out + len);
+}
+
+
+// Forward a complete packet if it is selected
+//   out:    output pointer
+//   return: output pointer after the forwarded data
+static uint8_t *ITM_Packet (uint8_t *out) {
+  uint32_t header;
+  uint32_t source;
+  uint32_t value;
+  uint32_t len;
+  uint32_t n;
+  uint8_t  data[4];
+
+  header = ITM.packet[0];
+  len    = ITM.length - 1U;
+  ITM.packets++;
+
+  switch (ITM.type) {
+    case ITM_PKT_SOURCE:
+      source = header >> 3;
+      if (header & 0x04U) {
+        if ((ITM.sources & (1UL << source)) == 0U) {
+          return (out);
+        }
+        source |= ITM_REC_HARDWARE;
+      } else {
+        if ((ITM.ports & (1UL << source)) == 0U) {
+          return (out);
+        }
+      }
+      ITM.forwarded++;
+      if ((ITM.flags & ITM_FLAG_COMPACT) == 0U) {
+        ITM_Run = NULL;
+        break;
+      }
+      if ((source < ITM_REC_HARDWARE) && (ITM_Run != NULL) && (ITM_Run[0] == source) &&
+          ((ITM_Run[1] + len) <= 0xFFU)) {
+        // Consecutive write to the same stimulus port
+        memcpy(out, &ITM.packet[1], len);
+        ITM_Run[1] += (uint8_t)len;
+        return (out + len);
+      }
+      ITM_Run = (source < ITM_REC_HARDWARE) ? out : NULL;
+      return (ITM_Record(out, source, &ITM.packet[1], len));
+
+    case ITM_PKT_LOCAL_TS:
+    case ITM_PKT_GLOBAL_TS1:
+    case ITM_PKT_GLOBAL_TS2:
+      if ((ITM.flags & ITM_FLAG_TIMESTAMP) == 0U) {
+        return (out);
+      }
+      ITM.forwarded++;
+      ITM_Run = NULL;
+      if ((ITM.flags & ITM_FLAG_COMPACT) == 0U) {
+        break;
+      }
+      if ((ITM.type == ITM_PKT_LOCAL_TS) && ((header & 0x80U) == 0U)) {
+        // Single byte local timestamp
+        value = (header >> 4) & 0x07U;
+      } else {
+        value = 0U;
+        for (n = 0U; (n < len) && (n < 5U); n++) {
+          value |= (uint32_t)(ITM.packet[1U + n] & 0x7FU) << (7U * n);
+        }
+      }
+      data[0] = (uint8_t)(value >>  0);
+      data[1] = (uint8_t)(value >>  8);
+      data[2] = (uint8_t)(value >> 16);
+      data[3] = (uint8_t)(value >> 24);
+      source  = (ITM.type == ITM_PKT_LOCAL_TS)   ? ITM_REC_LOCAL_TS   :
+                (ITM.type == ITM_PKT_GLOBAL_TS1) ? ITM_REC_GLOBAL_TS1 : ITM_REC_GLOBAL_TS2;
+      return (ITM_Record(out, source, data, 4U));
+
+    case ITM_PKT_EXTENSION:
+      // Stimulus port page: needed to decode the following ITM packets, not in compact records
+      if (ITM.flags & ITM_FLAG_COMPACT) {
+        return (out);
+      }
+      ITM.forwarded++;
+      ITM_Run = NULL;
+      break;
+
+    default:
+      return (out);
+  }
+
+  memcpy(out, ITM.packet, ITM.length);
+  return (out + ITM.length);
+}
+
+
+// Start a packet
+//   header: header byte
+//   out:    output pointer
+//   return: output pointer after forwarded data
+static uint8_t *ITM_Header (uint8_t header, uint8_t *out) {
+
+  ITM.packet[0] = header;
+  ITM.length    = 1U;
+
+  if (header == 0x00U) {
+    // Sync packet: at least 47 zero bits followed by a one
+    ITM.zeros = 1U;
+    ITM.state = ITM_STATE_SYNC;
+  } else if (header == 0x70U) {
+    // Overflow packet
+    ITM.packets++;
+    ITM.overflows++;
+    ITM_Run = NULL;
+    if (ITM.flags & ITM_FLAG_COMPACT) {
+      out = ITM_Record(out, ITM_REC_OVERFLOW, NULL, 0U);
+    } else {
+      *out++ = header;
+    }
+  } else if ((header & 0x03U) != 0U) {
+    // Instrumentation or hardware source packet with 1, 2 or 4 payload bytes
+    ITM.type   = ITM_PKT_SOURCE;
+    ITM.expect = (uint8_t)(((header & 0x03U) == 0x03U) ? 5U : ((header & 0x03U) + 1U));
+    ITM.state  = ITM_STATE_PAYLOAD;
+  } else if ((header & 0x0FU) == 0x00U) {
+    // Local timestamp (single byte when the continuation bit is clear)
+    ITM.type = ITM_PKT_LOCAL_TS;
+    if (header & 0x80U) {
+      ITM.state = ITM_STATE_CONTINUE;
+    } else {
+      out = ITM_Packet(out);
+    }
+  } else if ((header & 0xDFU) == 0x94U) {
+    // Global timestamp 1 or 2
+    ITM.type  = (header & 0x20U) ? ITM_PKT_GLOBAL_TS2 : ITM_PKT_GLOBAL_TS1;
+    ITM.state = ITM_STATE_CONTINUE;
+  } else if ((header & 0x0BU) == 0x08U) {
+    // Extension packet
+    ITM.type = ITM_PKT_EXTENSION;
+    if (header & 0x80U) {
+      ITM.state = ITM_STATE_CONTINUE;
+    } else {
+      out = ITM_Packet(out);
+    }
+  } else {
+    // Reserved header: packet boundaries are unknown until the next sync packet
+    ITM.errors++;
+    ITM.state = ITM_STATE_LOST;
+    ITM_Run   = NULL;
+  }
+  return (out);
+}
+
+
+// Filter trace data
+//   data:   trace data
+//   num:    number of trace data bytes
+//   out:    buffer for forwarded data
+//   size:   size of the buffer
+//   count:  number of forwarded bytes (output)
+//   return: number of processed trace data bytes (less than num when the buffer is full)
+uint32_t ITM_Filter (const uint8_t *data, uint32_t num, uint8_t *out, uint32_t size, uint32_t *count) {
+  uint8_t  *start;
+  uint32_t  n;
+  uint8_t   byte;
+  uint8_t   restart;
+
+  restart = ITM.restart;
+  if (restart) {
+    // Cleared trace data starts at a packet boundary, otherwise the next byte may be inside a packet
+    ITM.restart = 0U;
+    ITM.state   = (restart == ITM_RESTART_BOUNDARY) ? ITM_STATE_HEADER : ITM_STATE_LOST;
+    ITM.zeros   = 0U;
+  }
+
+  start   = out;
+  ITM_Run = NULL;   // Records are not extended across calls
+
+  for (n = 0U; (n < num) && ((uint32_t)(out - start + ITM_RECORD_MAX) <= size); n++) {
+    byte = data[n];
+    switch (ITM.state) {
+      case ITM_STATE_HEADER:
+        out = ITM_Header(byte, out);
+        break;
+
+      case ITM_STATE_PAYLOAD:
+        ITM.packet[ITM.length++] = byte;
+        if (ITM.length == ITM.expect) {
+          ITM.state = ITM_STATE_HEADER;
+          out = ITM_Packet(out);
+        }
+        break;
+
+      case ITM_STATE_CONTINUE:
+        ITM.packet[ITM.length++] = byte;
+        if ((byte & 0x80U) == 0U) {
+          ITM.state = ITM_STATE_HEADER;
+          out = ITM_Packet(out);
+        } else if (ITM.length == ITM_PACKET_MAX) {
+          ITM.errors++;
+          ITM.state = ITM_STATE_LOST;
+        }
+        break;
+
+      case ITM_STATE_SYNC:
+      case ITM_STATE_LOST:
+        if (byte == 0x00U) {
+          if (ITM.zeros < 0xFFU) {
+            ITM.zeros++;
+          }
+        } else {
+          if ((byte == 0x80U) && (ITM.zeros >= 5U)) {
+            ITM.packets++;
+            ITM.state = ITM_STATE_HEADER;
+          } else if (ITM.state == ITM_STATE_SYNC) {
+            // Zero header not followed by a sync packet
+            ITM.errors++;
+            ITM.state = ITM_STATE_LOST;
+          }
+          ITM.zeros = 0U;
+        }
+        break;
+
+      default:
+        ITM.state = ITM_STATE_LOST;
+        break;
+    }
+  }
+
+  ITM_Run = NULL;
+  *count  = (uint32_t)(out - start);
+  return (n);
+}
+
+
+// Process ITM Filter command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1), stimulus port mask (4), hardware source mask (4, bit n = discriminator n),
+//           flags (1, ITM_FLAG_xxx)
+// Response: status (1), parsed packets (4), forwarded packets (4), overflow packets (4),
+//           synchronization losses (4)
+uint32_t ITM_Configure (const uint8_t *request, uint8_t *response) {
+  uint32_t n;
+
+  *response = DAP_OK;
+
+  switch (*request) {
+    case ITM_DISABLE:
+      ITM.enabled = 0U;
+      break;
+    case ITM_ENABLE:
+      ITM.enabled   = 0U;
+      ITM.ports     = (uint32_t)(*(request+1) <<  0) |
+                      (uint32_t)(*(request+2) <<  8) |
+                      (uint32_t)(*(request+3) << 16) |
+                      (uint32_t)(*(request+4) << 24);
+      ITM.sources   = (uint32_t)(*(request+5) <<  0) |
+                      (uint32_t)(*(request+6) <<  8) |
+                      (uint32_t)(*(request+7) << 16) |
+                      (uint32_t)(*(request+8) << 24);
+      ITM.flags     = *(request+9);
+      ITM.packets   = 0U;
+      ITM.forwarded = 0U;
+      ITM.overflows = 0U;
+      ITM.errors    = 0U;
+      ITM.restart   = ITM_RESTART_SYNC;
+      ITM.enabled   = 1U;
+      break;
+    case ITM_STATUS:
+      break;
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  n = ITM.packets;
+  *(response+1)  = (uint8_t)(n >>  0);
+  *(response+2)  = (uint8_t)(n >>  8);
+  *(response+3)  = (uint8_t)(n >> 16);
+  *(response+4)  = (uint8_t)(n >> 24);
+  n = ITM.forwarded;
+  *(response+5)  = (uint8_t)(n >>  0);
+  *(response+6)  = (uint8_t)(n >>  8);
+  *(response+7)  = (uint8_t)(n >> 16);
+  *(response+8)  = (uint8_t)(n >> 24);
+  n = ITM.overflows;
+  *(response+9)  = (uint8_t)(n >>  0);
+  *(response+10) = (uint8_t)(n >>  8);
+  *(response+11) = (uint8_t)(n >> 16);
+  *(response+12) = (uint8_t)(n >> 24);
+  n = ITM.errors;
+  *(response+13) = (uint8_t)(n >>  0);
+  *(response+14) = (uint8_t)(n >>  8);
+  *(response+15) = (uint8_t)(n >> 16);
+  *(response+16) = (uint8_t)(n >> 24);
+
+  return ((10U << 16) | 17U);
+}
+
+#endif  /* (SWO_STREAM != 0) */
@@ -25,16 +25,37 @@
  *
  *---------------------------------------------------------------------------*/
 
+#include <string.h>
 #include "DAP_config.h"
 #include "DAP.h"
 
+#if (DAP_JTAG_SPI != 0)
+#include "driver/spi_master.h"
+#include "soc/spi_periph.h"
+#include "soc/gpio_sig_map.h"
+#include "esp_rom_gpio.h"
+#endif
+
 
 // JTAG Macros
 
-#define PIN_TCK_SET PIN_SWCLK_TCK_SET
-#define PIN_TCK_CLR PIN_SWCLK_TCK_CLR
-#define PIN_TMS_SET PIN_SWDIO_TMS_SET
-#define PIN_TMS_CLR PIN_SWDIO_TMS_CLR
+// JTAG pins of the DAP instance of the calling task. The pin masks are loaded once per function
+// and the pins are driven at register level (GPIO_OUT_W1TS/W1TC, GPIO_IN), which is much faster
+// than gpio_set_level() and keeps the TLS lookup of DAP_Pins out of the bit loops.
+#define JTAG_PINS()                                     \
+  const uint32_t tck_mask = 1U << DAP_Pins->swclk;      \
+  const uint32_t tms_mask = 1U << DAP_Pins->swdio;      \
+  const uint32_t tdi_mask = 1U << DAP_Pins->tdi;        \
+  const uint32_t tdo_pin  = DAP_Pins->tdo;              \
+  (void)tck_mask; (void)tms_mask; (void)tdi_mask; (void)tdo_pin
+
+#define PIN_TCK_SET()   REG_WRITE(GPIO_OUT_W1TS_REG, tck_mask)
+#define PIN_TCK_CLR()   REG_WRITE(GPIO_OUT_W1TC_REG, tck_mask)
+#define PIN_TMS_SET()   REG_WRITE(GPIO_OUT_W1TS_REG, tms_mask)
+#define PIN_TMS_CLR()   REG_WRITE(GPIO_OUT_W1TC_REG, tms_mask)
+#define JTAG_TDI_OUT(bit) \
+  REG_WRITE(((bit) & 1U) ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, tdi_mask)
+#define JTAG_TDO_IN()   ((REG_READ(GPIO_IN_REG) >> tdo_pin) & 1U)
 
 #define JTAG_CYCLE_TCK()                \
   PIN_TCK_CLR();                        \
@@ -43,7 +64,7 @@
   PIN_DELAY()
 
 #define JTAG_CYCLE_TDI(tdi)             \
-  PIN_TDI_OUT(tdi);                     \
+  JTAG_TDI_OUT(tdi);                    \
   PIN_TCK_CLR();                        \
   PIN_DELAY();                          \
   PIN_TCK_SET();                        \
@@ -52,15 +73,24 @@
 #define JTAG_CYCLE_TDO(tdo)             \
   PIN_TCK_CLR();                        \
   PIN_DELAY();                          \
-  tdo = PIN_TDO_IN();                   \
+  tdo = JTAG_TDO_IN();                  \
   PIN_TCK_SET();                        \
   PIN_DELAY()
 
 #define JTAG_CYCLE_TDIO(tdi,tdo)        \
-  PIN_TDI_OUT(tdi);                     \
+  JTAG_TDI_OUT(tdi);                    \
+  PIN_TCK_CLR();                        \
+  PIN_DELAY();                          \
+  tdo = JTAG_TDO_IN();                  \
+  PIN_TCK_SET();                        \
+  PIN_DELAY()
+
+// Shift TDI bit k of val and capture TDO into bit k of tdo
+#define JTAG_SHIFT_BIT(val,tdo,k)       \
+  JTAG_TDI_OUT((val) >> (k));           \
   PIN_TCK_CLR();                        \
   PIN_DELAY();                          \
-  tdo = PIN_TDO_IN();                   \
+  tdo |= JTAG_TDO_IN() << (k);          \
   PIN_TCK_SET();                        \
   PIN_DELAY()
 
@@ -70,42 +100,248 @@
 #if (DAP_JTAG != 0)
 
 
-// Generate JTAG Sequence
-//   info:   sequence information
-//   tdi:    pointer to TDI generated data
-//   tdo:    pointer to TDO captured data
-//   return: none
-void JTAG_Sequence (uint32_t info, const uint8_t *tdi, uint8_t *tdo) {
-  uint32_t i_val;
-  uint32_t o_val;
-  uint32_t bit;
-  uint32_t n, k;
+#if (DAP_JTAG_SPI != 0)
+
+// SPI shifts: TCK, TDI and TDO are routed to SCLK, MOSI and MISO of SPI2 through the GPIO matrix
+// for the duration of one transaction, so the bit-banged TMS transitions around it keep working on
+// the same pins. SPI mode 3 (clock idle high, data changed on the falling and sampled on the rising
+// edge) matches the JTAG timing and leaves TCK high like the bit-banged cycles.
+
+#define JTAG_SPI_HOST           SPI2_HOST
 
-  n = info & JTAG_SEQUENCE_TCK;
-  if (n == 0U) {
-    n = 64U;
+static spi_device_handle_t JTAG_SPI_Device;
+static uint32_t            JTAG_SPI_Delay;      // Clock delay the device was set up for (0 = fast clock)
+static uint8_t             JTAG_SPI_State;      // 0 = not initialized, 1 = ready, 2 = not available
+
+// SPI clock of the current SWJ clock setting (inverse of the clock delay calculation)
+//   return: clock in Hz
+static uint32_t JTAG_SPI_Clock (void) {
+  uint32_t clock;
+
+  if (DAP_Data.fast_clock) {
+    return (JTAG_SPI_CLOCK_MAX);
   }
+  clock = CPU_CLOCK / (2U * ((DAP_Data.clock_delay * DELAY_SLOW_CYCLES) + IO_PORT_WRITE_CYCLES));
+  if (clock > JTAG_SPI_CLOCK_MAX) {
+    clock = JTAG_SPI_CLOCK_MAX;
+  }
+  return (clock);
+}
 
-  if (info & JTAG_SEQUENCE_TMS) {
-    PIN_TMS_SET();
-  } else {
-    PIN_TMS_CLR();
+// Set up the SPI bus and a device for the current SWJ clock
+//   return: 1 = SPI ready, 0 = not available
+static uint32_t JTAG_SPI_Setup (void) {
+  spi_bus_config_t bus = {
+    .mosi_io_num     = -1,
+    .miso_io_num     = -1,
+    .sclk_io_num     = -1,
+    .quadwp_io_num   = -1,
+    .quadhd_io_num   = -1,
+    .max_transfer_sz = 8,
+  };
+  spi_device_interface_config_t dev = {
+    .mode           = 3,
+    .spics_io_num   = -1,
+    .flags          = SPI_DEVICE_BIT_LSBFIRST,
+    .queue_size     = 1,
+  };
+  uint32_t delay;
+
+  if (JTAG_SPI_State == 0U) {
+    JTAG_SPI_State = (spi_bus_initialize(JTAG_SPI_HOST, &bus, SPI_DMA_DISABLED) == ESP_OK) ? 1U : 2U;
+  }
+  if (JTAG_SPI_State != 1U) {
+    return (0U);
   }
 
-  while (n) {
-    i_val = *tdi++;
-    o_val = 0U;
-    for (k = 8U; k && n; k--, n--) {
-      JTAG_CYCLE_TDIO(i_val, bit);
-      i_val >>= 1;
-      o_val >>= 1;
-      o_val  |= bit << 7;
-    }
-    o_val >>= k;
-    if (info & JTAG_SEQUENCE_TDO) {
-      *tdo++ = (uint8_t)o_val;
+  delay = DAP_Data.fast_clock ? 0U : DAP_Data.clock_delay;
+  if (JTAG_SPI_Device != NULL) {
+    if (delay == JTAG_SPI_Delay) {
+      return (1U);
     }
+    spi_device_release_bus(JTAG_SPI_Device);
+    spi_bus_remove_device(JTAG_SPI_Device);
+    JTAG_SPI_Device = NULL;
   }
+
+  // Acquiring the bus applies the clock polarity before SCLK is routed to TCK for the first time
+  dev.clock_speed_hz = (int)JTAG_SPI_Clock();
+  if (spi_bus_add_device(JTAG_SPI_HOST, &dev, &JTAG_SPI_Device) != ESP_OK) {
+    JTAG_SPI_Device = NULL;
+    return (0U);
+  }
+  spi_device_acquire_bus(JTAG_SPI_Device, portMAX_DELAY);
+  JTAG_SPI_Delay = delay;
+  return (1U);
+}
+
+// Shift bits with constant TMS through the SPI peripheral
+//   tdi:    pointer to TDI data (LSB first)
+//   tdo:    pointer to TDO captured data (LSB first, unused bits of the last byte cleared)
+//   count:  number of bits (1..64)
+//   return: 1 = bits shifted, 0 = SPI not available or count out of range (bits must be bit-banged)
+static uint32_t JTAG_SPI_Shift (const uint8_t *tdi, uint8_t *tdo, uint32_t count) {
+  spi_transaction_t t;
+  uint32_t tx[2], rx[2];
+  uint32_t tck, tdi_pin;
+  uint32_t bytes;
+  esp_err_t err;
+
+  if ((count == 0U) || (count > 64U) || (JTAG_SPI_Setup() == 0U)) {
+    return (0U);
+  }
+
+  tck     = DAP_Pins->swclk;
+  tdi_pin = DAP_Pins->tdi;
+  bytes   = (count + 7U) / 8U;
+
+  memcpy(tx, tdi, bytes);
+  memset(&t, 0, sizeof(t));
+  t.length    = count;
+  t.rxlength  = count;
+  t.tx_buffer = tx;
+  t.rx_buffer = rx;
+
+  esp_rom_gpio_connect_in_signal(DAP_Pins->tdo, spi_periph_signal[JTAG_SPI_HOST].spiq_in, false);
+  esp_rom_gpio_connect_out_signal(tck, spi_periph_signal[JTAG_SPI_HOST].spiclk_out, false, false);
+  esp_rom_gpio_connect_out_signal(tdi_pin, spi_periph_signal[JTAG_SPI_HOST].spid_out, false, false);
+  err = spi_device_polling_transmit(JTAG_SPI_Device, &t);
+  esp_rom_gpio_connect_out_signal(tck, SIG_GPIO_OUT_IDX, false, false);
+  esp_rom_gpio_connect_out_signal(tdi_pin, SIG_GPIO_OUT_IDX, false, false);
+
+  if (err != ESP_OK) {
+    // Nothing was clocked out when the transaction could not be set up
+    return (0U);
+  }
+
+  memcpy(tdo, rx, bytes);
+  if (count & 7U) {
+    tdo[bytes - 1U] &= (uint8_t)((1U << (count & 7U)) - 1U);
+  }
+  return (1U);
+}
+
+#endif  /* (DAP_JTAG_SPI != 0) */
+
+
+// Shift segments of at least JTAG_SPI_MIN_BITS bits (and not more than 32) through SPI and
+// return the captured TDO data
+#if (DAP_JTAG_SPI != 0)
+#define JTAG_SHIFT_SPI(tdi,count)                                               \
+  if (((count) >= JTAG_SPI_MIN_BITS) && ((count) <= 32U)) {                     \
+    uint8_t  spi_tdi[4], spi_tdo[4];                                            \
+    uint32_t spi_n;                                                             \
+    for (spi_n = 0U; spi_n < 4U; spi_n++) {                                     \
+      spi_tdi[spi_n] = (uint8_t)((tdi) >> (8U * spi_n));                        \
+    }                                                                           \
+    if (JTAG_SPI_Shift(spi_tdi, spi_tdo, (count))) {                            \
+      return ((uint32_t)(spi_tdo[0] <<  0) | ((uint32_t)spi_tdo[1] <<  8) |     \
+              ((uint32_t)spi_tdo[2] << 16) | ((uint32_t)spi_tdo[3] << 24));     \
+    }                                                                           \
+  }
+#else
+#define JTAG_SHIFT_SPI(tdi,count)
+#endif
+
+// JTAG Shift with constant TMS
+//   tdi:    TDI data (LSB first)
+//   count:  number of bits (0..32)
+//   return: captured TDO data (LSB first)
+// Whole bytes are shifted with one loop iteration of 8 unrolled cycles, long segments with SPI.
+#define JTAG_ShiftFunction(speed)           /**/                                \
+static uint32_t JTAG_Shift##speed (uint32_t tdi, uint32_t count) {              \
+  JTAG_PINS();                                                                  \
+  uint32_t tdo;                                                                 \
+  uint32_t byte;                                                                \
+  uint32_t n;                                                                   \
+                                                                                \
+  JTAG_SHIFT_SPI(tdi, count);                                                   \
+                                                                                \
+  tdo = 0U;                                                                     \
+  for (n = 0U; (n + 8U) <= count; n += 8U) {                                    \
+    byte = 0U;                                                                  \
+    JTAG_SHIFT_BIT(tdi, byte, 0);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 1);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 2);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 3);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 4);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 5);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 6);                                               \
+    JTAG_SHIFT_BIT(tdi, byte, 7);                                               \
+    tdo |= byte << n;                                                           \
+    tdi >>= 8;                                                                  \
+  }                                                                             \
+  for (; n < count; n++) {                                                      \
+    byte = 0U;                                                                  \
+    JTAG_SHIFT_BIT(tdi, byte, 0);                                               \
+    tdo |= byte << n;                                                           \
+    tdi >>= 1;                                                                  \
+  }                                                                             \
+                                                                                \
+  return (tdo);                                                                 \
+}
+
+
+// Shift a whole sequence of at least JTAG_SPI_MIN_BITS bits through SPI
+#if (DAP_JTAG_SPI != 0)
+#define JTAG_SEQUENCE_SPI(info,tdi,tdo,count)                                   \
+  if ((count) >= JTAG_SPI_MIN_BITS) {                                           \
+    uint8_t spi_tdo[8];                                                         \
+    if (JTAG_SPI_Shift(tdi, spi_tdo, (count))) {                                \
+      if ((info) & JTAG_SEQUENCE_TDO) {                                         \
+        memcpy(tdo, spi_tdo, ((count) + 7U) / 8U);                              \
+      }                                                                         \
+      return;                                                                   \
+    }                                                                           \
+  }
+#else
+#define JTAG_SEQUENCE_SPI(info,tdi,tdo,count)
+#endif
+
+// Generate JTAG Sequence
+//   info:   sequence information
+//   tdi:    pointer to TDI generated data
+//   tdo:    pointer to TDO captured data
+//   return: none
+#define JTAG_SequenceFunction(speed)        /**/                                \
+static void JTAG_Sequence##speed (uint32_t info, const uint8_t *tdi, uint8_t *tdo) { \
+  JTAG_PINS();                                                                  \
+  uint32_t o_val;                                                               \
+  uint32_t n, k;                                                                \
+                                                                                \
+  n = info & JTAG_SEQUENCE_TCK;                                                 \
+  if (n == 0U) {                                                                \
+    n = 64U;                                                                    \
+  }                                                                             \
+                                                                                \
+  if (info & JTAG_SEQUENCE_TMS) {                                               \
+    PIN_TMS_SET();                                                              \
+  } else {                                                                      \
+    PIN_TMS_CLR();                                                              \
+  }                                                                             \
+                                                                                \
+  JTAG_SEQUENCE_SPI(info, tdi, tdo, n);                                         \
+                                                                                \
+  while (n) {                                                                   \
+    k = (n > 8U) ? 8U : n;                                                      \
+    o_val = JTAG_Shift##speed(*tdi++, k);                                       \
+    n -= k;                                                                     \
+    if (info & JTAG_SEQUENCE_TDO) {                                             \
+      *tdo++ = (uint8_t)o_val;                                                  \
+    }                                                                           \
+  }                                                                             \
+}
+
+
+// JTAG Bypass cycles with constant TMS (TDI = 1)
+//   count:  number of cycles
+//   return: none
+#define JTAG_BypassFunction(speed)          /**/                                \
+static void JTAG_Bypass##speed (uint32_t count) {                               \
+  for (; count >= 32U; count -= 32U) {                                          \
+    JTAG_Shift##speed(0xFFFFFFFFU, 32U);                                        \
+  }                                                                             \
+  JTAG_Shift##speed(0xFFFFFFFFU, count);                                        \
 }
 
 
@@ -114,6 +350,7 @@ void JTAG_Sequence (uint32_t info, const uint8_t *tdi, uint8_t *tdo) {
 //   return: none
 #define JTAG_IR_Function(speed) /**/                                            \
 static void JTAG_IR_##speed (uint32_t ir) {                                     \
+  JTAG_PINS();                                                                  \
   uint32_t n;                                                                   \
                                                                                 \
   PIN_TMS_SET();                                                                \
@@ -123,21 +360,23 @@ static void JTAG_IR_##speed (uint32_t ir) {
   JTAG_CYCLE_TCK();                         /* Capture-IR */                    \
   JTAG_CYCLE_TCK();                         /* Shift-IR */                      \
                                                                                 \
-  PIN_TDI_OUT(1U);                                                              \
-  for (n = DAP_Data.jtag_dev.ir_before[DAP_Data.jtag_dev.index]; n; n--) {      \
-    JTAG_CYCLE_TCK();                       /* Bypass before data */            \
+  n = DAP_Data.jtag_dev.ir_before[DAP_Data.jtag_dev.index];                     \
+  JTAG_Bypass##speed(n);                    /* Bypass before data */            \
+  n = DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index];                     \
+  if (n != 0U) {                                                                \
+    n--;                                    /* Last bit is shifted on exit */   \
   }                                                                             \
-  for (n = DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index] - 1U; n; n--) { \
-    JTAG_CYCLE_TDI(ir);                     /* Set IR bits (except last) */     \
-    ir >>= 1;                                                                   \
+  for (; n > 32U; n -= 32U) {                                                   \
+    JTAG_Shift##speed(ir, 32U);             /* Set IR bits in 32-bit chunks */  \
+    ir = 0U;                                /* TDI = 0 after bit 31 */          \
   }                                                                             \
+  JTAG_Shift##speed(ir, n);                 /* Set IR bits (except last) */     \
+  ir = (n < 32U) ? (ir >> n) : 0U;                                              \
   n = DAP_Data.jtag_dev.ir_after[DAP_Data.jtag_dev.index];                      \
   if (n) {                                                                      \
     JTAG_CYCLE_TDI(ir);                     /* Set last IR bit */               \
-    PIN_TDI_OUT(1U);                                                            \
-    for (--n; n; n--) {                                                         \
-      JTAG_CYCLE_TCK();                     /* Bypass after data */             \
-    }                                                                           \
+    JTAG_TDI_OUT(1U);                                                           \
+    JTAG_Bypass##speed(n - 1U);             /* Bypass after data */             \
     PIN_TMS_SET();                                                              \
     JTAG_CYCLE_TCK();                       /* Bypass & Exit1-IR */             \
   } else {                                                                      \
@@ -148,7 +387,7 @@ static void JTAG_IR_##speed (uint32_t ir) {
   JTAG_CYCLE_TCK();                         /* Update-IR */                     \
   PIN_TMS_CLR();                                                                \
   JTAG_CYCLE_TCK();                         /* Idle */                          \
-  PIN_TDI_OUT(1U);                                                              \
+  JTAG_TDI_OUT(1U);                                                             \
 }
 
 
@@ -158,6 +397,7 @@ static void JTAG_IR_##speed (uint32_t ir) {
 //   return:  ACK[2:0]
 #define JTAG_TransferFunction(speed)        /**/                                \
 static uint8_t JTAG_Transfer##speed (uint32_t request, uint32_t *data) {        \
+  JTAG_PINS();                                                                  \
   uint32_t ack;                                                                 \
   uint32_t bit;                                                                 \
   uint32_t val;                                                                 \
@@ -169,9 +409,7 @@ static uint8_t JTAG_Transfer##speed (uint32_t request, uint32_t *data) {
   JTAG_CYCLE_TCK();                         /* Capture-DR */                    \
   JTAG_CYCLE_TCK();                         /* Shift-DR */                      \
                                                                                 \
-  for (n = DAP_Data.jtag_dev.index; n; n--) {                                   \
-    JTAG_CYCLE_TCK();                       /* Bypass before data */            \
-  }                                                                             \
+  JTAG_Bypass##speed(DAP_Data.jtag_dev.index);  /* Bypass before data */       \
                                                                                 \
   JTAG_CYCLE_TDIO(request >> 1, bit);       /* Set RnW, Get ACK.0 */            \
   ack  = bit << 1;                                                              \
@@ -189,18 +427,11 @@ static uint8_t JTAG_Transfer##speed (uint32_t request, uint32_t *data) {
                                                                                 \
   if (request & DAP_TRANSFER_RnW) {                                             \
     /* Read Transfer */                                                         \
-    val = 0U;                                                                   \
-    for (n = 31U; n; n--) {                                                     \
-      JTAG_CYCLE_TDO(bit);                  /* Get D0..D30 */                   \
-      val  |= bit << 31;                                                        \
-      val >>= 1;                                                                \
-    }                                                                           \
+    val = JTAG_Shift##speed(0U, 31U);       /* Get D0..D30 */                   \
     n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1U;                 \
     if (n) {                                                                    \
       JTAG_CYCLE_TDO(bit);                  /* Get D31 */                       \
-      for (--n; n; n--) {                                                       \
-        JTAG_CYCLE_TCK();                   /* Bypass after data */             \
-      }                                                                         \
+      JTAG_Bypass##speed(n - 1U);           /* Bypass after data */             \
       PIN_TMS_SET();                                                            \
       JTAG_CYCLE_TCK();                     /* Bypass & Exit1-DR */             \
     } else {                                                                    \
@@ -212,16 +443,12 @@ static uint8_t JTAG_Transfer##speed (uint32_t request, uint32_t *data) {
   } else {                                                                      \
     /* Write Transfer */                                                        \
     val = *data;                                                                \
-    for (n = 31U; n; n--) {                                                     \
-      JTAG_CYCLE_TDI(val);                  /* Set D0..D30 */                   \
-      val >>= 1;                                                                \
-    }                                                                           \
+    JTAG_Shift##speed(val, 31U);            /* Set D0..D30 */                   \
+    val >>= 31;                                                                 \
     n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1U;                 \
     if (n) {                                                                    \
       JTAG_CYCLE_TDI(val);                  /* Set D31 */                       \
-      for (--n; n; n--) {                                                       \
-        JTAG_CYCLE_TCK();                   /* Bypass after data */             \
-      }                                                                         \
+      JTAG_Bypass##speed(n - 1U);           /* Bypass after data */             \
       PIN_TMS_SET();                                                            \
       JTAG_CYCLE_TCK();                     /* Bypass & Exit1-DR */             \
     } else {                                                                    \
@@ -234,7 +461,7 @@ exit:
   JTAG_CYCLE_TCK();                         /* Update-DR */                     \
   PIN_TMS_CLR();                                                                \
   JTAG_CYCLE_TCK();                         /* Idle */                          \
-  PIN_TDI_OUT(1U);                                                              \
+  JTAG_TDI_OUT(1U);                                                             \
                                                                                 \
   /* Capture Timestamp */                                                       \
   if (request & DAP_TRANSFER_TIMESTAMP) {                                       \
@@ -253,11 +480,17 @@ exit:
 
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_FAST()
+JTAG_ShiftFunction(Fast)
+JTAG_BypassFunction(Fast)
+JTAG_SequenceFunction(Fast)
 JTAG_IR_Function(Fast)
 JTAG_TransferFunction(Fast)
 
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
+JTAG_ShiftFunction(Slow)
+JTAG_BypassFunction(Slow)
+JTAG_SequenceFunction(Slow)
 JTAG_IR_Function(Slow)
 JTAG_TransferFunction(Slow)
 
@@ -265,6 +498,7 @@ JTAG_TransferFunction(Slow)
 // JTAG Read IDCODE register
 //   return: value read
 uint32_t JTAG_ReadIDCode (void) {
+  JTAG_PINS();
   uint32_t bit;
   uint32_t val;
   uint32_t n;
@@ -279,12 +513,7 @@ uint32_t JTAG_ReadIDCode (void) {
     JTAG_CYCLE_TCK();                       /* Bypass before data */
   }
 
-  val = 0U;
-  for (n = 31U; n; n--) {
-    JTAG_CYCLE_TDO(bit);                    /* Get D0..D30 */
-    val  |= bit << 31;
-    val >>= 1;
-  }
+  val = JTAG_ShiftSlow(0U, 31U);            /* Get D0..D30 */
   PIN_TMS_SET();
   JTAG_CYCLE_TDO(bit);                      /* Get D31 & Exit1-DR */
   val |= bit << 31;
@@ -292,6 +521,7 @@ uint32_t JTAG_ReadIDCode (void) {
   JTAG_CYCLE_TCK();                         /* Update-DR */
   PIN_TMS_CLR();
   JTAG_CYCLE_TCK();                         /* Idle */
+  JTAG_TDI_OUT(1U);
 
   return (val);
 }
@@ -301,6 +531,7 @@ uint32_t JTAG_ReadIDCode (void) {
 //   data:   value to write
 //   return: none
 void JTAG_WriteAbort (uint32_t data) {
+  JTAG_PINS();
   uint32_t n;
 
   PIN_TMS_SET();
@@ -313,15 +544,13 @@ void JTAG_WriteAbort (uint32_t data) {
     JTAG_CYCLE_TCK();                       /* Bypass before data */
   }
 
-  PIN_TDI_OUT(0U);
+  JTAG_TDI_OUT(0U);
   JTAG_CYCLE_TCK();                         /* Set RnW=0 (Write) */
   JTAG_CYCLE_TCK();                         /* Set A2=0 */
   JTAG_CYCLE_TCK();                         /* Set A3=0 */
 
-  for (n = 31U; n; n--) {
-    JTAG_CYCLE_TDI(data);                   /* Set D0..D30 */
-    data >>= 1;
-  }
+  JTAG_ShiftSlow(data, 31U);                /* Set D0..D30 */
+  data >>= 31;
   n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1U;
   if (n) {
     JTAG_CYCLE_TDI(data);                   /* Set D31 */
@@ -338,7 +567,21 @@ void JTAG_WriteAbort (uint32_t data) {
   JTAG_CYCLE_TCK();                         /* Update-DR */
   PIN_TMS_CLR();
   JTAG_CYCLE_TCK();                         /* Idle */
-  PIN_TDI_OUT(1U);
+  JTAG_TDI_OUT(1U);
+}
+
+
+// Generate JTAG Sequence
+//   info:   sequence information
+//   tdi:    pointer to TDI generated data
+//   tdo:    pointer to TDO captured data
+//   return: none
+void JTAG_Sequence (uint32_t info, const uint8_t *tdi, uint8_t *tdo) {
+  if (DAP_Data.fast_clock) {
+    JTAG_SequenceFast(info, tdi, tdo);
+  } else {
+    JTAG_SequenceSlow(info, tdi, tdo);
+  }
 }
 
 
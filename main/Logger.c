@@ -0,0 +1,297 @@
+// Data logger
+// Reads a list of target variables, each with its own period, between host commands and notifies
+// timestamped records on the stream service. When the BLE link cannot keep up, the pending batch is
+// kept and retried while new records are dropped and counted (the target is never stalled).
+//
+// Batch format:
+//   sequence (1), base timestamp (4)
+//   then for each record: entry index (1), timestamp difference to base (varint), value (width of entry)
+// Timestamps are Test Domain Timer ticks (TIMESTAMP_CLOCK).
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "ble_stream.h"
+
+#if (DAP_SWD != 0)
+
+// Maximum number of logged variables
+#define LOG_MAX_ENTRIES         16U
+
+// Maximum time a record waits in a batch (in us)
+#define LOG_LATENCY             20000U
+
+// Maximum length of a batch
+#define LOG_FRAME_SIZE          244U
+#define LOG_HEADER_SIZE         5U
+#define LOG_RECORD_MAX          10U             // index, varint, 4-byte value
+
+// Range of the period of an entry (in us); shorter periods would keep the DAP task reading target
+// memory without a break, longer ones overflow the signed timestamp tick comparisons
+#define LOG_PERIOD_MIN          100U
+#define LOG_PERIOD_MAX          (0x7FFFFFFFU / TIMESTAMP_TICKS_PER_US)
+
+// Logger Control
+#define LOG_CLEAR               0U              // Stop and remove all entries
+#define LOG_ADD                 1U              // Add entry
+#define LOG_START               2U              // Start logging
+#define LOG_STOP                3U              // Stop logging
+#define LOG_STATUS              4U              // Get status
+
+typedef struct {
+  uint32_t addr;                                // Target address (aligned to width)
+  uint32_t period;                              // Period in timestamp ticks
+  uint32_t next;                                // Timestamp when the next read is due
+  uint8_t  width;                               // Width in bytes (1, 2 or 4)
+} Log_Entry_t;
+
+static struct {
+  uint8_t  active;                              // Logging enabled
+  uint8_t  ap;                                  // Index of the MEM-AP
+  uint8_t  count;                               // Number of entries
+  uint8_t  sequence;                            // Sequence number of the next batch
+  uint8_t  pending;                             // Batch is complete but could not be sent yet
+  uint16_t length;                              // Length of the batch (0: empty)
+  uint16_t limit;                               // Maximum length of the batch
+  uint32_t base;                                // Base timestamp of the batch
+  uint32_t sent;                                // Number of sent records
+  uint32_t dropped;                             // Number of dropped records
+  uint32_t records;                             // Number of records in the batch
+  Log_Entry_t entry[LOG_MAX_ENTRIES];
+  uint8_t  frame[LOG_FRAME_SIZE];               // Batch
+} Log;
+
+
+// Send the batch
+//   return: 1 when the batch was sent (or empty)
+static uint32_t Log_Flush (void) {
+  if (Log.length == 0U) {
+    return (1U);
+  }
+
+  if (ble_stream_notify(BLE_STREAM_LOG, Log.frame, Log.length) != 0) {
+    Log.pending = 1U;     // Retried on next poll
+    return (0U);
+  }
+
+  Log.sent    += Log.records;
+  Log.sequence++;
+  Log.pending  = 0U;
+  Log.length   = 0U;
+  Log.records  = 0U;
+  return (1U);
+}
+
+
+// Add record to the batch
+//   index:  entry index
+//   time:   timestamp of the read
+//   value:  read value
+static void Log_Add (uint32_t index, uint32_t time, uint32_t value) {
+  uint32_t diff;
+  uint32_t n;
+
+  if ((Log.length != 0U) && ((Log.length + LOG_RECORD_MAX) > Log.limit)) {
+    Log_Flush();
+  }
+  if (Log.pending) {
+    Log.dropped++;
+    return;
+  }
+
+  if (Log.length == 0U) {
+    Log.limit = ble_stream_payload_size();
+    if (Log.limit > LOG_FRAME_SIZE) {
+      Log.limit = LOG_FRAME_SIZE;
+    }
+    Log.base     = time;
+    Log.frame[0] = Log.sequence;
+    Log.frame[1] = (uint8_t)(time >>  0);
+    Log.frame[2] = (uint8_t)(time >>  8);
+    Log.frame[3] = (uint8_t)(time >> 16);
+    Log.frame[4] = (uint8_t)(time >> 24);
+    Log.length   = LOG_HEADER_SIZE;
+  }
+
+  Log.frame[Log.length++] = (uint8_t)index;
+  diff = time - Log.base;
+  while (diff >= 0x80U) {
+    Log.frame[Log.length++] = (uint8_t)(diff | 0x80U);
+    diff >>= 7;
+  }
+  Log.frame[Log.length++] = (uint8_t)diff;
+  for (n = 0U; n < Log.entry[index].width; n++) {
+    Log.frame[Log.length++] = (uint8_t)value;
+    value >>= 8;
+  }
+  Log.records++;
+}
+
+
+// Process Logger command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1)
+//           LOG_ADD:   address (4), width in bytes (1), period in us (4, LOG_PERIOD_MIN..LOG_PERIOD_MAX)
+//           LOG_START: AP index (1)
+// Response: status (1), number of entries (1), sent records (4), dropped records (4)
+uint32_t Logger_Configure (const uint8_t *request, uint8_t *response) {
+  Log_Entry_t *entry;
+  uint32_t num;
+  uint32_t addr;
+  uint32_t period;
+  uint32_t width;
+  uint32_t n;
+
+  num = 1U;
+  *response = DAP_OK;
+
+  switch (*request) {
+    case LOG_CLEAR:
+      Log_Flush();
+      Log.active = 0U;
+      Log.count  = 0U;
+      break;
+
+    case LOG_ADD:
+      addr   = (uint32_t)(*(request+1) <<  0) |
+               (uint32_t)(*(request+2) <<  8) |
+               (uint32_t)(*(request+3) << 16) |
+               (uint32_t)(*(request+4) << 24);
+      width  = *(request+5);
+      period = (uint32_t)(*(request+6) <<  0) |
+               (uint32_t)(*(request+7) <<  8) |
+               (uint32_t)(*(request+8) << 16) |
+               (uint32_t)(*(request+9) << 24);
+      num = 10U;
+      if ((Log.count == LOG_MAX_ENTRIES) ||
+          ((width != 1U) && (width != 2U) && (width != 4U)) || ((addr & (width - 1U)) != 0U) ||
+          (period < LOG_PERIOD_MIN) || (period > LOG_PERIOD_MAX)) {
+        *response = DAP_ERROR;
+        break;
+      }
+      entry = &Log.entry[Log.count++];
+      entry->addr   = addr;
+      entry->width  = (uint8_t)width;
+      entry->period = period * TIMESTAMP_TICKS_PER_US;
+      entry->next   = TIMESTAMP_GET();
+      break;
+
+    case LOG_START:
+      num = 2U;
+      if ((DAP_Data.debug_port != DAP_PORT_SWD) || (Log.count == 0U)) {
+        *response = DAP_ERROR;
+        break;
+      }
+      Log.ap      = *(request+1);
+      Log.length  = 0U;
+      Log.records = 0U;
+      Log.pending = 0U;
+      Log.sent    = 0U;
+      Log.dropped = 0U;
+      for (n = 0U; n < Log.count; n++) {
+        Log.entry[n].next = TIMESTAMP_GET();
+      }
+      Log.active  = 1U;
+      break;
+
+    case LOG_STOP:
+      Log_Flush();
+      Log.active = 0U;
+      break;
+
+    case LOG_STATUS:
+      break;
+
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  *(response+1) = Log.count;
+  *(response+2) = (uint8_t)(Log.sent >>  0);
+  *(response+3) = (uint8_t)(Log.sent >>  8);
+  *(response+4) = (uint8_t)(Log.sent >> 16);
+  *(response+5) = (uint8_t)(Log.sent >> 24);
+  *(response+6) = (uint8_t)(Log.dropped >>  0);
+  *(response+7) = (uint8_t)(Log.dropped >>  8);
+  *(response+8) = (uint8_t)(Log.dropped >> 16);
+  *(response+9) = (uint8_t)(Log.dropped >> 24);
+
+  return ((num << 16) | 10U);
+}
+
+
+// Read variables which are due
+//   return: time in microseconds until the next read
+uint32_t Logger_Poll (void) {
+  Log_Entry_t *entry;
+  uint32_t time;
+  uint32_t wait;
+  uint32_t data;
+  uint32_t n;
+  uint8_t  open;
+
+  if (!Log.active) {
+    return (DAP_POLL_IDLE);
+  }
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    // Host disconnected
+    Log.active = 0U;
+    return (DAP_POLL_IDLE);
+  }
+
+  time = TIMESTAMP_GET();
+  if (Log.pending ||
+      ((Log.length != 0U) && ((time - Log.base) >= (LOG_LATENCY * TIMESTAMP_TICKS_PER_US)))) {
+    Log_Flush();
+  }
+
+  open = 0U;
+  for (n = 0U; n < Log.count; n++) {
+    entry = &Log.entry[n];
+    time  = TIMESTAMP_GET();
+    if ((int32_t)(time - entry->next) < 0) {
+      continue;
+    }
+    // Catch up at most one period when reads are late
+    entry->next += entry->period;
+    if ((int32_t)(time - entry->next) > 0) {
+      entry->next = time + entry->period;
+    }
+    if (!ble_stream_is_subscribed(BLE_STREAM_LOG)) {
+      continue;   // Nobody listens, do not disturb the target
+    }
+    if (!open) {
+      if (MEM_Open(Log.ap) != DAP_TRANSFER_OK) {
+        break;
+      }
+      open = 1U;
+    }
+    if (MEM_Read(entry->addr & ~3U, &data) != DAP_TRANSFER_OK) {
+      break;
+    }
+    Log_Add(n, time, data >> ((entry->addr & 3U) * 8U));
+  }
+  MEM_Close();
+
+  // Time until the next entry is due
+  time = TIMESTAMP_GET();
+  wait = DAP_POLL_IDLE;
+  for (n = 0U; n < Log.count; n++) {
+    if ((int32_t)(Log.entry[n].next - time) <= 0) {
+      return (0U);
+    }
+    if (((Log.entry[n].next - time) / TIMESTAMP_TICKS_PER_US) < wait) {
+      wait = (Log.entry[n].next - time) / TIMESTAMP_TICKS_PER_US;
+    }
+  }
+  if ((Log.length != 0U) && (wait > LOG_LATENCY)) {
+    wait = LOG_LATENCY;
+  }
+  return (wait + 1U);
+}
+
+#endif  /* (DAP_SWD != 0) */
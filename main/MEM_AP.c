@@ -0,0 +1,458 @@
+// Target memory access through a MEM-AP for probe-side jobs (SWD only)
+// The host debugger caches DP SELECT and AP CSW/TAR, so every access sequence is bracketed
+// by MEM_Open and MEM_Close which save and restore the AP context the host left behind.
+// No sequence is opened while the SELECT of the host is unknown (after a line reset or a transfer
+// without response), since it could not be restored.
+
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// DP ABORT flags
+#define ABORT_CLEAR_ERRORS      0x1EU   // STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR
+
+// AP CSW fields
+#define CSW_SIZE_MASK           0x07U
+#define CSW_SIZE_BYTE           0x00U
+#define CSW_SIZE_WORD           0x02U
+#define CSW_ADDRINC_MASK        0x30U
+#define CSW_ADDRINC_OFF         0x00U
+#define CSW_ADDRINC_SINGLE      0x10U
+
+// TAR auto-increment is only guaranteed within a 1 KB block
+#define TAR_INC_BLOCK           0x400U
+
+// AP register banks
+#define AP_BANK_CSW             0x00U   // CSW, TAR, DRW
+#define AP_BANK_BD              0x01U   // Banked Data BD0..BD3
+
+// MEM-AP Access State
+static struct {
+  uint8_t  active;                      // Access sequence open
+  uint8_t  error;                       // Transfer error occurred (sticky flags may be set)
+  uint8_t  csw_written;                 // CSW was changed
+  uint8_t  tar_written;                 // TAR was changed
+  uint8_t  tar_valid;                   // Current TAR is known
+  uint32_t ap;                          // SELECT of the accessed AP (APSEL and DPBANKSEL)
+  uint32_t select;                      // Host SELECT
+  uint32_t csw;                         // Host CSW
+  uint32_t tar;                         // Host TAR
+  uint32_t cur_csw;                     // Current CSW
+  uint32_t cur_tar;                     // Current TAR
+} MEM;
+
+
+// Transfer with retries on WAIT response
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+static uint8_t MEM_Transfer (uint32_t request, uint32_t *data) {
+  uint32_t retry;
+  uint8_t  ack;
+
+  retry = DAP_Data.transfer.retry_count;
+  do {
+    ack = SWD_Transfer(request, data);
+  } while ((ack == DAP_TRANSFER_WAIT) && retry--);
+
+  if (ack != DAP_TRANSFER_OK) {
+    MEM.error = 1U;
+    MEM.tar_valid = 0U;
+  }
+  return (ack);
+}
+
+// Read AP register (posted read followed by RDBUFF)
+//   reg:    A[3:2]
+//   data:   DATA[31:0]
+//   return: ACK[2:0]
+static uint8_t MEM_ReadAP (uint32_t reg, uint32_t *data) {
+  uint8_t ack;
+
+  ack = MEM_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | reg, NULL);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+  }
+  return (ack);
+}
+
+// Write AP register
+//   reg:    A[3:2]
+//   data:   DATA[31:0]
+//   return: ACK[2:0]
+static uint8_t MEM_WriteAP (uint32_t reg, uint32_t data) {
+  return MEM_Transfer(DAP_TRANSFER_APnDP | reg, &data);
+}
+
+// Write DP SELECT (not sent when it already holds the value)
+//   select: SELECT value
+//   return: ACK[2:0]
+static uint8_t MEM_Select (uint32_t select) {
+  return MEM_Transfer(DP_SELECT, &select);
+}
+
+// Select AP register bank
+//   bank:   AP_BANK_xxx
+//   return: ACK[2:0]
+static uint8_t MEM_SelectBank (uint32_t bank) {
+  return MEM_Select(MEM.ap | (bank << 4));
+}
+
+// Set CSW access size and address increment
+//   size:   CSW_SIZE_xxx
+//   inc:    CSW_ADDRINC_xxx
+//   return: ACK[2:0]
+static uint8_t MEM_SetCSW (uint32_t size, uint32_t inc) {
+  uint32_t csw;
+  uint8_t  ack;
+
+  csw = (MEM.csw & ~(CSW_SIZE_MASK | CSW_ADDRINC_MASK)) | size | inc;
+  if (csw == MEM.cur_csw) {
+    return (DAP_TRANSFER_OK);
+  }
+  ack = MEM_WriteAP(AP_CSW, csw);
+  if (ack == DAP_TRANSFER_OK) {
+    MEM.cur_csw = csw;
+    MEM.csw_written = 1U;
+  }
+  return (ack);
+}
+
+// Set TAR unless it already holds the address
+//   addr:   target address
+//   return: ACK[2:0]
+static uint8_t MEM_SetTAR (uint32_t addr) {
+  uint8_t ack;
+
+  if (MEM.tar_valid && (MEM.cur_tar == addr)) {
+    return (DAP_TRANSFER_OK);
+  }
+  MEM.tar_written = 1U;
+  ack = MEM_WriteAP(AP_TAR, addr);
+  if (ack == DAP_TRANSFER_OK) {
+    MEM.cur_tar   = addr;
+    MEM.tar_valid = 1U;
+  }
+  return (ack);
+}
+
+
+// Open MEM-AP access sequence (save AP context of the host)
+//   apsel:  index of the MEM-AP
+//   return: ACK[2:0], DAP_TRANSFER_WAIT when the SELECT of the host is unknown (nothing is sent,
+//           because SELECT could not be restored; background jobs try again later)
+uint8_t MEM_Open (uint32_t apsel) {
+  uint8_t  ack;
+
+  if ((DAP_Data.debug_port != DAP_PORT_SWD) || MEM.active) {
+    return (DAP_TRANSFER_ERROR);
+  }
+  if ((DAP_Data.shadow.valid & DAP_SHADOW_SELECT) == 0U) {
+    return (DAP_TRANSFER_WAIT);
+  }
+
+  MEM.active       = 1U;
+  MEM.error        = 0U;
+  MEM.csw_written  = 0U;
+  MEM.tar_written  = 0U;
+  MEM.tar_valid    = 0U;
+  MEM.select       = DAP_Data.shadow.select;
+
+  // Select AP bank 0 (CSW, TAR, DRW), keep DPBANKSEL of the host
+  MEM.ap = (apsel << 24) | (MEM.select & 0x0FU);
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack != DAP_TRANSFER_OK) {
+    return (ack);
+  }
+
+  // Save CSW and TAR, shadow copies are used when the host accessed the same AP
+  if (((DAP_Data.shadow.valid & (DAP_SHADOW_CSW | DAP_SHADOW_TAR)) == (DAP_SHADOW_CSW | DAP_SHADOW_TAR)) &&
+      ((DAP_Data.shadow.select & (DP_SELECT_APSEL | DP_SELECT_APBANKSEL)) == (apsel << 24))) {
+    MEM.csw       = DAP_Data.shadow.csw;
+    MEM.tar       = DAP_Data.shadow.tar;
+    MEM.cur_csw   = MEM.csw;
+    MEM.cur_tar   = MEM.tar;
+    MEM.tar_valid = 1U;
+    return (DAP_TRANSFER_OK);
+  }
+
+  // Posted reads: CSW, TAR, RDBUFF
+  ack = MEM_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | AP_CSW, NULL);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | AP_TAR, &MEM.csw);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, &MEM.tar);
+  }
+  MEM.cur_csw   = MEM.csw;
+  MEM.cur_tar   = MEM.tar;
+  MEM.tar_valid = (ack == DAP_TRANSFER_OK) ? 1U : 0U;
+
+  return (ack);
+}
+
+
+// Close MEM-AP access sequence (clear errors and restore AP context of the host)
+//   return: ACK[2:0] of the first failed restore step or DAP_TRANSFER_OK
+uint8_t MEM_Close (void) {
+  uint32_t data;
+  uint8_t  ack;
+
+  if (!MEM.active) {
+    return (DAP_TRANSFER_ERROR);
+  }
+
+  ack = DAP_TRANSFER_OK;
+
+  if (MEM.error) {
+    // Do not leave sticky errors behind for the host
+    data = ABORT_CLEAR_ERRORS;
+    SWD_Transfer(DP_ABORT, &data);
+  }
+  if (MEM.tar_written || MEM.csw_written) {
+    ack = MEM_SelectBank(AP_BANK_CSW);
+  }
+  if (MEM.tar_written && (ack == DAP_TRANSFER_OK)) {
+    ack = MEM_WriteAP(AP_TAR, MEM.tar);
+  }
+  if (MEM.csw_written && (ack == DAP_TRANSFER_OK)) {
+    ack = MEM_WriteAP(AP_CSW, MEM.csw);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_Select(MEM.select);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    // Make sure that posted writes are complete
+    ack = MEM_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
+  }
+
+  MEM.active = 0U;
+  return (ack);
+}
+
+
+// Read target memory word
+//   addr:   target address (word aligned)
+//   data:   pointer to read data
+//   return: ACK[2:0]
+uint8_t MEM_Read (uint32_t addr, uint32_t *data) {
+  uint8_t ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_WORD, CSW_ADDRINC_OFF);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetTAR(addr);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_ReadAP(AP_DRW, data);
+  }
+  return (ack);
+}
+
+
+// Write target memory word
+//   addr:   target address (word aligned)
+//   data:   data to write
+//   return: ACK[2:0]
+uint8_t MEM_Write (uint32_t addr, uint32_t data) {
+  uint8_t ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_WORD, CSW_ADDRINC_OFF);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetTAR(addr);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_WriteAP(AP_DRW, data);
+  }
+  return (ack);
+}
+
+
+// Read block of target memory words
+//   addr:   target address (word aligned)
+//   data:   pointer to read data
+//   count:  number of words
+//   return: ACK[2:0]
+uint8_t MEM_ReadBlock (uint32_t addr, uint32_t *data, uint32_t count) {
+  uint32_t n;
+  uint8_t  ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_WORD, CSW_ADDRINC_SINGLE);
+  }
+
+  while ((count != 0U) && (ack == DAP_TRANSFER_OK)) {
+    // Split at auto-increment boundaries
+    n = (TAR_INC_BLOCK - (addr & (TAR_INC_BLOCK - 1U))) / 4U;
+    if (n > count) {
+      n = count;
+    }
+    ack = MEM_SetTAR(addr);
+    if (ack != DAP_TRANSFER_OK) {
+      break;
+    }
+    MEM.tar_valid = 0U;                 // TAR is incremented by the reads
+    addr  += n * 4U;
+    count -= n;
+    // Post first read, then every read returns the previous data
+    ack = MEM_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | AP_DRW, NULL);
+    while ((--n != 0U) && (ack == DAP_TRANSFER_OK)) {
+      ack = MEM_Transfer(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | AP_DRW, data++);
+    }
+    if (ack == DAP_TRANSFER_OK) {
+      ack = MEM_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data++);
+    }
+  }
+
+  return (ack);
+}
+
+
+// Write block of target memory words
+//   addr:   target address (word aligned)
+//   data:   pointer to data to write
+//   count:  number of words
+//   return: ACK[2:0]
+uint8_t MEM_WriteBlock (uint32_t addr, const uint32_t *data, uint32_t count) {
+  uint32_t n;
+  uint8_t  ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_WORD, CSW_ADDRINC_SINGLE);
+  }
+
+  while ((count != 0U) && (ack == DAP_TRANSFER_OK)) {
+    // Split at auto-increment boundaries
+    n = (TAR_INC_BLOCK - (addr & (TAR_INC_BLOCK - 1U))) / 4U;
+    if (n > count) {
+      n = count;
+    }
+    ack = MEM_SetTAR(addr);
+    MEM.tar_valid = 0U;                 // TAR is incremented by the writes
+    addr  += n * 4U;
+    count -= n;
+    for (; n && (ack == DAP_TRANSFER_OK); n--) {
+      ack = MEM_WriteAP(AP_DRW, *data++);
+    }
+  }
+
+  return (ack);
+}
+
+
+// Write block of target memory bytes
+//   addr:   target address
+//   data:   pointer to data to write
+//   count:  number of bytes
+//   return: ACK[2:0]
+uint8_t MEM_WriteBytes (uint32_t addr, const uint8_t *data, uint32_t count) {
+  uint32_t n;
+  uint8_t  ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_BYTE, CSW_ADDRINC_SINGLE);
+  }
+
+  while ((count != 0U) && (ack == DAP_TRANSFER_OK)) {
+    // Split at auto-increment boundaries
+    n = TAR_INC_BLOCK - (addr & (TAR_INC_BLOCK - 1U));
+    if (n > count) {
+      n = count;
+    }
+    ack = MEM_SetTAR(addr);
+    MEM.tar_valid = 0U;                 // TAR is incremented by the writes
+    count -= n;
+    for (; n && (ack == DAP_TRANSFER_OK); n--) {
+      // Byte is driven on the byte lane selected by the address
+      ack = MEM_WriteAP(AP_DRW, (uint32_t)(*data++) << ((addr & 3U) * 8U));
+      addr++;
+    }
+  }
+
+  return (ack);
+}
+
+
+// Write TAR and read it back (link test without memory access)
+//   addr:   value written to TAR
+//   return: ACK[2:0], DAP_TRANSFER_ERROR when the read value differs
+uint8_t MEM_CheckTAR (uint32_t addr) {
+  uint32_t data;
+  uint8_t  ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    MEM.tar_valid   = 0U;
+    MEM.tar_written = 1U;
+    ack = MEM_WriteAP(AP_TAR, addr);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_ReadAP(AP_TAR, &data);
+  }
+  if ((ack == DAP_TRANSFER_OK) && (data != addr)) {
+    ack = DAP_TRANSFER_ERROR;
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    MEM.cur_tar   = addr;
+    MEM.tar_valid = 1U;
+  }
+  return (ack);
+}
+
+
+// Map the banked data registers (BD0..BD3) to a 16-byte block of target memory
+//   addr:   target address (16-byte aligned)
+//   return: ACK[2:0]
+uint8_t MEM_SetBanked (uint32_t addr) {
+  uint8_t ack;
+
+  ack = MEM_SelectBank(AP_BANK_CSW);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetCSW(CSW_SIZE_WORD, CSW_ADDRINC_OFF);
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_SetTAR(addr & ~0x0FU);
+  }
+  return (ack);
+}
+
+
+// Read target memory word through banked data register
+//   addr:   target address within the block set by MEM_SetBanked
+//   data:   pointer to read data
+//   return: ACK[2:0]
+uint8_t MEM_ReadBanked (uint32_t addr, uint32_t *data) {
+  uint8_t ack;
+
+  ack = MEM_SelectBank(AP_BANK_BD);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_ReadAP(addr & 0x0CU, data);
+  }
+  return (ack);
+}
+
+
+// Write target memory word through banked data register
+//   addr:   target address within the block set by MEM_SetBanked
+//   data:   data to write
+//   return: ACK[2:0]
+uint8_t MEM_WriteBanked (uint32_t addr, uint32_t data) {
+  uint8_t ack;
+
+  ack = MEM_SelectBank(AP_BANK_BD);
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_WriteAP(addr & 0x0CU, data);
+  }
+  return (ack);
+}
+
+#endif  /* (DAP_SWD != 0) */
@@ -0,0 +1,244 @@
+// Command macros
+// Sequences of DAP command requests are stored in NVS under a one-byte ID and replayed by a single
+// command, so that repetitive steps (e.g. connect under reset, fixed memory dumps) cost one packet.
+// A macro is stored as a list of [request length (1)][request (length)].
+
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+#include "DAP_config.h"
+#include "DAP.h"
+
+// NVS namespace of macros
+#define MACRO_NAMESPACE         "dap_macro"
+
+// Maximum macro size
+#define MACRO_SIZE              1024U
+
+// Macro Control
+#define MACRO_BEGIN             0U              // Start recording
+#define MACRO_APPEND            1U              // Append requests to recording
+#define MACRO_SAVE              2U              // Store recording in NVS
+#define MACRO_ERASE             3U              // Erase macro from NVS
+#define MACRO_RUN               4U              // Replay macro
+
+// Macro Run Modes
+#define MACRO_CONCAT            0U              // Return concatenated responses
+#define MACRO_SUMMARY           1U              // Return last response only
+
+// No failing request
+#define MACRO_NO_FAILURE        0xFFU
+
+static uint8_t  MacroBuffer[MACRO_SIZE];        // Recorded macro (overwritten by MACRO_RUN)
+static uint16_t MacroLength;                    // Length of recorded macro
+static uint8_t  MacroID;                        // ID of recorded macro
+static uint8_t  MacroRunning;                   // Macro is being replayed (nested Macro commands are rejected)
+
+
+// Get NVS key of macro
+//   key:    key buffer (at least 4 bytes)
+//   id:     macro ID
+static void Macro_Key (char *key, uint32_t id) {
+  snprintf(key, 4, "m%02x", (unsigned int)(id & 0xFFU));
+}
+
+
+// Check if a replayed request failed
+//   response: pointer to response data
+//   return:   1 when the request failed
+static uint32_t Macro_Failed (const uint8_t *response) {
+  switch (*response) {
+    case ID_DAP_Invalid:
+      return (1U);
+    case ID_DAP_Transfer:
+      return (*(response+2) != DAP_TRANSFER_OK);
+    case ID_DAP_TransferBlock:
+      return (*(response+3) != DAP_TRANSFER_OK);
+    case ID_DAP_HostStatus:
+    case ID_DAP_Disconnect:
+    case ID_DAP_Delay:
+    case ID_DAP_SWJ_Clock:
+    case ID_DAP_SWJ_Sequence:
+    case ID_DAP_SWD_Configure:
+    case ID_DAP_SWD_Sequence:
+    case ID_DAP_JTAG_Sequence:
+    case ID_DAP_JTAG_Configure:
+    case ID_DAP_TransferConfigure:
+    case ID_DAP_WriteABORT:
+      return (*(response+1) == DAP_ERROR);
+    case ID_DAP_Connect:
+      return (*(response+1) == DAP_PORT_DISABLED);
+    default:
+      break;
+  }
+  return (0U);
+}
+
+
+// Replay macro
+//   mode:     MACRO_CONCAT or MACRO_SUMMARY
+//   response: pointer to response data (after status)
+//   return:   number of bytes in response
+static uint32_t Macro_Run (uint32_t mode, uint8_t *response) {
+  static uint8_t cmd_request [DAP_PACKET_SIZE];
+  static uint8_t cmd_response[DAP_PACKET_SIZE];
+  uint32_t pos;
+  uint32_t len;
+  uint32_t num;
+  uint32_t index;
+  uint32_t failed;
+  uint32_t space;
+  uint8_t *data;
+
+  data   = response + 2;
+  space  = DAP_PACKET_SIZE - 4U;                // Command ID, status, count, failure index
+  failed = MACRO_NO_FAILURE;
+  index  = 0U;
+  num    = 0U;
+
+  for (pos = 0U; pos < MacroLength; pos += 1U + len) {
+    len = MacroBuffer[pos];
+    if ((len == 0U) || (len > DAP_PACKET_SIZE) || ((pos + 1U + len) > MacroLength) ||
+        (MacroBuffer[pos+1U] == ID_DAP_Macro)) {
+      failed = index;
+      break;
+    }
+    memcpy(cmd_request, &MacroBuffer[pos+1U], len);
+    memset(&cmd_request[len], 0, DAP_PACKET_SIZE - len);
+
+    num = DAP_ExecuteCommand(cmd_request, cmd_response) & 0xFFFFU;
+
+    if (mode == MACRO_CONCAT) {
+      if (num > space) {
+        num = space;
+      }
+      memcpy(data, cmd_response, num);
+      data  += num;
+      space -= num;
+    }
+    index++;
+
+    if (Macro_Failed(cmd_response)) {
+      failed = index - 1U;
+      break;
+    }
+  }
+
+  if ((mode != MACRO_CONCAT) && (index != 0U)) {
+    // Response of the last executed request
+    num = (num > space) ? space : num;
+    memcpy(data, cmd_response, num);
+    data += num;
+  }
+
+  *(response+0) = (uint8_t)index;
+  *(response+1) = (uint8_t)failed;
+  return ((uint32_t)(data - response));
+}
+
+
+// Process Macro command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1)
+//           MACRO_BEGIN:  ID (1)
+//           MACRO_APPEND: length (1), data (length)
+//           MACRO_ERASE:  ID (1)
+//           MACRO_RUN:    ID (1), mode (1)
+// Response: status (1)
+//           MACRO_RUN:    number of executed requests (1), index of failed request (1, 0xFF = none),
+//                         responses (MACRO_CONCAT: all, truncated to packet size; MACRO_SUMMARY: last)
+uint32_t Macro_Process (const uint8_t *request, uint8_t *response) {
+  nvs_handle_t handle;
+  size_t   size;
+  uint32_t num;
+  uint32_t len;
+  char     key[4];
+
+  num = 1U;
+  *response = DAP_OK;
+
+  switch (*request) {
+    case MACRO_BEGIN:
+      if (MacroRunning) {
+        // The buffer holds the macro being replayed
+        *response = DAP_ERROR;
+      } else {
+        MacroID     = *(request+1);
+        MacroLength = 0U;
+      }
+      return ((2U << 16) | 1U);
+
+    case MACRO_APPEND:
+      len = *(request+1);
+      if (MacroRunning || (len > (DAP_PACKET_SIZE - 3U)) || ((MacroLength + len) > MACRO_SIZE)) {
+        *response = DAP_ERROR;
+      } else {
+        memcpy(&MacroBuffer[MacroLength], request+2, len);
+        MacroLength += len;
+      }
+      return (((2U + len) << 16) | 1U);
+
+    case MACRO_SAVE:
+      Macro_Key(key, MacroID);
+      if ((nvs_open(MACRO_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)) {
+        *response = DAP_ERROR;
+        break;
+      }
+      if ((nvs_set_blob(handle, key, MacroBuffer, MacroLength) != ESP_OK) || (nvs_commit(handle) != ESP_OK)) {
+        *response = DAP_ERROR;
+      }
+      nvs_close(handle);
+      break;
+
+    case MACRO_ERASE:
+      num = 2U;
+      Macro_Key(key, *(request+1));
+      if ((nvs_open(MACRO_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)) {
+        *response = DAP_ERROR;
+        break;
+      }
+      if ((nvs_erase_key(handle, key) != ESP_OK) || (nvs_commit(handle) != ESP_OK)) {
+        *response = DAP_ERROR;
+      }
+      nvs_close(handle);
+      break;
+
+    case MACRO_RUN:
+      if (MacroRunning) {
+        // Reached through ExecuteCommands or a Script CMD of the running macro
+        *response = DAP_ERROR;
+        return ((3U << 16) | 1U);
+      }
+      Macro_Key(key, *(request+1));
+      size = sizeof(MacroBuffer);
+      if ((nvs_open(MACRO_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)) {
+        *response = DAP_ERROR;
+        return ((3U << 16) | 1U);
+      }
+      if (nvs_get_blob(handle, key, MacroBuffer, &size) != ESP_OK) {
+        *response = DAP_ERROR;
+        nvs_close(handle);
+        return ((3U << 16) | 1U);
+      }
+      nvs_close(handle);
+      MacroID     = *(request+1);
+      MacroLength = (uint16_t)size;
+      MacroRunning = 1U;
+      len = Macro_Run(*(request+2), response+1);
+      MacroRunning = 0U;
+      if (*(response+2) != MACRO_NO_FAILURE) {
+        *response = DAP_ERROR;
+      }
+      return ((3U << 16) | (1U + len));
+
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  return ((num << 16) | 1U);
+}
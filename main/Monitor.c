@@ -0,0 +1,148 @@
+// Halt/run state monitor
+// Polls DHCSR over SWD between host commands and pushes an event on the stream service
+// whenever S_HALT or S_LOCKUP changes or S_RESET_ST is seen, so that hosts do not need to poll.
+// Note that reading DHCSR clears the sticky S_RESET_ST bit; resets are reported by the event instead.
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "ble_stream.h"
+
+#if (DAP_SWD != 0)
+
+#define MONITOR_DEFAULT_INTERVAL  10U       // Default poll interval in ms
+
+// Monitor Events
+#define MONITOR_EVENT_STATE       0x01U     // DHCSR changed (data: DHCSR)
+#define MONITOR_EVENT_ERROR       0x02U     // DHCSR could not be read (data: ACK)
+
+// Monitor States
+#define MONITOR_UNKNOWN           0U
+#define MONITOR_VALID             1U
+#define MONITOR_ERROR             2U
+
+static uint8_t  MonitorActive = 0U;         // Monitor enabled
+static uint8_t  MonitorState;               // State of last poll
+static uint32_t MonitorInterval;            // Poll interval in timestamp ticks
+static uint32_t MonitorTimestamp;           // Timestamp of last poll
+static uint32_t MonitorDHCSR;               // Last DHCSR value
+
+
+// Send monitor event
+//   event: MONITOR_EVENT_xxx
+//   data:  event data
+static void Monitor_Notify (uint8_t event, uint32_t data) {
+  uint8_t buf[9];
+
+  buf[0] = event;
+  buf[1] = (uint8_t)(data >>  0);
+  buf[2] = (uint8_t)(data >>  8);
+  buf[3] = (uint8_t)(data >> 16);
+  buf[4] = (uint8_t)(data >> 24);
+  buf[5] = (uint8_t)(MonitorTimestamp >>  0);
+  buf[6] = (uint8_t)(MonitorTimestamp >>  8);
+  buf[7] = (uint8_t)(MonitorTimestamp >> 16);
+  buf[8] = (uint8_t)(MonitorTimestamp >> 24);
+
+  ble_stream_notify(BLE_STREAM_EVENT, buf, sizeof(buf));
+}
+
+// Read DHCSR and report changes
+static void Monitor_Check (void) {
+  uint32_t dhcsr;
+  uint8_t  ack;
+
+  ack = MEM_Open(0U);
+  if (ack == DAP_TRANSFER_WAIT) {
+    return;   // SELECT of the host is unknown, try again on the next poll
+  }
+  if (ack == DAP_TRANSFER_OK) {
+    ack = MEM_Read(DHCSR, &dhcsr);
+  }
+  if ((MEM_Close() != DAP_TRANSFER_OK) && (ack == DAP_TRANSFER_OK)) {
+    ack = DAP_TRANSFER_ERROR;
+  }
+
+  if (ack != DAP_TRANSFER_OK) {
+    if (MonitorState != MONITOR_ERROR) {
+      MonitorState = MONITOR_ERROR;
+      Monitor_Notify(MONITOR_EVENT_ERROR, ack);
+    }
+    return;
+  }
+
+  if ((MonitorState != MONITOR_VALID) ||
+      (((dhcsr ^ MonitorDHCSR) & (DHCSR_S_HALT | DHCSR_S_LOCKUP)) != 0U) ||
+      ((dhcsr & DHCSR_S_RESET_ST) != 0U)) {
+    Monitor_Notify(MONITOR_EVENT_STATE, dhcsr);
+  }
+  MonitorState = MONITOR_VALID;
+  MonitorDHCSR = dhcsr;
+}
+
+
+// Process Monitor command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+uint32_t Monitor_Configure (const uint8_t *request, uint8_t *response) {
+  uint32_t interval;
+
+  interval = (uint32_t)(*(request+1) << 0) |
+             (uint32_t)(*(request+2) << 8);
+  if (interval == 0U) {
+    interval = MONITOR_DEFAULT_INTERVAL;
+  }
+
+  if (*request != 0U) {
+    if (DAP_Data.debug_port == DAP_PORT_SWD) {
+      MonitorInterval  = interval * 1000U * TIMESTAMP_TICKS_PER_US;
+      MonitorTimestamp = TIMESTAMP_GET();
+      MonitorState     = MONITOR_UNKNOWN;
+      MonitorActive    = 1U;
+      Monitor_Check();
+      *response = DAP_OK;
+    } else {
+      MonitorActive = 0U;
+      *response = DAP_ERROR;
+    }
+  } else {
+    MonitorActive = 0U;
+    *response = DAP_OK;
+  }
+
+  *(response+1) = (uint8_t)(MonitorDHCSR >>  0);
+  *(response+2) = (uint8_t)(MonitorDHCSR >>  8);
+  *(response+3) = (uint8_t)(MonitorDHCSR >> 16);
+  *(response+4) = (uint8_t)(MonitorDHCSR >> 24);
+
+  return ((3U << 16) | 5U);
+}
+
+
+// Poll target state if the interval has elapsed
+//   return: time in microseconds until the next poll
+uint32_t Monitor_Poll (void) {
+  uint32_t elapsed;
+
+  if (!MonitorActive) {
+    return (DAP_POLL_IDLE);
+  }
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    // Host disconnected
+    MonitorActive = 0U;
+    return (DAP_POLL_IDLE);
+  }
+
+  elapsed = TIMESTAMP_GET() - MonitorTimestamp;
+  if (elapsed < MonitorInterval) {
+    return ((MonitorInterval - elapsed) / TIMESTAMP_TICKS_PER_US);
+  }
+
+  MonitorTimestamp = TIMESTAMP_GET();
+  Monitor_Check();
+
+  return (MonitorInterval / TIMESTAMP_TICKS_PER_US);
+}
+
+#endif  /* (DAP_SWD != 0) */
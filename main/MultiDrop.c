@@ -0,0 +1,117 @@
+// SWD multi-drop target selection
+// Several targets share one SWD bus (ADIv5.2 multi-drop) and are addressed by a TARGETSEL write
+// after a line reset. The selected target is cached so that selecting it again costs nothing. The
+// line reset of a switch invalidates the DP/AP shadow registers (it resets DP state such as
+// DPBANKSEL), so they are not carried over between targets.
+
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// Number of targets with cached state
+#define MULTIDROP_TARGETS       4U
+
+// Target Select Flags
+#define MULTIDROP_FORCE         (1U<<0)         // Always send line reset and TARGETSEL
+
+typedef struct {
+  uint8_t  used;                                // Entry is used
+  uint8_t  padding[3];
+  uint32_t targetsel;                           // TARGETSEL value
+  uint32_t idcode;                              // DPIDR
+} MultiDrop_Target_t;
+
+static MultiDrop_Target_t Targets[MULTIDROP_TARGETS];
+static uint32_t           Victim;               // Next entry to replace
+
+
+// Find cached state of a target
+//   targetsel: TARGETSEL value
+//   return:    entry or NULL
+static MultiDrop_Target_t *MultiDrop_Find (uint32_t targetsel) {
+  uint32_t n;
+
+  for (n = 0U; n < MULTIDROP_TARGETS; n++) {
+    if (Targets[n].used && (Targets[n].targetsel == targetsel)) {
+      return (&Targets[n]);
+    }
+  }
+  return (NULL);
+}
+
+
+// Forget cached state of all targets (new session)
+void MultiDrop_Reset (void) {
+  uint32_t n;
+
+  for (n = 0U; n < MULTIDROP_TARGETS; n++) {
+    Targets[n].used = 0U;
+  }
+  Victim = 0U;
+}
+
+
+// Process Target Select command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  TARGETSEL (4), flags (1, MULTIDROP_FORCE)
+// Response: status (1), switched (1: 0 = target was already selected), DPIDR (4)
+uint32_t MultiDrop_Select (const uint8_t *request, uint8_t *response) {
+  MultiDrop_Target_t *target;
+  uint32_t targetsel;
+  uint32_t idcode;
+  uint32_t switched;
+
+  targetsel = (uint32_t)(*(request+0) <<  0) |
+              (uint32_t)(*(request+1) <<  8) |
+              (uint32_t)(*(request+2) << 16) |
+              (uint32_t)(*(request+3) << 24);
+
+  *response = DAP_ERROR;
+  switched  = 0U;
+  idcode    = 0U;
+
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    goto end;
+  }
+
+  target = MultiDrop_Find(targetsel);
+
+  if (DAP_Data.multidrop.selected && (DAP_Data.multidrop.targetsel == targetsel) &&
+      (target != NULL) && ((*(request+4) & MULTIDROP_FORCE) == 0U)) {
+    // No line reset since the target was selected
+    idcode    = target->idcode;
+    *response = DAP_OK;
+    goto end;
+  }
+
+  // The line reset of SWD_TargetSelect invalidates the shadow registers
+  switched = 1U;
+  if (SWD_TargetSelect(targetsel, &idcode) != DAP_TRANSFER_OK) {
+    goto end;
+  }
+
+  if (target == NULL) {
+    target = &Targets[Victim];
+    Victim = (Victim + 1U) % MULTIDROP_TARGETS;
+  }
+  target->used      = 1U;
+  target->targetsel = targetsel;
+  target->idcode    = idcode;
+  *response = DAP_OK;
+
+end:
+  *(response+1) = (uint8_t)switched;
+  *(response+2) = (uint8_t)(idcode >>  0);
+  *(response+3) = (uint8_t)(idcode >>  8);
+  *(response+4) = (uint8_t)(idcode >> 16);
+  *(response+5) = (uint8_t)(idcode >> 24);
+
+  return ((5U << 16) | 6U);
+}
+
+#endif  /* (DAP_SWD != 0) */
@@ -0,0 +1,286 @@
+// PC sampling profiler
+// Reads the DWT PC Sample Register between host commands (the core keeps running) and notifies
+// batches of samples on the stream service, so that profiling does not need a round trip per sample.
+//
+// Batch format:
+//   sequence (1), number of samples (1), timestamp (4), PC (4) of the first sample
+//   then for each following sample: PC difference (zigzag varint), timestamp difference (varint)
+// Timestamps are Test Domain Timer ticks (TIMESTAMP_CLOCK). PC 0xFFFFFFFF means that no sample was
+// available (e.g. core halted or sleeping).
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "ble_stream.h"
+
+#if (DAP_SWD != 0)
+
+// DWT registers
+#define DWT_PCSR                0xE000101CU     // Program Counter Sample Register
+
+// DEMCR fields
+#define DEMCR_TRCENA            (1U<<24)
+
+// Maximum number of samples taken in one poll
+#define SAMPLE_BURST            32U
+
+// Maximum time a sample waits in a batch (in us)
+#define SAMPLE_LATENCY          20000U
+
+// Maximum length of a batch (header and two maximal varints must fit)
+#define SAMPLE_FRAME_SIZE       244U
+#define SAMPLE_HEADER_SIZE      10U
+#define SAMPLE_ENTRY_MAX        10U
+
+// Longest sample period (in us), period differences are compared as signed timestamp ticks
+#define SAMPLE_PERIOD_MAX       (0x7FFFFFFFU / TIMESTAMP_TICKS_PER_US)
+
+// Sample Control
+#define SAMPLE_STOP             0U
+#define SAMPLE_START            1U
+#define SAMPLE_STATUS           2U
+
+static struct {
+  uint8_t  active;                          // Sampling enabled
+  uint8_t  ap;                              // Index of the MEM-AP
+  uint8_t  trcena;                          // TRCENA was set by the sampler (cleared again on stop)
+  uint8_t  sequence;                        // Sequence number of the next batch
+  uint8_t  count;                           // Number of samples in the batch
+  uint16_t length;                          // Length of the batch
+  uint16_t limit;                           // Maximum length of the batch
+  uint32_t period;                          // Sample period in timestamp ticks
+  uint32_t next;                            // Timestamp when the next sample is due
+  uint32_t start;                           // Timestamp of the first sample in the batch
+  uint32_t pc;                              // Last PC in the batch
+  uint32_t time;                            // Last timestamp in the batch
+  uint32_t samples;                         // Number of sent samples
+  uint32_t dropped;                         // Number of samples which could not be sent
+  uint8_t  frame[SAMPLE_FRAME_SIZE];        // Batch
+} Sample;
+
+
+// Append unsigned varint (7 bits per byte, LSB first) to the batch
+//   value:  value to append
+static void Sample_PutVarint (uint32_t value) {
+  while (value >= 0x80U) {
+    Sample.frame[Sample.length++] = (uint8_t)(value | 0x80U);
+    value >>= 7;
+  }
+  Sample.frame[Sample.length++] = (uint8_t)value;
+}
+
+
+// Send the batch
+static void Sample_Flush (void) {
+  if (Sample.count == 0U) {
+    return;
+  }
+
+  Sample.frame[0] = Sample.sequence++;
+  Sample.frame[1] = Sample.count;
+  if (ble_stream_notify(BLE_STREAM_SAMPLE, Sample.frame, Sample.length) == 0) {
+    Sample.samples += Sample.count;
+  } else {
+    Sample.dropped += Sample.count;
+  }
+
+  Sample.count  = 0U;
+  Sample.length = 0U;
+}
+
+
+// Add sample to the batch
+//   pc:     sampled PC
+//   time:   timestamp of the sample
+static void Sample_Add (uint32_t pc, uint32_t time) {
+  int32_t diff;
+
+  if ((Sample.count == 255U) || ((Sample.length + SAMPLE_ENTRY_MAX) > Sample.limit)) {
+    Sample_Flush();
+  }
+
+  if (Sample.count == 0U) {
+    Sample.limit = ble_stream_payload_size();
+    if (Sample.limit > SAMPLE_FRAME_SIZE) {
+      Sample.limit = SAMPLE_FRAME_SIZE;
+    }
+    Sample.frame[2] = (uint8_t)(time >>  0);
+    Sample.frame[3] = (uint8_t)(time >>  8);
+    Sample.frame[4] = (uint8_t)(time >> 16);
+    Sample.frame[5] = (uint8_t)(time >> 24);
+    Sample.frame[6] = (uint8_t)(pc >>  0);
+    Sample.frame[7] = (uint8_t)(pc >>  8);
+    Sample.frame[8] = (uint8_t)(pc >> 16);
+    Sample.frame[9] = (uint8_t)(pc >> 24);
+    Sample.length = SAMPLE_HEADER_SIZE;
+    Sample.start  = time;
+  } else {
+    diff = (int32_t)(pc - Sample.pc);
+    Sample_PutVarint(((uint32_t)diff << 1) ^ (uint32_t)(diff >> 31));
+    Sample_PutVarint(time - Sample.time);
+  }
+
+  Sample.pc   = pc;
+  Sample.time = time;
+  Sample.count++;
+}
+
+
+// Process PC Sample command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1), for SAMPLE_START: AP index (1), sample period in us (4, 0 = as fast as possible,
+//           at most SAMPLE_PERIOD_MAX)
+// Response: status (1), sent samples (4), dropped samples (4)
+uint32_t PCSample_Configure (const uint8_t *request, uint8_t *response) {
+  uint32_t num;
+  uint32_t period;
+  uint32_t data;
+  uint8_t  ack;
+
+  num = 1U;
+  *response = DAP_OK;
+
+  switch (*request) {
+    case SAMPLE_STOP:
+      Sample_Flush();
+      Sample.active = 0U;
+      if (Sample.trcena && (DAP_Data.debug_port == DAP_PORT_SWD)) {
+        // Restore DEMCR as it was before sampling
+        ack = MEM_Open(Sample.ap);
+        if (ack == DAP_TRANSFER_OK) {
+          ack = MEM_Read(DEMCR, &data);
+        }
+        if (ack == DAP_TRANSFER_OK) {
+          ack = MEM_Write(DEMCR, data & ~DEMCR_TRCENA);
+        }
+        if ((MEM_Close() != DAP_TRANSFER_OK) || (ack != DAP_TRANSFER_OK)) {
+          *response = DAP_ERROR;
+        }
+      }
+      Sample.trcena = 0U;
+      break;
+
+    case SAMPLE_START:
+      period = (uint32_t)(*(request+2) <<  0) |
+               (uint32_t)(*(request+3) <<  8) |
+               (uint32_t)(*(request+4) << 16) |
+               (uint32_t)(*(request+5) << 24);
+      num = 6U;
+      Sample.active = 0U;
+      if (period > SAMPLE_PERIOD_MAX) {
+        *response = DAP_ERROR;
+        break;
+      }
+
+      // DWT is only accessible when trace is enabled
+      ack = MEM_Open(*(request+1));
+      if (ack == DAP_TRANSFER_OK) {
+        ack = MEM_Read(DEMCR, &data);
+      }
+      if ((ack == DAP_TRANSFER_OK) && ((data & DEMCR_TRCENA) == 0U)) {
+        ack = MEM_Write(DEMCR, data | DEMCR_TRCENA);
+        if (ack == DAP_TRANSFER_OK) {
+          Sample.trcena = 1U;
+          Sample.ap     = *(request+1);
+        }
+      }
+      if (ack == DAP_TRANSFER_OK) {
+        ack = MEM_Read(DWT_PCSR, &data);
+      }
+      if ((MEM_Close() != DAP_TRANSFER_OK) || (ack != DAP_TRANSFER_OK)) {
+        *response = DAP_ERROR;
+        break;
+      }
+
+      Sample.ap       = *(request+1);
+      Sample.period   = period * TIMESTAMP_TICKS_PER_US;
+      Sample.next     = TIMESTAMP_GET();
+      Sample.count    = 0U;
+      Sample.length   = 0U;
+      Sample.samples  = 0U;
+      Sample.dropped  = 0U;
+      Sample.active   = 1U;
+      break;
+
+    case SAMPLE_STATUS:
+      break;
+
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  *(response+1) = (uint8_t)(Sample.samples >>  0);
+  *(response+2) = (uint8_t)(Sample.samples >>  8);
+  *(response+3) = (uint8_t)(Sample.samples >> 16);
+  *(response+4) = (uint8_t)(Sample.samples >> 24);
+  *(response+5) = (uint8_t)(Sample.dropped >>  0);
+  *(response+6) = (uint8_t)(Sample.dropped >>  8);
+  *(response+7) = (uint8_t)(Sample.dropped >> 16);
+  *(response+8) = (uint8_t)(Sample.dropped >> 24);
+
+  return ((num << 16) | 9U);
+}
+
+
+// Take samples which are due
+//   return: time in microseconds until the next sample
+uint32_t PCSample_Poll (void) {
+  uint32_t time;
+  uint32_t pc;
+  uint32_t n;
+
+  if (!Sample.active) {
+    return (DAP_POLL_IDLE);
+  }
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    // Host disconnected
+    Sample_Flush();
+    Sample.active = 0U;
+    return (DAP_POLL_IDLE);
+  }
+
+  time = TIMESTAMP_GET();
+  if ((Sample.count != 0U) && ((time - Sample.start) >= (SAMPLE_LATENCY * TIMESTAMP_TICKS_PER_US))) {
+    Sample_Flush();
+  }
+  if (!ble_stream_is_subscribed(BLE_STREAM_SAMPLE)) {
+    // Nobody listens, do not disturb the target
+    Sample.next = time + Sample.period;
+    return ((Sample.period / TIMESTAMP_TICKS_PER_US) + 1U);
+  }
+  if ((int32_t)(time - Sample.next) < 0) {
+    return (((Sample.next - time) / TIMESTAMP_TICKS_PER_US) + 1U);
+  }
+
+  if (MEM_Open(Sample.ap) == DAP_TRANSFER_OK) {
+    for (n = 0U; n < SAMPLE_BURST; n++) {
+      time = TIMESTAMP_GET();
+      if ((int32_t)(time - Sample.next) < 0) {
+        break;
+      }
+      if (MEM_Read(DWT_PCSR, &pc) != DAP_TRANSFER_OK) {
+        break;
+      }
+      Sample_Add(pc, time);
+      Sample.next += Sample.period;
+    }
+  }
+  MEM_Close();
+
+  // Do not try to catch up when the requested rate cannot be reached
+  time = TIMESTAMP_GET();
+  if ((int32_t)(time - Sample.next) > (int32_t)Sample.period) {
+    Sample.next = time;
+  }
+
+  if ((int32_t)(Sample.next - time) <= 0) {
+    return (0U);
+  }
+  return (((Sample.next - time) / TIMESTAMP_TICKS_PER_US) + 1U);
+}
+
+#endif  /* (DAP_SWD != 0) */
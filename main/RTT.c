@@ -0,0 +1,397 @@
+// SEGGER RTT compatible channel poller
+// Locates the RTT control block in target RAM and moves data of its ring buffers between the target and
+// the RTT characteristic of the stream service between host commands, so that RTT does not use DAP packets.
+// Up data is notified as [channel][data...]. Down data is written by the peer in the same format.
+//
+// RTT control block layout:
+//   char acID[16]            "SEGGER RTT"
+//   int  MaxNumUpBuffers
+//   int  MaxNumDownBuffers
+//   Buffer aUp[MaxNumUpBuffers], aDown[MaxNumDownBuffers]
+// Buffer layout: sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags (4 bytes each)
+
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "ble_stream.h"
+
+#if (DAP_SWD != 0)
+
+#define RTT_DEFAULT_INTERVAL    10U         // Default poll interval in ms
+
+// RTT control block
+#define RTT_CB_ID_WORDS         4U          // acID
+#define RTT_CB_HEADER_WORDS     6U          // acID, MaxNumUpBuffers, MaxNumDownBuffers
+#define RTT_BUFFER_DESC_SIZE    24U         // Size of buffer descriptor
+#define RTT_BUFFER_WROFF        12U         // Offset of WrOff in buffer descriptor
+#define RTT_BUFFER_RDOFF        16U         // Offset of RdOff in buffer descriptor
+
+// "SEGGER RTT\0" as little-endian words
+#define RTT_ID0                 0x47474553U // "SEGG"
+#define RTT_ID1                 0x52205245U // "ER R"
+#define RTT_ID2                 0x00005454U // "TT\0"
+#define RTT_ID2_MASK            0x00FFFFFFU
+
+// Number of channels handled in each direction
+#define RTT_MAX_CHANNELS        8U
+
+// Number of words compared per scan step (overlaps with the next step by the ID length)
+#define RTT_SCAN_WORDS          64U
+
+// Maximum length of data moved in one step
+#define RTT_CHUNK_SIZE          244U
+
+// RTT Control
+#define RTT_STOP                0U
+#define RTT_START               1U
+#define RTT_STATUS              2U
+
+// RTT States
+#define RTT_OFF                 0U          // Not running
+#define RTT_SEARCH              1U          // Searching control block
+#define RTT_FOUND               2U          // Control block found
+
+static struct {
+  uint8_t  state;                           // RTT_xxx
+  uint8_t  ap;                              // Index of the MEM-AP
+  uint8_t  num_up;                          // Number of up buffers
+  uint8_t  num_down;                        // Number of down buffers
+  uint32_t addr;                            // Control block address
+  uint32_t down_desc;                       // Address of first down buffer descriptor
+  uint32_t scan_start;                      // Start address of search range
+  uint32_t scan_end;                        // End address of search range (0: fixed address)
+  uint32_t scan_addr;                       // Current search address
+  uint32_t interval;                        // Poll interval in timestamp ticks
+  uint32_t timestamp;                       // Timestamp of last poll
+  uint32_t up_bytes;                        // Number of bytes sent to the peer
+  uint32_t down_bytes;                      // Number of bytes written to the target
+  uint16_t down_len;                        // Length of pending down message
+  uint16_t down_pos;                        // Position in pending down message
+  uint8_t  down[BLE_STREAM_WRITE_MAX];      // Pending down message
+} RTT;
+
+static uint32_t RTT_Words[RTT_SCAN_WORDS];               // Target memory read buffer (also holds an unaligned chunk)
+static uint8_t  RTT_Frame[RTT_CHUNK_SIZE + 1U];          // Notification data
+
+
+// Check control block at current address
+//   return: 1 when the control block is valid
+static uint32_t RTT_Check (void) {
+  uint32_t header[RTT_CB_HEADER_WORDS];
+
+  if (MEM_ReadBlock(RTT.addr, header, RTT_CB_HEADER_WORDS) != DAP_TRANSFER_OK) {
+    return (0U);
+  }
+  if ((header[0] != RTT_ID0) || (header[1] != RTT_ID1) || ((header[2] & RTT_ID2_MASK) != RTT_ID2) ||
+      (header[4] > 255U) || (header[5] > 255U)) {
+    return (0U);
+  }
+  RTT.down_desc = RTT.addr + (RTT_CB_HEADER_WORDS * 4U) + (header[4] * RTT_BUFFER_DESC_SIZE);
+  RTT.num_up   = (header[4] > RTT_MAX_CHANNELS) ? RTT_MAX_CHANNELS : (uint8_t)header[4];
+  RTT.num_down = (header[5] > RTT_MAX_CHANNELS) ? RTT_MAX_CHANNELS : (uint8_t)header[5];
+  return (1U);
+}
+
+
+// Search control block in next part of the search range
+//   return: 1 when searching should continue immediately
+static uint32_t RTT_Search (void) {
+  uint32_t n, i;
+
+  n = (RTT.scan_end - RTT.scan_addr) / 4U;
+  if (n > RTT_SCAN_WORDS) {
+    n = RTT_SCAN_WORDS;
+  }
+  if ((n < RTT_CB_ID_WORDS) || (MEM_ReadBlock(RTT.scan_addr, RTT_Words, n) != DAP_TRANSFER_OK)) {
+    // Start over after the interval (the target may not have initialized RTT yet)
+    RTT.scan_addr = RTT.scan_start;
+    return (0U);
+  }
+
+  for (i = 0U; i <= (n - RTT_CB_ID_WORDS); i++) {
+    if ((RTT_Words[i] == RTT_ID0) && (RTT_Words[i+1U] == RTT_ID1) &&
+        ((RTT_Words[i+2U] & RTT_ID2_MASK) == RTT_ID2)) {
+      RTT.addr = RTT.scan_addr + (i * 4U);
+      if (RTT_Check()) {
+        RTT.state = RTT_FOUND;
+        return (1U);
+      }
+    }
+  }
+
+  RTT.scan_addr += (n - (RTT_CB_ID_WORDS - 1U)) * 4U;
+  return (1U);
+}
+
+
+// Read buffer descriptor
+//   addr:   address of buffer descriptor
+//   desc:   pBuffer, SizeOfBuffer, WrOff, RdOff
+//   return: 1 when the descriptor is valid
+static uint32_t RTT_ReadDesc (uint32_t addr, uint32_t *desc) {
+  if (MEM_ReadBlock(addr + 4U, desc, 4U) != DAP_TRANSFER_OK) {
+    return (0U);
+  }
+  return ((desc[1] != 0U) && (desc[2] < desc[1]) && (desc[3] < desc[1]));
+}
+
+
+// Move data of an up buffer to the peer
+//   index:  up buffer index
+//   return: number of bytes moved
+static uint32_t RTT_Up (uint32_t index) {
+  uint32_t desc_addr;
+  uint32_t desc[4];
+  uint32_t addr;
+  uint32_t rd;
+  uint32_t n;
+  uint32_t max;
+
+  // Up data is left in the target while nobody listens to the channel
+  if (!ble_stream_is_subscribed(BLE_STREAM_RTT) && !Trace_Routed(TRACE_SOURCE_RTT + index)) {
+    return (0U);
+  }
+
+  max = ble_stream_payload_size();
+  if (max <= 1U) {
+    return (0U);
+  }
+
+  desc_addr = RTT.addr + (RTT_CB_HEADER_WORDS * 4U) + (index * RTT_BUFFER_DESC_SIZE);
+  if (!RTT_ReadDesc(desc_addr, desc) || (desc[2] == desc[3])) {
+    return (0U);
+  }
+
+  // Contiguous data up to WrOff or the end of the buffer
+  rd = desc[3];
+  n  = (desc[2] > rd) ? (desc[2] - rd) : (desc[1] - rd);
+  if (n > RTT_CHUNK_SIZE) {
+    n = RTT_CHUNK_SIZE;
+  }
+  if (n > (max - 1U)) {
+    n = max - 1U;
+  }
+
+  addr = desc[0] + rd;
+  if (MEM_ReadBlock(addr & ~3U, RTT_Words, ((addr & 3U) + n + 3U) / 4U) != DAP_TRANSFER_OK) {
+    return (0U);
+  }
+  RTT_Frame[0] = (uint8_t)index;
+  memcpy(&RTT_Frame[1], (uint8_t *)RTT_Words + (addr & 3U), n);
+  if (Trace_Routed(TRACE_SOURCE_RTT + index)) {
+    // Record of the trace multiplexer (may take only a part without credit)
+    n = Trace_Put(TRACE_SOURCE_RTT + index, &RTT_Frame[1], n, TIMESTAMP_GET());
+    if (n == 0U) {
+      return (0U);
+    }
+  } else if (ble_stream_notify(BLE_STREAM_RTT, RTT_Frame, (uint16_t)(n + 1U)) != 0) {
+    return (0U);  // Keep data in the target until the peer can accept it
+  }
+
+  rd += n;
+  if (rd == desc[1]) {
+    rd = 0U;
+  }
+  MEM_Write(desc_addr + RTT_BUFFER_RDOFF, rd);
+  RTT.up_bytes += n;
+
+  return (n);
+}
+
+
+// Move data written by the peer to a down buffer
+//   return: number of bytes moved
+static uint32_t RTT_Down (void) {
+  uint32_t desc_addr;
+  uint32_t desc[4];
+  uint32_t index;
+  uint32_t wr;
+  uint32_t n;
+
+  if (RTT.down_pos == RTT.down_len) {
+    RTT.down_len = ble_stream_receive(BLE_STREAM_RTT, RTT.down, sizeof(RTT.down));
+    RTT.down_pos = 1U;
+    if (RTT.down_len <= 1U) {
+      RTT.down_len = 0U;
+      RTT.down_pos = 0U;
+      return (0U);
+    }
+  }
+
+  index = RTT.down[0];
+  if (index >= RTT.num_down) {
+    RTT.down_pos = RTT.down_len;  // Discard data for nonexistent channel
+    return (0U);
+  }
+
+  desc_addr = RTT.down_desc + (index * RTT_BUFFER_DESC_SIZE);
+  if (!RTT_ReadDesc(desc_addr, desc)) {
+    return (0U);
+  }
+
+  // Contiguous free space (one byte is always left free to distinguish full from empty)
+  wr = desc[2];
+  if (desc[3] > wr) {
+    n = desc[3] - wr - 1U;
+  } else {
+    n = desc[1] - wr - ((desc[3] == 0U) ? 1U : 0U);
+  }
+  if (n > (uint32_t)(RTT.down_len - RTT.down_pos)) {
+    n = RTT.down_len - RTT.down_pos;
+  }
+  if (n == 0U) {
+    return (0U);
+  }
+
+  if (MEM_WriteBytes(desc[0] + wr, &RTT.down[RTT.down_pos], n) != DAP_TRANSFER_OK) {
+    return (0U);
+  }
+  wr += n;
+  if (wr == desc[1]) {
+    wr = 0U;
+  }
+  if (MEM_Write(desc_addr + RTT_BUFFER_WROFF, wr) != DAP_TRANSFER_OK) {
+    return (0U);
+  }
+  RTT.down_pos   += n;
+  RTT.down_bytes += n;
+
+  return (n);
+}
+
+
+// Process RTT command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1), for RTT_START: AP index (1), address (4), search range in bytes (4, 0 = fixed address),
+//           poll interval in ms (2, 0 = default)
+// Response: status (1), state (1), control block address (4), number of up/down buffers (1 each),
+//           bytes sent to the peer (4), bytes written to the target (4)
+uint32_t RTT_Configure (const uint8_t *request, uint8_t *response) {
+  uint32_t num;
+  uint32_t addr;
+  uint32_t range;
+  uint32_t interval;
+
+  num = 1U;
+  *response = DAP_OK;
+
+  switch (*request) {
+    case RTT_STOP:
+      RTT.state = RTT_OFF;
+      break;
+
+    case RTT_START:
+      addr     = (uint32_t)(*(request+2) <<  0) |
+                 (uint32_t)(*(request+3) <<  8) |
+                 (uint32_t)(*(request+4) << 16) |
+                 (uint32_t)(*(request+5) << 24);
+      range    = (uint32_t)(*(request+6) <<  0) |
+                 (uint32_t)(*(request+7) <<  8) |
+                 (uint32_t)(*(request+8) << 16) |
+                 (uint32_t)(*(request+9) << 24);
+      interval = (uint32_t)(*(request+10) << 0) |
+                 (uint32_t)(*(request+11) << 8);
+      num = 12U;
+      if (interval == 0U) {
+        interval = RTT_DEFAULT_INTERVAL;
+      }
+      if (DAP_Data.debug_port != DAP_PORT_SWD) {
+        RTT.state = RTT_OFF;
+        *response = DAP_ERROR;
+        break;
+      }
+      RTT.ap         = *(request+1);
+      RTT.addr       = addr & ~3U;
+      RTT.scan_start = addr & ~3U;
+      RTT.scan_addr  = addr & ~3U;
+      RTT.scan_end   = (range != 0U) ? ((addr + range) & ~3U) : 0U;
+      RTT.interval   = interval * 1000U * TIMESTAMP_TICKS_PER_US;
+      RTT.timestamp  = TIMESTAMP_GET() - RTT.interval;  // Poll as soon as possible
+      RTT.num_up     = 0U;
+      RTT.num_down   = 0U;
+      RTT.up_bytes   = 0U;
+      RTT.down_bytes = 0U;
+      RTT.down_len   = 0U;
+      RTT.down_pos   = 0U;
+      RTT.state      = (range != 0U) ? RTT_SEARCH : RTT_FOUND;
+      break;
+
+    case RTT_STATUS:
+      break;
+
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  *(response+1)  = RTT.state;
+  *(response+2)  = (uint8_t)(RTT.addr >>  0);
+  *(response+3)  = (uint8_t)(RTT.addr >>  8);
+  *(response+4)  = (uint8_t)(RTT.addr >> 16);
+  *(response+5)  = (uint8_t)(RTT.addr >> 24);
+  *(response+6)  = RTT.num_up;
+  *(response+7)  = RTT.num_down;
+  *(response+8)  = (uint8_t)(RTT.up_bytes >>  0);
+  *(response+9)  = (uint8_t)(RTT.up_bytes >>  8);
+  *(response+10) = (uint8_t)(RTT.up_bytes >> 16);
+  *(response+11) = (uint8_t)(RTT.up_bytes >> 24);
+  *(response+12) = (uint8_t)(RTT.down_bytes >>  0);
+  *(response+13) = (uint8_t)(RTT.down_bytes >>  8);
+  *(response+14) = (uint8_t)(RTT.down_bytes >> 16);
+  *(response+15) = (uint8_t)(RTT.down_bytes >> 24);
+
+  return ((num << 16) | 16U);
+}
+
+
+// Poll RTT buffers if the interval has elapsed
+//   return: time in microseconds until the next poll
+uint32_t RTT_Poll (void) {
+  uint32_t elapsed;
+  uint32_t busy;
+  uint32_t i;
+
+  if (RTT.state == RTT_OFF) {
+    return (DAP_POLL_IDLE);
+  }
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    // Host disconnected
+    RTT.state = RTT_OFF;
+    return (DAP_POLL_IDLE);
+  }
+
+  elapsed = TIMESTAMP_GET() - RTT.timestamp;
+  if (elapsed < RTT.interval) {
+    return ((RTT.interval - elapsed) / TIMESTAMP_TICKS_PER_US);
+  }
+
+  busy = 0U;
+  if (MEM_Open(RTT.ap) == DAP_TRANSFER_OK) {
+    if (RTT.state == RTT_SEARCH) {
+      busy = RTT_Search();
+    } else if (RTT_Check()) {
+      for (i = 0U; i < RTT.num_up; i++) {
+        busy |= RTT_Up(i);
+      }
+      busy |= RTT_Down();
+    } else if (RTT.scan_end != 0U) {
+      // Control block is gone (e.g. target reset), search again
+      RTT.state     = RTT_SEARCH;
+      RTT.scan_addr = RTT.scan_start;
+    }
+  }
+  MEM_Close();
+
+  if (busy) {
+    // More data may be pending, poll again as soon as no command is waiting
+    return (0U);
+  }
+  RTT.timestamp = TIMESTAMP_GET();
+  return (RTT.interval / TIMESTAMP_TICKS_PER_US);
+}
+
+#endif  /* (DAP_SWD != 0) */
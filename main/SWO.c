@@ -25,15 +25,33 @@
  *
  *---------------------------------------------------------------------------*/
 
+#include <string.h>
 #include "DAP_config.h"
 #include "DAP.h"
 #if (SWO_UART != 0)
-#include "Driver_USART.h"
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "hid_dap.h"
+#endif
+#if (SWO_MANCHESTER != 0)
+#include "driver/rmt_rx.h"
+#include "esp_attr.h"
+#include "soc/soc_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "hid_dap.h"
 #endif
 #if (SWO_STREAM != 0)
-#include "cmsis_os2.h"
-#define   osObjectsExternal
-#include "osObjects.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "hid_dap.h"
+#include "ble_stream.h"
 #endif
 
 #if (SWO_STREAM != 0)
@@ -44,23 +62,92 @@
 
 #if (SWO_UART != 0)
 
-// USART Driver
-#define _USART_Driver_(n)  Driver_USART##n
-#define  USART_Driver_(n) _USART_Driver_(n)
-extern ARM_DRIVER_USART    USART_Driver_(SWO_UART_DRIVER);
-#define pUSART           (&USART_Driver_(SWO_UART_DRIVER))
+// ESP-IDF UART Driver
+// The driver interrupt moves data from the RX FIFO into its ring buffer, the SWO UART task moves
+// it from there into the trace buffer in the blocks requested by the trace logic (USART_Receive).
+#define USART_RX_RING_SIZE      4096U   /* Ring buffer size of the UART driver */
+#define USART_RX_THRESHOLD      64U     /* RX FIFO interrupt threshold in bytes */
+#define USART_RX_TIMEOUT        4U      /* RX timeout interrupt after idle line in symbols */
+#define USART_EVENT_QUEUE       16U     /* Number of UART driver events */
+#define USART_POLL_MS           10U     /* Maximum latency of the SWO UART task */
+#define USART_TASK_STACK        3072U   /* Stack size of the SWO UART task */
+
+// USART Events (same meaning as the ARM_USART_EVENT_xxx events of the CMSIS driver)
+#define USART_EVENT_RECEIVE_COMPLETE  (1UL << 0)
+#define USART_EVENT_RX_OVERFLOW       (1UL << 1)
+#define USART_EVENT_RX_ERROR          (1UL << 2)
 
 static uint8_t USART_Ready = 0U;
 
+static QueueHandle_t      USART_Events;     /* UART driver event queue */
+static SemaphoreHandle_t  USART_Lock;       /* Held while the receive state is changed or used */
+static TaskHandle_t       USART_Task;       /* SWO UART task */
+static uint8_t           *USART_RxBuf;      /* Buffer of the active receive (NULL = none) */
+static uint32_t           USART_RxNum;      /* Size of the active receive */
+static volatile uint32_t  USART_RxCount;    /* Bytes received by the active receive */
+static volatile uint8_t   USART_RxEnabled;  /* Receiver enabled */
+
 #endif  /* (SWO_UART != 0) */
 
 
+#if (SWO_MANCHESTER != 0)
+
+// RMT Receiver
+// The RMT channel records the SWO line as pulse durations. A frame (start bit, data bytes) ends
+// when the line is idle for longer than one and a half bit periods; the receive done interrupt
+// hands the frame to the SWO RMT task and restarts reception into the next frame buffer. The task
+// decodes the frame into the trace buffer in the blocks requested by the trace logic.
+#define MANCHESTER_RESOLUTION   40000000U  /* RMT tick rate in Hz */
+#define MANCHESTER_MIN_BAUDRATE 2000U      /* Idle detection must fit the 15-bit RMT duration */
+#define MANCHESTER_MAX_BAUDRATE 1000000U   /* Limited by decoding in software */
+#define MANCHESTER_FILTER_NS    3000U      /* Maximum width of the RMT glitch filter in ns */
+#define MANCHESTER_FRAMES       4U         /* Number of frame buffers */
+#define MANCHESTER_SYMBOLS      512U       /* RMT symbols per frame buffer */
+#define MANCHESTER_TASK_STACK   3072U      /* Stack size of the SWO RMT task */
+
+#if (SOC_RMT_SUPPORT_DMA != 0)
+#define MANCHESTER_DMA          1U
+#define MANCHESTER_MEM_SYMBOLS  MANCHESTER_SYMBOLS
+#else
+#define MANCHESTER_DMA          0U
+#define MANCHESTER_MEM_SYMBOLS  SOC_RMT_MEM_WORDS_PER_CHANNEL
+#endif
+
+typedef struct {
+  uint16_t index;                           /* Frame buffer */
+  uint16_t count;                           /* Number of received symbols */
+} Manchester_Frame_t;
+
+static uint8_t Manchester_Ready = 0U;
+
+static rmt_channel_handle_t Manchester_Channel;
+static rmt_receive_config_t Manchester_Config;  /* Glitch filter and idle detection */
+static rmt_symbol_word_t    Manchester_Symbols[MANCHESTER_FRAMES][MANCHESTER_SYMBOLS];
+static uint32_t             Manchester_Next;    /* Frame buffer of the active reception */
+static uint8_t              Manchester_Armed;   /* Reception started */
+static volatile uint32_t    Manchester_Lost;    /* Frames lost because the task fell behind */
+static volatile uint32_t    Manchester_Baud;    /* Baudrate detected from the last frame (0 = none) */
+
+static QueueHandle_t      Manchester_Frames;    /* Received frames */
+static SemaphoreHandle_t  Manchester_Lock;      /* Held while the receive state is changed or used */
+static TaskHandle_t       Manchester_Task;      /* SWO RMT task */
+static uint8_t           *Manchester_RxBuf;     /* Buffer of the active receive (NULL = none) */
+static uint32_t           Manchester_RxNum;     /* Size of the active receive */
+static volatile uint32_t  Manchester_RxCount;   /* Bytes received by the active receive */
+static volatile uint8_t   Manchester_RxEnabled; /* Receiver enabled */
+
+#endif  /* (SWO_MANCHESTER != 0) */
+
+
 #if ((SWO_UART != 0) || (SWO_MANCHESTER != 0))
 
 
 #define SWO_STREAM_TIMEOUT      50U     /* Stream timeout in ms */
+#define SWO_STREAM_RETRY        5U      /* Delay before retrying a refused notification in ms */
+#define SWO_STREAM_RETRY_TICKS  ((pdMS_TO_TICKS(SWO_STREAM_RETRY) != 0U) ? pdMS_TO_TICKS(SWO_STREAM_RETRY) : 1U) /* At least one tick */
+#define SWO_STREAM_STACK        3072U   /* Stack size of the SWO stream task */
+#define SWO_STREAM_OUT_SIZE     544U    /* ITM filter output (largest notification and a record) */
 
-#define USB_BLOCK_SIZE          512U    /* USB Block Size */
 #define TRACE_BLOCK_SIZE        64U     /* Trace Block Size (2^n: 32...512) */
 
 // Trace State
@@ -71,11 +158,12 @@ static uint8_t  TraceError[2]  = {0U, 0U};  /* Trace Error flags (banked) */
 static uint8_t  TraceError_n   =  0U;       /* Active Trace Error bank */
 
 // Trace Buffer
-static uint8_t  TraceBuf[SWO_BUFFER_SIZE];  /* Trace Buffer (must be 2^n) */
+static uint8_t  TraceBuf[SWO_BUFFER_SIZE] TRACE_BUFFER_ATTR; /* Trace Buffer (must be 2^n) */
 static volatile uint32_t TraceIndexI  = 0U; /* Incoming Trace Index */
 static volatile uint32_t TraceIndexO  = 0U; /* Outgoing Trace Index */
 static volatile uint8_t  TraceUpdate;       /* Trace Update Flag */
 static          uint32_t TraceBlockSize;    /* Current Trace Block Size */
+static volatile uint32_t TraceOverrun;      /* Number of overruns since capture start */
 
 #if (TIMESTAMP_CLOCK != 0U)
 // Trace Timestamp
@@ -83,6 +171,14 @@ static volatile struct {
   uint32_t index;
   uint32_t tick;
 } TraceTimestamp;
+#if (SWO_STREAM != 0)
+// Capture time of the trace data: time of the last completed block of each of TRACE_STAMPS equal
+// parts of the trace buffer (a part is one block for the default buffer size)
+#define TRACE_STAMPS            64U
+#define TRACE_STAMP_SIZE        (((SWO_BUFFER_SIZE / TRACE_STAMPS) > TRACE_BLOCK_SIZE) ? \
+                                 (SWO_BUFFER_SIZE / TRACE_STAMPS) : TRACE_BLOCK_SIZE)
+static uint32_t TraceStampTick[TRACE_STAMPS];
+#endif
 #endif
 
 // Trace Helper functions
@@ -93,84 +189,177 @@ static uint8_t  GetTraceStatus (void);
 static void     SetTraceError  (uint8_t flag);
 
 #if (SWO_STREAM != 0)
-extern osThreadId_t      SWO_ThreadId;
+static TaskHandle_t      SWO_ThreadId;      /* SWO stream task */
+static SemaphoreHandle_t StreamLock;        /* Held by the stream task during a transfer */
+static volatile uint8_t  StreamAbort  = 0U; /* Stop the transfer after the current notification */
+static volatile uint32_t StreamBlockSize = 20U; /* Notification payload size of the connection */
 static volatile uint8_t  TransferBusy = 0U; /* Transfer Busy Flag */
 static          uint32_t TransferSize;      /* Current Transfer Size */
-#endif
+static uint8_t  StreamOut[SWO_STREAM_OUT_SIZE]; /* Output of the ITM filter not sent yet */
+static uint32_t StreamOutCount = 0U;        /* Number of bytes in StreamOut */
+static uint32_t StreamOutTime;              /* Capture time of the data in StreamOut */
 
+static void     SWO_Thread     (void *argument);
+#endif
 
-#if (SWO_UART != 0)
 
-// USART Driver Callback function
-//   event: event mask
-static void USART_Callback (uint32_t event) {
+// Account a captured trace block and find the next one (called by the capture task)
+//   return: size of the next block at TraceIndexI, 0 when the trace buffer is full (capture paused)
+static uint32_t CompleteTraceBlock (void) {
   uint32_t index_i;
   uint32_t index_o;
   uint32_t count;
   uint32_t num;
 
-  if (event &  ARM_USART_EVENT_RECEIVE_COMPLETE) {
 #if (TIMESTAMP_CLOCK != 0U)
-    TraceTimestamp.tick = TIMESTAMP_GET();
+  TraceTimestamp.tick = TIMESTAMP_GET();
 #endif
-    index_o  = TraceIndexO;
-    index_i  = TraceIndexI;
-    index_i += TraceBlockSize;
-    TraceIndexI = index_i;
+  index_o  = TraceIndexO;
+  index_i  = TraceIndexI;
+  index_i += TraceBlockSize;
+  TraceIndexI = index_i;
 #if (TIMESTAMP_CLOCK != 0U)
-    TraceTimestamp.index = index_i;
+  TraceTimestamp.index = index_i;
+#if (SWO_STREAM != 0)
+  TraceStampTick[((index_i - 1U) / TRACE_STAMP_SIZE) & (TRACE_STAMPS - 1U)] = TraceTimestamp.tick;
 #endif
-    num   = TRACE_BLOCK_SIZE - (index_i & (TRACE_BLOCK_SIZE - 1U));
-    count = index_i - index_o;
-    if (count <= (SWO_BUFFER_SIZE - num)) {
-      index_i &= SWO_BUFFER_SIZE - 1U;
-      TraceBlockSize = num;
-      pUSART->Receive(&TraceBuf[index_i], num);
-    } else {
-      TraceStatus = DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_CAPTURE_PAUSED;
-    }
-    TraceUpdate = 1U;
+#endif
+  num   = TRACE_BLOCK_SIZE - (index_i & (TRACE_BLOCK_SIZE - 1U));
+  count = index_i - index_o;
+  if (count <= (SWO_BUFFER_SIZE - num)) {
+    TraceBlockSize = num;
+  } else {
+    TraceStatus = DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_CAPTURE_PAUSED;
+    num = 0U;
+  }
+  TraceUpdate = 1U;
 #if (SWO_STREAM != 0)
-    if (TraceTransport == 2U) {
-      if (count >= (USB_BLOCK_SIZE - (index_o & (USB_BLOCK_SIZE - 1U)))) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
-      }
+  if (TraceTransport == 2U) {
+    if (count >= StreamBlockSize) {
+      xTaskNotifyGive(SWO_ThreadId);
     }
+  }
 #endif
+  return (num);
+}
+
+
+#if (SWO_UART != 0)
+
+// Start receive into the trace buffer (USART_Lock is held)
+//   buf: pointer to buffer for receiving
+//   num: number of bytes to receive
+static void USART_Receive (uint8_t *buf, uint32_t num) {
+  USART_RxCount = 0U;
+  USART_RxNum   = num;
+  USART_RxBuf   = buf;
+}
+
+// Abort active receive and keep the received bytes (USART_Lock is held)
+static void USART_AbortReceive (void) {
+  USART_RxEnabled = 0U;
+  if (USART_RxBuf != NULL) {
+    TraceIndexI += USART_RxCount;
+    USART_RxBuf  = NULL;
+  }
+}
+
+// USART Callback function (called by the SWO UART task with USART_Lock held)
+//   event: event mask
+static void USART_Callback (uint32_t event) {
+  uint32_t num;
+
+  if (event &  USART_EVENT_RECEIVE_COMPLETE) {
+    num = CompleteTraceBlock();
+    if (num != 0U) {
+      USART_Receive(&TraceBuf[TraceIndexI & (SWO_BUFFER_SIZE - 1U)], num);
+    }
   }
-  if (event &  ARM_USART_EVENT_RX_OVERFLOW) {
+  if (event &  USART_EVENT_RX_OVERFLOW) {
+    TraceOverrun++;
     SetTraceError(DAP_SWO_BUFFER_OVERRUN);
   }
-  if (event & (ARM_USART_EVENT_RX_BREAK         |
-               ARM_USART_EVENT_RX_FRAMING_ERROR |
-               ARM_USART_EVENT_RX_PARITY_ERROR)) {
+  if (event &  USART_EVENT_RX_ERROR) {
     SetTraceError(DAP_SWO_STREAM_ERROR);
   }
 }
 
+// SWO UART task: forwards UART driver events and moves received data into the trace buffer
+static void USART_Thread (void *argument) {
+  uart_event_t event;
+  int          len;
+  (void)       argument;
+
+  for (;;) {
+    if (xQueueReceive(USART_Events, &event, pdMS_TO_TICKS(USART_POLL_MS)) == pdTRUE) {
+      xSemaphoreTake(USART_Lock, portMAX_DELAY);
+      switch (event.type) {
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          USART_Callback(USART_EVENT_RX_OVERFLOW);
+          break;
+        case UART_BREAK:
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+          USART_Callback(USART_EVENT_RX_ERROR);
+          break;
+        default:
+          break;
+      }
+      xSemaphoreGive(USART_Lock);
+    }
+
+    xSemaphoreTake(USART_Lock, portMAX_DELAY);
+    while (USART_RxEnabled && (USART_RxBuf != NULL)) {
+      len = uart_read_bytes(SWO_UART_DRIVER, USART_RxBuf + USART_RxCount, USART_RxNum - USART_RxCount, 0);
+      if (len <= 0) {
+        break;
+      }
+      USART_RxCount += (uint32_t)len;
+      if (USART_RxCount == USART_RxNum) {
+        USART_RxBuf = NULL;
+        USART_Callback(USART_EVENT_RECEIVE_COMPLETE);
+      }
+    }
+    xSemaphoreGive(USART_Lock);
+  }
+}
+
 // Enable or disable SWO Mode (UART)
 //   enable: enable flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Mode_UART (uint32_t enable) {
-  int32_t status;
 
   USART_Ready = 0U;
 
   if (enable != 0U) {
-    status = pUSART->Initialize(USART_Callback);
-    if (status != ARM_DRIVER_OK) {
+    if (uart_driver_install(SWO_UART_DRIVER, USART_RX_RING_SIZE, 0, USART_EVENT_QUEUE, &USART_Events, 0) != ESP_OK) {
+      return (0U);
+    }
+    if ((uart_set_pin(SWO_UART_DRIVER, UART_PIN_NO_CHANGE, CONFIG_PIN_SWO,
+                      UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) ||
+        (uart_set_rx_full_threshold(SWO_UART_DRIVER, USART_RX_THRESHOLD) != ESP_OK) ||
+        (uart_set_rx_timeout(SWO_UART_DRIVER, USART_RX_TIMEOUT) != ESP_OK)) {
+      uart_driver_delete(SWO_UART_DRIVER);
       return (0U);
     }
-    status = pUSART->PowerControl(ARM_POWER_FULL);
-    if (status != ARM_DRIVER_OK) {
-      pUSART->Uninitialize();
+    if (USART_Lock == NULL) {
+      USART_Lock = xSemaphoreCreateMutex();
+    }
+    USART_RxEnabled = 0U;
+    USART_RxBuf     = NULL;
+    if (xTaskCreatePinnedToCore(USART_Thread, "swo_uart", USART_TASK_STACK, NULL, CONFIG_STREAM_TASK_PRIORITY,
+                                &USART_Task, TASK_CORE(CONFIG_STREAM_TASK_CORE)) != pdPASS) {
+      uart_driver_delete(SWO_UART_DRIVER);
       return (0U);
     }
   } else {
-    pUSART->Control(ARM_USART_CONTROL_RX, 0U);
-    pUSART->Control(ARM_USART_ABORT_RECEIVE, 0U);
-    pUSART->PowerControl(ARM_POWER_OFF);
-    pUSART->Uninitialize();
+    // Task must not hold the lock while it is deleted
+    xSemaphoreTake(USART_Lock, portMAX_DELAY);
+    USART_AbortReceive();
+    vTaskDelete(USART_Task);
+    xSemaphoreGive(USART_Lock);
+    uart_driver_delete(SWO_UART_DRIVER);
   }
   return (1U);
 }
@@ -179,7 +368,13 @@ __WEAK uint32_t SWO_Mode_UART (uint32_t enable) {
 //   baudrate: requested baudrate
 //   return:   actual baudrate or 0 when not configured
 __WEAK uint32_t SWO_Baudrate_UART (uint32_t baudrate) {
-  int32_t  status;
+  uart_config_t config = {
+    .data_bits  = UART_DATA_8_BITS,
+    .parity     = UART_PARITY_DISABLE,
+    .stop_bits  = UART_STOP_BITS_1,
+    .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
+    .source_clk = UART_SCLK_DEFAULT,
+  };
   uint32_t index;
   uint32_t num;
 
@@ -187,37 +382,36 @@ __WEAK uint32_t SWO_Baudrate_UART (uint32_t baudrate) {
     baudrate = SWO_UART_MAX_BAUDRATE;
   }
 
+  xSemaphoreTake(USART_Lock, portMAX_DELAY);
+
   if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
-    pUSART->Control(ARM_USART_CONTROL_RX, 0U);
-    if (pUSART->GetStatus().rx_busy) {
-      TraceIndexI += pUSART->GetRxCount();
-      pUSART->Control(ARM_USART_ABORT_RECEIVE, 0U);
-    }
+    USART_AbortReceive();
   }
 
-  status = pUSART->Control(ARM_USART_MODE_ASYNCHRONOUS |
-                           ARM_USART_DATA_BITS_8       |
-                           ARM_USART_PARITY_NONE       |
-                           ARM_USART_STOP_BITS_1,
-                           baudrate);
-
-  if (status == ARM_DRIVER_OK) {
+  config.baud_rate = (int)baudrate;
+  if ((uart_param_config(SWO_UART_DRIVER, &config) == ESP_OK) &&
+      (uart_get_baudrate(SWO_UART_DRIVER, &baudrate) == ESP_OK)) {
     USART_Ready = 1U;
   } else {
     USART_Ready = 0U;
+    xSemaphoreGive(USART_Lock);
     return (0U);
   }
 
   if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    // Data received at the old baudrate is garbage
+    uart_flush_input(SWO_UART_DRIVER);
     if ((TraceStatus & DAP_SWO_CAPTURE_PAUSED) == 0U) {
       index = TraceIndexI & (SWO_BUFFER_SIZE - 1U);
       num = TRACE_BLOCK_SIZE - (index & (TRACE_BLOCK_SIZE - 1U));
       TraceBlockSize = num;
-      pUSART->Receive(&TraceBuf[index], num);
+      USART_Receive(&TraceBuf[index], num);
     }
-    pUSART->Control(ARM_USART_CONTROL_RX, 1U);
+    USART_RxEnabled = 1U;
   }
 
+  xSemaphoreGive(USART_Lock);
+
   return (baudrate);
 }
 
@@ -225,28 +419,21 @@ __WEAK uint32_t SWO_Baudrate_UART (uint32_t baudrate) {
 //   active: active flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Control_UART (uint32_t active) {
-  int32_t status;
 
+  xSemaphoreTake(USART_Lock, portMAX_DELAY);
   if (active) {
     if (!USART_Ready) {
+      xSemaphoreGive(USART_Lock);
       return (0U);
     }
+    uart_flush_input(SWO_UART_DRIVER);
     TraceBlockSize = 1U;
-    status = pUSART->Receive(&TraceBuf[0], 1U);
-    if (status != ARM_DRIVER_OK) {
-      return (0U);
-    }
-    status = pUSART->Control(ARM_USART_CONTROL_RX, 1U);
-    if (status != ARM_DRIVER_OK) {
-      return (0U);
-    }
+    USART_Receive(&TraceBuf[0], 1U);
+    USART_RxEnabled = 1U;
   } else {
-    pUSART->Control(ARM_USART_CONTROL_RX, 0U);
-    if (pUSART->GetStatus().rx_busy) {
-      TraceIndexI += pUSART->GetRxCount();
-      pUSART->Control(ARM_USART_ABORT_RECEIVE, 0U);
-    }
+    USART_AbortReceive();
   }
+  xSemaphoreGive(USART_Lock);
   return (1U);
 }
 
@@ -254,8 +441,10 @@ __WEAK uint32_t SWO_Control_UART (uint32_t active) {
 //   buf: pointer to buffer for capturing
 //   num: number of bytes to capture
 __WEAK void SWO_Capture_UART (uint8_t *buf, uint32_t num) {
+  xSemaphoreTake(USART_Lock, portMAX_DELAY);
   TraceBlockSize = num;
-  pUSART->Receive(buf, num);
+  USART_Receive(buf, num);
+  xSemaphoreGive(USART_Lock);
 }
 
 // Get SWO Pending Trace Count (UART)
@@ -263,8 +452,8 @@ __WEAK void SWO_Capture_UART (uint8_t *buf, uint32_t num) {
 __WEAK uint32_t SWO_GetCount_UART (void) {
   uint32_t count;
 
-  if (pUSART->GetStatus().rx_busy) {
-    count = pUSART->GetRxCount();
+  if (USART_RxBuf != NULL) {
+    count = USART_RxCount;
   } else {
     count = 0U;
   }
@@ -276,36 +465,340 @@ __WEAK uint32_t SWO_GetCount_UART (void) {
 
 #if (SWO_MANCHESTER != 0)
 
+// Start receive into the trace buffer (Manchester_Lock is held)
+//   buf: pointer to buffer for receiving
+//   num: number of bytes to receive
+static void Manchester_Receive (uint8_t *buf, uint32_t num) {
+  Manchester_RxCount = 0U;
+  Manchester_RxNum   = num;
+  Manchester_RxBuf   = buf;
+}
+
+// Abort active receive and keep the received bytes (Manchester_Lock is held)
+static void Manchester_AbortReceive (void) {
+  Manchester_RxEnabled = 0U;
+  if (Manchester_RxBuf != NULL) {
+    TraceIndexI += Manchester_RxCount;
+    Manchester_RxBuf = NULL;
+  }
+}
+
+// Store a decoded byte in the trace buffer (Manchester_Lock is held)
+//   data:   decoded byte
+//   return: 1 - stored, 0 - trace buffer full
+static uint32_t Manchester_Put (uint8_t data) {
+  uint32_t num;
+
+  if (Manchester_RxBuf == NULL) {
+    return (0U);
+  }
+  Manchester_RxBuf[Manchester_RxCount++] = data;
+  if (Manchester_RxCount == Manchester_RxNum) {
+    Manchester_RxBuf = NULL;
+    num = CompleteTraceBlock();
+    if (num != 0U) {
+      Manchester_Receive(&TraceBuf[TraceIndexI & (SWO_BUFFER_SIZE - 1U)], num);
+    }
+  }
+  return (1U);
+}
+
+// Decode a frame into the trace buffer (Manchester_Lock is held)
+// A one is sent as high then low, a zero as low then high. A frame starts with a one (start bit)
+// and continues with data bytes, LSB first. The bit period is taken from the frame itself, so the
+// configured baudrate only needs to be close enough for idle detection.
+//   symbols: received symbols (the first level is the high half of the start bit)
+//   count:   number of symbols
+static void Manchester_Decode (const rmt_symbol_word_t *symbols, uint32_t count) {
+  uint32_t half;
+  uint32_t sum;
+  uint32_t halves;
+  uint32_t duration;
+  uint32_t level;
+  uint32_t first;
+  uint32_t phase;
+  uint32_t start;
+  uint32_t data;
+  uint32_t bits;
+  uint32_t last;
+  uint32_t overrun;
+  uint32_t error;
+  uint32_t i, n;
+
+  if ((count == 0U) || (symbols[0].level0 == 0U) || (symbols[0].duration0 == 0U)) {
+    SetTraceError(DAP_SWO_STREAM_ERROR);
+    return;
+  }
+
+  // The high half of the start bit follows the idle (low) line, so it is one half-bit long
+  half    = symbols[0].duration0;
+  sum     = 0U;
+  halves  = 0U;
+  first   = 0U;
+  phase   = 0U;
+  start   = 0U;
+  data    = 0U;
+  bits    = 0U;
+  overrun = 0U;
+  error   = 0U;
+
+  for (i = 0U; (i < (2U * count)) && (error == 0U); i++) {
+    if ((i & 1U) == 0U) {
+      level    = symbols[i >> 1].level0;
+      duration = symbols[i >> 1].duration0;
+    } else {
+      level    = symbols[i >> 1].level1;
+      duration = symbols[i >> 1].duration1;
+    }
+    n    = (duration + (half / 2U)) / half;
+    last = 0U;
+    if ((duration == 0U) || (n > 2U)) {
+      // Idle line: ends the frame and completes a one sent last
+      if (level != 0U) {
+        error = 1U;
+        break;
+      }
+      n    = phase;
+      last = 1U;
+    } else {
+      if (n == 0U) {
+        n = 1U;
+      }
+      sum    += duration;
+      halves += n;
+    }
+    for (; n != 0U; n--) {
+      if (phase == 0U) {
+        first = level;
+        phase = 1U;
+        continue;
+      }
+      phase = 0U;
+      if (first == level) {
+        // No transition in the middle of the bit
+        error = 1U;
+        break;
+      }
+      if (start == 0U) {
+        start = 1U;
+        continue;
+      }
+      data |= first << bits;
+      if (++bits == 8U) {
+        if (Manchester_Put((uint8_t)data) == 0U) {
+          overrun = 1U;
+        }
+        data = 0U;
+        bits = 0U;
+      }
+    }
+    if (last != 0U) {
+      break;
+    }
+  }
+
+  if ((error != 0U) || (bits != 0U)) {
+    SetTraceError(DAP_SWO_STREAM_ERROR);
+  }
+  if (overrun != 0U) {
+    TraceOverrun++;
+    SetTraceError(DAP_SWO_BUFFER_OVERRUN);
+  }
+  if ((error == 0U) && (halves != 0U)) {
+    Manchester_Baud = (uint32_t)(((uint64_t)MANCHESTER_RESOLUTION * halves) / (2U * sum));
+    // Idle detection follows the detected bit period (one and a half bits)
+    Manchester_Config.signal_range_max_ns = (uint32_t)((3ULL * sum * 1000000000ULL) /
+                                                       ((uint64_t)halves * MANCHESTER_RESOLUTION));
+  }
+}
+
+// RMT receive done callback (interrupt): queue the frame and receive into the next frame buffer
+static bool IRAM_ATTR Manchester_Done (rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata,
+                                       void *user_ctx) {
+  Manchester_Frame_t frame;
+  BaseType_t         woken;
+  (void)             user_ctx;
+
+  woken       = pdFALSE;
+  frame.index = (uint16_t)Manchester_Next;
+  frame.count = (uint16_t)edata->num_symbols;
+  // At most MANCHESTER_FRAMES - 2 frames are queued and one is decoded, so the next buffer is free
+  if (xQueueSendFromISR(Manchester_Frames, &frame, &woken) == pdTRUE) {
+    Manchester_Next = (Manchester_Next + 1U) % MANCHESTER_FRAMES;
+  } else {
+    Manchester_Lost++;
+  }
+  rmt_receive(channel, Manchester_Symbols[Manchester_Next], sizeof(Manchester_Symbols[0]), &Manchester_Config);
+  return (woken == pdTRUE);
+}
+
+// SWO RMT task: decodes received frames into the trace buffer
+static void Manchester_Thread (void *argument) {
+  Manchester_Frame_t frame;
+  uint32_t           lost;
+  (void)             argument;
+
+  lost = Manchester_Lost;
+
+  for (;;) {
+    if (xQueueReceive(Manchester_Frames, &frame, portMAX_DELAY) == pdTRUE) {
+      xSemaphoreTake(Manchester_Lock, portMAX_DELAY);
+      if (Manchester_RxEnabled) {
+        if (Manchester_Lost != lost) {
+          TraceOverrun++;
+          SetTraceError(DAP_SWO_BUFFER_OVERRUN);
+        }
+        Manchester_Decode(Manchester_Symbols[frame.index], frame.count);
+      }
+      lost = Manchester_Lost;
+      xSemaphoreGive(Manchester_Lock);
+    }
+  }
+}
+
 // Enable or disable SWO Mode (Manchester)
 //   enable: enable flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Mode_Manchester (uint32_t enable) {
-  return (0U);
+  rmt_rx_channel_config_t config = {
+    .gpio_num          = CONFIG_PIN_SWO,
+    .clk_src           = RMT_CLK_SRC_DEFAULT,
+    .resolution_hz     = MANCHESTER_RESOLUTION,
+    .mem_block_symbols = MANCHESTER_MEM_SYMBOLS,
+    .flags.with_dma    = MANCHESTER_DMA,
+  };
+  rmt_rx_event_callbacks_t callbacks = {
+    .on_recv_done = Manchester_Done,
+  };
+
+  Manchester_Ready = 0U;
+
+  if (enable != 0U) {
+    if (Manchester_Lock == NULL) {
+      Manchester_Lock = xSemaphoreCreateMutex();
+      if (Manchester_Lock == NULL) {
+        return (0U);
+      }
+    }
+    Manchester_Frames = xQueueCreate(MANCHESTER_FRAMES - 2U, sizeof(Manchester_Frame_t));
+    if (Manchester_Frames == NULL) {
+      return (0U);
+    }
+    if (rmt_new_rx_channel(&config, &Manchester_Channel) != ESP_OK) {
+      vQueueDelete(Manchester_Frames);
+      return (0U);
+    }
+    if ((rmt_rx_register_event_callbacks(Manchester_Channel, &callbacks, NULL) != ESP_OK) ||
+        (rmt_enable(Manchester_Channel) != ESP_OK)) {
+      rmt_del_channel(Manchester_Channel);
+      vQueueDelete(Manchester_Frames);
+      return (0U);
+    }
+    Manchester_Armed     = 0U;
+    Manchester_Baud      = 0U;
+    Manchester_RxEnabled = 0U;
+    Manchester_RxBuf     = NULL;
+    if (xTaskCreatePinnedToCore(Manchester_Thread, "swo_rmt", MANCHESTER_TASK_STACK, NULL, CONFIG_STREAM_TASK_PRIORITY,
+                                &Manchester_Task, TASK_CORE(CONFIG_STREAM_TASK_CORE)) != pdPASS) {
+      rmt_disable(Manchester_Channel);
+      rmt_del_channel(Manchester_Channel);
+      vQueueDelete(Manchester_Frames);
+      return (0U);
+    }
+  } else {
+    rmt_disable(Manchester_Channel);
+    // Task must not hold the lock while it is deleted
+    xSemaphoreTake(Manchester_Lock, portMAX_DELAY);
+    Manchester_AbortReceive();
+    vTaskDelete(Manchester_Task);
+    xSemaphoreGive(Manchester_Lock);
+    rmt_del_channel(Manchester_Channel);
+    vQueueDelete(Manchester_Frames);
+    Manchester_Armed = 0U;
+  }
+  return (1U);
 }
 
 // Configure SWO Baudrate (Manchester)
+// Sets the glitch filter and the initial idle detection, the bit period is detected from the data.
 //   baudrate: requested baudrate
 //   return:   actual baudrate or 0 when not configured
 __WEAK uint32_t SWO_Baudrate_Manchester (uint32_t baudrate) {
-  return (0U);
+  uint32_t half_ns;
+
+  if (baudrate > MANCHESTER_MAX_BAUDRATE) {
+    baudrate = MANCHESTER_MAX_BAUDRATE;
+  }
+  if (baudrate < MANCHESTER_MIN_BAUDRATE) {
+    return (0U);
+  }
+
+  xSemaphoreTake(Manchester_Lock, portMAX_DELAY);
+
+  half_ns = 500000000U / baudrate;
+  Manchester_Config.signal_range_min_ns = ((half_ns / 4U) < MANCHESTER_FILTER_NS) ? (half_ns / 4U) :
+                                                                                    MANCHESTER_FILTER_NS;
+  Manchester_Config.signal_range_max_ns = 3U * half_ns;
+  Manchester_Baud = 0U;
+
+  if (Manchester_Armed == 0U) {
+    Manchester_Next = 0U;
+    if (rmt_receive(Manchester_Channel, Manchester_Symbols[0], sizeof(Manchester_Symbols[0]),
+                    &Manchester_Config) == ESP_OK) {
+      Manchester_Armed = 1U;
+    }
+  }
+  Manchester_Ready = Manchester_Armed;
+
+  xSemaphoreGive(Manchester_Lock);
+
+  return ((Manchester_Ready != 0U) ? baudrate : 0U);
 }
 
 // Control SWO Capture (Manchester)
 //   active: active flag
 //   return: 1 - Success, 0 - Error
 __WEAK uint32_t SWO_Control_Manchester (uint32_t active) {
-  return (0U);
+
+  xSemaphoreTake(Manchester_Lock, portMAX_DELAY);
+  if (active) {
+    if (!Manchester_Ready) {
+      xSemaphoreGive(Manchester_Lock);
+      return (0U);
+    }
+    // Frames received before capture start are not trace data of this capture
+    xQueueReset(Manchester_Frames);
+    TraceBlockSize = 1U;
+    Manchester_Receive(&TraceBuf[0], 1U);
+    Manchester_RxEnabled = 1U;
+  } else {
+    Manchester_AbortReceive();
+  }
+  xSemaphoreGive(Manchester_Lock);
+  return (1U);
 }
 
 // Start SWO Capture (Manchester)
 //   buf: pointer to buffer for capturing
 //   num: number of bytes to capture
 __WEAK void SWO_Capture_Manchester (uint8_t *buf, uint32_t num) {
+  xSemaphoreTake(Manchester_Lock, portMAX_DELAY);
+  TraceBlockSize = num;
+  Manchester_Receive(buf, num);
+  xSemaphoreGive(Manchester_Lock);
 }
 
 // Get SWO Pending Trace Count (Manchester)
 //   return: number of pending trace data bytes
 __WEAK uint32_t SWO_GetCount_Manchester (void) {
+  uint32_t count;
+
+  if (Manchester_RxBuf != NULL) {
+    count = Manchester_RxCount;
+  } else {
+    count = 0U;
+  }
+  return (count);
 }
 
 #endif  /* (SWO_MANCHESTER != 0) */
@@ -316,11 +809,14 @@ static void ClearTrace (void) {
 
 #if (SWO_STREAM != 0)
   if (TraceTransport == 2U) {
-    if (TransferBusy != 0U) {
-      SWO_AbortTransfer();
-      TransferBusy = 0U;
-    }
+    // Indexes must not change while the stream task sends data
+    SWO_AbortTransfer();
+    xSemaphoreTake(StreamLock, portMAX_DELAY);
+    StreamAbort  = 0U;
+    TransferBusy = 0U;
   }
+  StreamOutCount = 0U;
+  ITM_Reset();
 #endif
 
   TraceError[0] = 0U;
@@ -328,11 +824,18 @@ static void ClearTrace (void) {
   TraceError_n  = 0U;
   TraceIndexI   = 0U;
   TraceIndexO   = 0U;
+  TraceOverrun  = 0U;
 
 #if (TIMESTAMP_CLOCK != 0U)
   TraceTimestamp.index = 0U;
   TraceTimestamp.tick  = 0U;
 #endif
+
+#if (SWO_STREAM != 0)
+  if (TraceTransport == 2U) {
+    xSemaphoreGive(StreamLock);
+  }
+#endif
 }
 
 // Resume Trace Capture
@@ -431,12 +934,25 @@ uint32_t SWO_Transport (const uint8_t *request, uint8_t *response) {
     switch (transport) {
       case 0U:
       case 1U:
+        TraceTransport = transport;
+        result = 1U;
+        break;
 #if (SWO_STREAM != 0)
       case 2U:
-#endif
-        TraceTransport = transport;
         result = 1U;
+        if (SWO_ThreadId == NULL) {
+          StreamLock = xSemaphoreCreateMutex();
+          if ((StreamLock == NULL) ||
+              (xTaskCreatePinnedToCore(SWO_Thread, "swo_stream", SWO_STREAM_STACK, NULL, CONFIG_STREAM_TASK_PRIORITY,
+                                       &SWO_ThreadId, TASK_CORE(CONFIG_STREAM_TASK_CORE)) != pdPASS)) {
+            result = 0U;
+          }
+        }
+        if (result != 0U) {
+          TraceTransport = transport;
+        }
         break;
+#endif
       default:
         result = 0U;
         break;
@@ -593,7 +1109,7 @@ uint32_t SWO_Control (const uint8_t *request, uint8_t *response) {
       TraceStatus = active;
 #if (SWO_STREAM != 0)
       if (TraceTransport == 2U) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
+        xTaskNotifyGive(SWO_ThreadId);
       }
 #endif
     }
@@ -679,6 +1195,28 @@ uint32_t SWO_ExtendedStatus (const uint8_t *request, uint8_t *response) {
     *response++ = (uint8_t)(tick  >>  8);
     *response++ = (uint8_t)(tick  >> 16);
     *response++ = (uint8_t)(tick  >> 24);
+    num += 8U;
+  }
+#endif
+
+  // Vendor extension: number of overruns since capture start
+  if (cmd & 0x08U) {
+    count = TraceOverrun;
+    *response++ = (uint8_t)(count >>  0);
+    *response++ = (uint8_t)(count >>  8);
+    *response++ = (uint8_t)(count >> 16);
+    *response++ = (uint8_t)(count >> 24);
+    num += 4U;
+  }
+
+#if (SWO_MANCHESTER != 0)
+  // Vendor extension: baudrate detected from the last Manchester frame (0 = none)
+  if (cmd & 0x10U) {
+    count = (TraceMode == DAP_SWO_MANCHESTER) ? Manchester_Baud : 0U;
+    *response++ = (uint8_t)(count >>  0);
+    *response++ = (uint8_t)(count >>  8);
+    *response++ = (uint8_t)(count >> 16);
+    *response++ = (uint8_t)(count >> 24);
     num += 4U;
   }
 #endif
@@ -696,7 +1234,7 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
   uint8_t  status;
   uint32_t count;
   uint32_t index;
-  uint32_t n, i;
+  uint32_t n;
 
   status = GetTraceStatus();
   count  = GetTraceCount();
@@ -719,12 +1257,16 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
   *response++ = (uint8_t)(count >> 8);
 
   if (TraceTransport == 1U) {
-    index = TraceIndexO;
-    for (i = index, n = count; n; n--) {
-      i &= SWO_BUFFER_SIZE - 1U;
-      *response++ = TraceBuf[i++];
+    // At most two block copies (word accesses are much faster than byte accesses in PSRAM)
+    index = TraceIndexO & (SWO_BUFFER_SIZE - 1U);
+    n = SWO_BUFFER_SIZE - index;
+    if (count <= n) {
+      memcpy(response, &TraceBuf[index], count);
+    } else {
+      memcpy(response,     &TraceBuf[index], n);
+      memcpy(&response[n], &TraceBuf[0],     count - n);
     }
-    TraceIndexO = index + count;
+    TraceIndexO += count;
     ResumeTrace();
   }
 
@@ -734,34 +1276,166 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
 
 #if (SWO_STREAM != 0)
 
+// Check if streamed trace data can be sent
+//   return: 1 when the SWO characteristic is subscribed or SWO goes to the trace multiplexer
+static uint32_t StreamReady (void) {
+  return ((ble_stream_is_subscribed(BLE_STREAM_SWO) || Trace_Routed(TRACE_SOURCE_SWO)) ? 1U : 0U);
+}
+
+// Get the capture time of trace data
+//   index:  trace index of the data
+//   return: timestamp of the trace buffer part with the data (current time while the block is captured)
+static uint32_t StreamTime (uint32_t index) {
+#if (TIMESTAMP_CLOCK != 0U)
+  if ((int32_t)(index - TraceIndexI) < 0) {
+    return (TraceStampTick[(index / TRACE_STAMP_SIZE) & (TRACE_STAMPS - 1U)]);
+  }
+#else
+  (void)index;
+#endif
+  return (TIMESTAMP_GET());
+}
+
+// Send streamed trace data in a notification or as a record of the trace multiplexer
+//   buf:    pointer to data
+//   num:    number of bytes (not more than one notification)
+//   time:   capture time of the data
+//   return: number of bytes sent
+static uint32_t StreamSend (const uint8_t *buf, uint32_t num, uint32_t time) {
+  if (Trace_Routed(TRACE_SOURCE_SWO)) {
+    return (Trace_Put(TRACE_SOURCE_SWO, buf, num, time));
+  }
+  if (ble_stream_notify(BLE_STREAM_SWO, buf, (uint16_t)num) != 0) {
+    return (0U);
+  }
+  return (num);
+}
+
+// Send trace data as notifications on the SWO stream characteristic
+// Notifications are queued by the BLE host, so the transfer is complete when this returns.
+//   buf: pointer to buffer with data
+//   num: number of bytes to transfer
+void SWO_QueueTransfer (uint8_t *buf, uint32_t num) {
+  uint32_t size;
+  uint32_t sent;
+  uint32_t n, m;
+
+  size = StreamBlockSize;
+  for (sent = 0U; (sent < num) && (StreamAbort == 0U); sent += m) {
+    n = num - sent;
+    if (n > size) {
+      n = size;
+    }
+    m = StreamSend(&buf[sent], n, StreamTime(TraceIndexO + sent));
+    if (m != n) {
+      // Out of buffers, credit or unsubscribed: the rest stays in the trace buffer
+      sent += m;
+      break;
+    }
+  }
+  TransferSize = sent;
+  SWO_TransferComplete();
+}
+
+// Stop a transfer after the notification in progress
+void SWO_AbortTransfer (void) {
+  StreamAbort = 1U;
+}
+
 // SWO Data Transfer complete callback
 void SWO_TransferComplete (void) {
   TraceIndexO += TransferSize;
   TransferBusy = 0U;
   ResumeTrace();
-  osThreadFlagsSet(SWO_ThreadId, 1U);
+  if (TransferSize != 0U) {
+    xTaskNotifyGive(SWO_ThreadId);
+  }
 }
 
-// SWO Thread
-__NO_RETURN void SWO_Thread (void *argument) {
-  uint32_t timeout;
-  uint32_t flags;
+// Send the trace data selected by the ITM filter (StreamLock is held)
+//   size:   notification payload size
+//   flush:  also send a notification which is not full
+//   return: 1 - done, 0 - notification refused (retry later)
+static uint32_t StreamFiltered (uint32_t size, uint32_t flush) {
   uint32_t count;
   uint32_t index;
-  uint32_t i, n;
-  (void)   argument;
+  uint32_t used;
+  uint32_t n;
+
+  for (;;) {
+    // Filter trace data until a notification is full
+    while ((StreamOutCount < size) && (ITM_Active() != 0U)) {
+      count = GetTraceCount();
+      if (count == 0U) {
+        break;
+      }
+      index = TraceIndexO & (SWO_BUFFER_SIZE - 1U);
+      n = SWO_BUFFER_SIZE - index;
+      if (count > n) {
+        count = n;
+      }
+      if (StreamOutCount == 0U) {
+        StreamOutTime = StreamTime(TraceIndexO);
+      }
+      used = ITM_Filter(&TraceBuf[index], count, &StreamOut[StreamOutCount],
+                        SWO_STREAM_OUT_SIZE - StreamOutCount, &n);
+      StreamOutCount += n;
+      TraceIndexO    += used;
+      ResumeTrace();
+    }
 
-  timeout = osWaitForever;
+    n = (StreamOutCount < size) ? StreamOutCount : size;
+    if ((n == 0U) || ((n < size) && (flush == 0U)) || (StreamAbort != 0U)) {
+      return (1U);
+    }
+    used = StreamSend(StreamOut, n, StreamOutTime);
+    StreamOutCount -= used;
+    memmove(StreamOut, &StreamOut[used], StreamOutCount);
+    if (used != n) {
+      return (0U);
+    }
+  }
+}
+
+// SWO Thread
+// Sends the trace buffer without SWO_Data requests: full notifications as soon as the data is
+// captured, the rest after SWO_STREAM_TIMEOUT or when capture stops.
+static void SWO_Thread (void *argument) {
+  TickType_t timeout;
+  uint32_t   flags;
+  uint32_t   count;
+  uint32_t   index;
+  uint32_t   size;
+  uint32_t   n;
+  (void)     argument;
+
+  timeout = portMAX_DELAY;
 
   for (;;) {
-    flags = osThreadFlagsWait(1U, osFlagsWaitAny, timeout);
+    flags = ulTaskNotifyTake(pdTRUE, timeout);
     if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
-      timeout = SWO_STREAM_TIMEOUT;
+      timeout = pdMS_TO_TICKS(SWO_STREAM_TIMEOUT);
     } else {
-      timeout = osWaitForever;
-      flags   = osFlagsErrorTimeout;
+      timeout = portMAX_DELAY;
+      flags   = 0U;
+    }
+    if (StreamReady() == 0U) {
+      // Trace data is kept (and capture paused when full) until the host subscribes
+      continue;
     }
-    if (TransferBusy == 0U) {
+    size = ble_stream_payload_size();
+    if (size == 0U) {
+      continue;
+    }
+    StreamBlockSize = size;
+
+    xSemaphoreTake(StreamLock, portMAX_DELAY);
+    if ((TransferBusy == 0U) && (TraceTransport == 2U) &&
+        ((StreamOutCount != 0U) || (ITM_Active() != 0U))) {
+      if (StreamFiltered(size, (flags == 0U) ? 1U : 0U) == 0U) {
+        timeout = SWO_STREAM_RETRY_TICKS;
+      }
+    } else if ((TransferBusy == 0U) && (TraceTransport == 2U)) {
       count = GetTraceCount();
       if (count != 0U) {
         index = TraceIndexO & (SWO_BUFFER_SIZE - 1U);
@@ -769,26 +1443,21 @@ __NO_RETURN void SWO_Thread (void *argument) {
         if (count > n) {
           count = n;
         }
-        if (flags != osFlagsErrorTimeout) {
-          i = index & (USB_BLOCK_SIZE - 1U);
-          if (i == 0U) {
-            count &= ~(USB_BLOCK_SIZE - 1U);
-          } else {
-            n = USB_BLOCK_SIZE - i;
-            if (count >= n) {
-              count = n;
-            } else {
-              count = 0U;
-            }
-          }
+        if (flags != 0U) {
+          // Woken by new data: only full notifications
+          count -= count % size;
         }
         if (count != 0U) {
           TransferSize = count;
           TransferBusy = 1U;
           SWO_QueueTransfer(&TraceBuf[index], count);
+          if (TransferSize != count) {
+            timeout = SWO_STREAM_RETRY_TICKS;
+          }
         }
       }
     }
+    xSemaphoreGive(StreamLock);
   }
 }
 
@@ -57,6 +57,12 @@
 #define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
 
 
+// Adaptive WAIT handling
+#define WAIT_IDLE_MAX           64U     // Maximum learned idle cycles after AP accesses
+#define WAIT_IDLE_DECAY         64U     // AP transfers without WAIT before one idle cycle is removed
+#define WAIT_BACKOFF_SHIFT      6U      // Maximum backoff between WAIT retries (1 << n us)
+
+
 // Generate SWJ Sequence
 //   count:  sequence bit count
 //   data:   pointer to sequence bit data
@@ -66,6 +72,11 @@ void SWJ_Sequence (uint32_t count, const uint8_t *data) {
   uint32_t val;
   uint32_t n;
 
+#if (DAP_SWD != 0)
+  DAP_Data.shadow.valid = 0U;           // Line reset or protocol switch
+  DAP_Data.multidrop.selected = 0U;
+#endif
+
   val = 0U;
   n = 0U;
   while (count--) {
@@ -97,6 +108,9 @@ void SWD_Sequence (uint32_t info, const uint8_t *swdo, uint8_t *swdi) {
   uint32_t bit;
   uint32_t n, k;
 
+  DAP_Data.shadow.valid = 0U;           // Line reset or protocol switch
+  DAP_Data.multidrop.selected = 0U;
+
   n = info & SWD_SEQUENCE_CLK;
   if (n == 0U) {
     n = 64U;
@@ -218,7 +232,7 @@ static uint8_t SWD_Transfer##speed (uint32_t request, uint32_t *data) {
       DAP_Data.timestamp = TIMESTAMP_GET();                                     \
     }                                                                           \
     /* Idle cycles */                                                           \
-    n = DAP_Data.transfer.idle_cycles;                                          \
+    n = DAP_Data.transfer.idle_cycles + DAP_Data.wait.extra;                    \
     if (n) {                                                                    \
       PIN_SWDIO_OUT(0U);                                                        \
       for (; n; n--) {                                                          \
@@ -270,16 +284,247 @@ SWD_TransferFunction(Fast)
 SWD_TransferFunction(Slow)
 
 
+// Check if a write would not change a shadowed register
+//   reg:    A[3:2] RnW APnDP
+//   data:   DATA[31:0]
+//   return: 1 when the write can be elided
+static uint32_t SWD_ShadowHit (uint32_t reg, uint32_t data) {
+  uint32_t valid = DAP_Data.shadow.valid;
+
+  if (reg == DP_SELECT) {
+    if ((valid & DAP_SHADOW_SELECT) && (DAP_Data.shadow.select == data)) {
+      DAP_Stats.elided_select++;
+      return (1U);
+    }
+    return (0U);
+  }
+  // CSW and TAR shadows are only valid while SELECT is known, bank 0 holds CSW and TAR
+  if ((valid & DAP_SHADOW_SELECT) && ((DAP_Data.shadow.select & DP_SELECT_APBANKSEL) == 0U)) {
+    if ((reg == (DAP_TRANSFER_APnDP | AP_CSW)) && (valid & DAP_SHADOW_CSW) && (DAP_Data.shadow.csw == data)) {
+      DAP_Stats.elided_csw++;
+      return (1U);
+    }
+    if ((reg == (DAP_TRANSFER_APnDP | AP_TAR)) && (valid & DAP_SHADOW_TAR) && (DAP_Data.shadow.tar == data)) {
+      DAP_Stats.elided_tar++;
+      return (1U);
+    }
+  }
+  return (0U);
+}
+
+// Update shadowed registers after a transfer
+//   reg:    A[3:2] RnW APnDP
+//   data:   DATA[31:0]
+//   ack:    ACK[2:0]
+static void SWD_ShadowUpdate (uint32_t reg, const uint32_t *data, uint8_t ack) {
+  if (ack != DAP_TRANSFER_OK) {
+    if (ack == DAP_TRANSFER_FAULT) {
+      // SELECT is not changed by a failed access, the AP may have been
+      DAP_Data.shadow.valid &= ~(DAP_SHADOW_CSW | DAP_SHADOW_TAR);
+    } else if (ack != DAP_TRANSFER_WAIT) {
+      // No response or protocol error: state of the target is unknown
+      DAP_Data.shadow.valid = 0U;
+    }
+    return;
+  }
+
+  if (reg == DP_SELECT) {
+    if (((DAP_Data.shadow.valid & DAP_SHADOW_SELECT) == 0U) ||
+        ((DAP_Data.shadow.select ^ *data) & DP_SELECT_APSEL)) {
+      // Another AP is selected
+      DAP_Data.shadow.valid &= ~(DAP_SHADOW_CSW | DAP_SHADOW_TAR);
+    }
+    DAP_Data.shadow.select = *data;
+    DAP_Data.shadow.valid |= DAP_SHADOW_SELECT;
+    return;
+  }
+  if (reg == DP_ABORT) {
+    // ABORT does not change SELECT, an aborted AP transfer may leave CSW and TAR changed
+    DAP_Data.shadow.valid &= ~(DAP_SHADOW_CSW | DAP_SHADOW_TAR);
+    return;
+  }
+  if (reg == DP_CTRL_STAT) {
+    // Debug power requests may change, AP registers can be reset
+    DAP_Data.shadow.valid &= ~(DAP_SHADOW_CSW | DAP_SHADOW_TAR);
+    return;
+  }
+  if ((reg & DAP_TRANSFER_APnDP) == 0U) {
+    return;
+  }
+
+  if (((DAP_Data.shadow.valid & DAP_SHADOW_SELECT) == 0U) ||
+      ((DAP_Data.shadow.select & DP_SELECT_APBANKSEL) != 0U)) {
+    return;   // Not CSW, TAR or DRW (CSW and TAR shadows are invalid while SELECT is unknown)
+  }
+  switch (reg & ~DAP_TRANSFER_RnW) {
+    case (DAP_TRANSFER_APnDP | AP_CSW):
+      if ((reg & DAP_TRANSFER_RnW) == 0U) {
+        DAP_Data.shadow.csw = *data;
+        DAP_Data.shadow.valid |= DAP_SHADOW_CSW;
+      }
+      break;
+    case (DAP_TRANSFER_APnDP | AP_TAR):
+      if ((reg & DAP_TRANSFER_RnW) == 0U) {
+        DAP_Data.shadow.tar = *data;
+        DAP_Data.shadow.valid |= DAP_SHADOW_TAR;
+      }
+      break;
+    case (DAP_TRANSFER_APnDP | AP_DRW):
+      // TAR is incremented unless CSW is known to disable auto-increment
+      if (((DAP_Data.shadow.valid & DAP_SHADOW_CSW) == 0U) ||
+          ((DAP_Data.shadow.csw & AP_CSW_ADDRINC) != 0U)) {
+        DAP_Data.shadow.valid &= ~DAP_SHADOW_TAR;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Get index of the selected AP for learned idle cycles
+//   return: AP index or DAP_WAIT_AP_COUNT when unknown
+static uint32_t SWD_WaitAP (void) {
+  uint32_t ap;
+
+  if ((DAP_Data.shadow.valid & DAP_SHADOW_SELECT) == 0U) {
+    return (DAP_WAIT_AP_COUNT);
+  }
+  ap = DAP_Data.shadow.select >> 24;
+  return ((ap < DAP_WAIT_AP_COUNT) ? ap : DAP_WAIT_AP_COUNT);
+}
+
+// Adapt WAIT handling to the response of a transfer
+//   reg:    A[3:2] RnW APnDP
+//   ap:     AP index (SWD_WaitAP)
+//   ack:    ACK[2:0]
+static void SWD_WaitUpdate (uint32_t reg, uint32_t ap, uint8_t ack) {
+  uint32_t idle;
+  uint32_t delay;
+
+  if (ack != DAP_TRANSFER_WAIT) {
+    DAP_Data.wait.streak = 0U;
+    if ((ack == DAP_TRANSFER_OK) && (reg & DAP_TRANSFER_APnDP) &&
+        (ap < DAP_WAIT_AP_COUNT) && (DAP_Data.wait.idle[ap] != 0U)) {
+      // Try fewer idle cycles after a run without WAIT responses
+      if (++DAP_Data.wait.calm >= WAIT_IDLE_DECAY) {
+        DAP_Data.wait.calm = 0U;
+        DAP_Data.wait.idle[ap]--;
+        DAP_Stats.wait_idle = DAP_Data.wait.idle[ap];
+      }
+    }
+    return;
+  }
+
+  DAP_Stats.waits++;
+  if (DAP_Data.wait.streak != 255U) {
+    DAP_Data.wait.streak++;
+  }
+  if (DAP_Data.wait.streak > DAP_Stats.wait_streak_max) {
+    DAP_Stats.wait_streak_max = DAP_Data.wait.streak;
+  }
+
+  // The AP access is still in progress: give the AP more idle cycles after each access
+  if (ap < DAP_WAIT_AP_COUNT) {
+    idle = (DAP_Data.wait.idle[ap] * 2U) + 1U;
+    if (idle > WAIT_IDLE_MAX) {
+      idle = WAIT_IDLE_MAX;
+    }
+    DAP_Data.wait.idle[ap] = (uint8_t)idle;
+    DAP_Data.wait.calm     = 0U;
+    DAP_Stats.wait_idle    = idle;
+  }
+
+  // First retry is immediate, then back off 1, 2, 4, ... us between retries
+  if (DAP_Data.wait.streak > 1U) {
+    delay = DAP_Data.wait.streak - 2U;
+    delay = (delay < WAIT_BACKOFF_SHIFT) ? (1U << delay) : (1U << WAIT_BACKOFF_SHIFT);
+    delay *= ((CPU_CLOCK/1000000U) + (DELAY_SLOW_CYCLES-1U)) / DELAY_SLOW_CYCLES;
+    PIN_DELAY_SLOW(delay);
+  }
+}
+
 // SWD Transfer I/O
 //   request: A[3:2] RnW APnDP
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  SWD_Transfer(uint32_t request, uint32_t *data) {
+  uint32_t reg;
+  uint32_t ap;
+  uint8_t  ack;
+
+  reg = request & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+
+  // Writes of SELECT, CSW and TAR which would not change anything are not sent
+  if (((reg & DAP_TRANSFER_RnW) == 0U) && SWD_ShadowHit(reg, *data)) {
+    if (request & DAP_TRANSFER_TIMESTAMP) {
+      DAP_Data.timestamp = TIMESTAMP_GET();
+    }
+    return (DAP_TRANSFER_OK);
+  }
+
+  // AP accesses are followed by the idle cycles learned for the AP
+  ap = SWD_WaitAP();
+  DAP_Data.wait.extra = ((reg & DAP_TRANSFER_APnDP) && (ap < DAP_WAIT_AP_COUNT)) ? DAP_Data.wait.idle[ap] : 0U;
+
   if (DAP_Data.fast_clock) {
-    return SWD_TransferFast(request, data);
+    ack = SWD_TransferFast(request, data);
   } else {
-    return SWD_TransferSlow(request, data);
+    ack = SWD_TransferSlow(request, data);
+  }
+
+  SWD_WaitUpdate(reg, ap, ack);
+  SWD_ShadowUpdate(reg, data, ack);
+
+  return (ack);
+}
+
+
+// Select target in a SWD multi-drop system (ADIv5.2): line reset, TARGETSEL write, DPIDR read
+//   targetsel: TARGETSEL value
+//   idcode:    DPIDR of the selected target
+//   return:    ACK[2:0] of the DPIDR read
+uint8_t SWD_TargetSelect (uint32_t targetsel, uint32_t *idcode) {
+  static const uint8_t reset[8] = { 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0xFFU, 0x00U };
+  uint32_t val;
+  uint32_t parity;
+  uint32_t n;
+  uint8_t  ack;
+
+  // Line reset (56 cycles high) and 8 idle cycles
+  SWJ_Sequence(64U, reset);
+
+  // Packet request of a DP write to TARGETSEL (A[3:2] = 3)
+  val = 0x99U;                          // Start, APnDP=0, RnW=0, A2=1, A3=1, Parity=0, Stop, Park
+  for (n = 8U; n; n--) {
+    SW_WRITE_BIT(val);
+    val >>= 1;
+  }
+
+  // Turnaround, ACK and turnaround are not driven by any target
+  PIN_SWDIO_OUT_DISABLE();
+  for (n = (2U * DAP_Data.swd_conf.turnaround) + 3U; n; n--) {
+    SW_CLOCK_CYCLE();
+  }
+  PIN_SWDIO_OUT_ENABLE();
+
+  // Write TARGETSEL value
+  val = targetsel;
+  parity = 0U;
+  for (n = 32U; n; n--) {
+    SW_WRITE_BIT(val);
+    parity += val;
+    val >>= 1;
+  }
+  SW_WRITE_BIT(parity);
+  PIN_SWDIO_OUT(1U);
+
+  // Reading DPIDR completes the selection
+  ack = SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, idcode);
+  if (ack == DAP_TRANSFER_OK) {
+    DAP_Data.multidrop.selected  = 1U;
+    DAP_Data.multidrop.targetsel = targetsel;
   }
+  return (ack);
 }
 
 
@@ -0,0 +1,380 @@
+// DAP sequence interpreter
+// Runs a small bytecode program uploaded by the host, so that dependent sequences
+// (connect, unlock, reset, ...) complete on the probe without a BLE round trip per step.
+//
+// The program works on an accumulator (ACC) and a compare flag. Multi-byte operands are little-endian.
+//   END                                   stop (result SCRIPT_OK)
+//   FAIL    code(1)                       stop (result code, host defined codes should be >= 0x10)
+//   XFER    req(1) [data(4)]              DP/AP transfer (A[3:2] RnW APnDP), read data is stored in ACC
+//                                         SCRIPT_XFER_NOFAIL in req continues on failure (ACK in ACK register)
+//   XFER_ACC req(1)                       DP/AP write of ACC
+//   LOAD    value(4)                      ACC = value
+//   AND     value(4)                      ACC &= value
+//   OR      value(4)                      ACC |= value
+//   CMP     mask(4) value(4)              flag = ((ACC & mask) == value)
+//   JMP     target(2)                     jump
+//   JEQ     target(2)                     jump if flag
+//   JNE     target(2)                     jump if not flag
+//   TIMER   time(4)                       start timer (us, at most SCRIPT_TIME_MAX)
+//   JNT     target(2)                     jump if timer has not expired
+//   DELAY   time(4)                       wait (us, at most SCRIPT_TIME_MAX, ends with the run time limit)
+//   PINS    output(1) select(1) wait(4)   same as DAP_SWJ_Pins, pin input is stored in ACC
+//   CMD     length(1) command(length)     execute DAP command, response data after Command ID is stored in ACC
+
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (DAP_SWD != 0)
+
+// Program size
+#define SCRIPT_SIZE             1024U
+
+// Default run time limit (in ms)
+#define SCRIPT_DEFAULT_TIMEOUT  1000U
+
+// Longest TIMER/DELAY time (in us) that fits into timestamp ticks
+#define SCRIPT_TIME_MAX         (0xFFFFFFFFU / TIMESTAMP_TICKS_PER_US)
+
+// Opcodes
+#define SCRIPT_END              0x00U
+#define SCRIPT_FAIL             0x01U
+#define SCRIPT_XFER             0x02U
+#define SCRIPT_XFER_ACC         0x03U
+#define SCRIPT_LOAD             0x04U
+#define SCRIPT_AND              0x05U
+#define SCRIPT_OR               0x06U
+#define SCRIPT_CMP              0x07U
+#define SCRIPT_JMP              0x08U
+#define SCRIPT_JEQ              0x09U
+#define SCRIPT_JNE              0x0AU
+#define SCRIPT_TIMER            0x0BU
+#define SCRIPT_JNT              0x0CU
+#define SCRIPT_DELAY            0x0DU
+#define SCRIPT_PINS             0x0EU
+#define SCRIPT_CMD              0x0FU
+
+// Transfer flags
+#define SCRIPT_XFER_NOFAIL      (1U<<7)
+
+// Results
+#define SCRIPT_OK               0x00U
+#define SCRIPT_ERROR_TRANSFER   0x01U           // Transfer failed (see ACK)
+#define SCRIPT_ERROR_TIMEOUT    0x02U           // Run time limit exceeded
+#define SCRIPT_ERROR_ABORT      0x03U           // Aborted by DAP_TransferAbort
+#define SCRIPT_ERROR_INVALID    0x04U           // Invalid instruction or operand
+
+// Script Control
+#define SCRIPT_LOAD_PROGRAM     0U
+#define SCRIPT_RUN              1U
+
+static uint8_t  ScriptProgram[SCRIPT_SIZE];     // Program
+static uint16_t ScriptLength;                   // Program length
+static uint8_t  ScriptRunning;                  // Program is running (nested Script commands are rejected)
+
+
+// Get little-endian operand
+//   p:      pointer to operand
+//   n:      operand size in bytes
+//   return: operand value
+static uint32_t Script_Get (const uint8_t *p, uint32_t n) {
+  uint32_t value = 0U;
+
+  while (n--) {
+    value = (value << 8) | p[n];
+  }
+  return (value);
+}
+
+
+// Execute DP/AP transfer with retries on WAIT
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+static uint8_t Script_Transfer (uint32_t request, uint32_t *data) {
+  uint32_t retry;
+  uint8_t  ack;
+
+  retry = DAP_Data.transfer.retry_count;
+  do {
+    ack = SWD_Transfer(request, ((request & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW)) ==
+                                 (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW)) ? NULL : data);
+  } while ((ack == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+
+  if ((ack == DAP_TRANSFER_OK) &&
+      ((request & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW)) == (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW))) {
+    // AP read is posted, get data from RDBUFF
+    retry = DAP_Data.transfer.retry_count;
+    do {
+      ack = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+    } while ((ack == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+  }
+
+  return (ack);
+}
+
+
+// Run program
+//   timeout:  run time limit in timestamp ticks
+//   pc:       program counter (in: entry, out: stop position)
+//   acc:      accumulator
+//   ack:      last transfer ACK
+//   return:   SCRIPT_OK, SCRIPT_ERROR_xxx or code of FAIL
+static uint32_t Script_Run (uint32_t timeout, uint32_t *pc, uint32_t *acc, uint8_t *ack) {
+  static uint8_t cmd_response[DAP_PACKET_SIZE];
+  uint8_t  cmd_request[DAP_PACKET_SIZE];
+  const uint8_t *op;
+  uint32_t opcode;
+  uint32_t pos;
+  uint32_t start;
+  uint32_t timer_start;
+  uint32_t timer;
+  uint32_t flag;
+  uint32_t size;
+  uint32_t data;
+  uint32_t num;
+
+  start       = TIMESTAMP_GET();
+  timer_start = start;
+  timer       = 0U;
+  flag        = 0U;
+
+  for (;;) {
+    if (DAP_TransferAbort) {
+      return (SCRIPT_ERROR_ABORT);
+    }
+    if ((TIMESTAMP_GET() - start) > timeout) {
+      return (SCRIPT_ERROR_TIMEOUT);
+    }
+    if (*pc >= ScriptLength) {
+      return (SCRIPT_ERROR_INVALID);
+    }
+
+    // Operand size
+    pos    = *pc;
+    opcode = ScriptProgram[pos];
+    op     = &ScriptProgram[pos + 1U];
+    switch (opcode) {
+      case SCRIPT_END:
+        size = 0U;
+        break;
+      case SCRIPT_FAIL:
+      case SCRIPT_XFER_ACC:
+        size = 1U;
+        break;
+      case SCRIPT_XFER:
+        size = (((pos + 1U) < ScriptLength) && ((*op & DAP_TRANSFER_RnW) == 0U)) ? 5U : 1U;
+        break;
+      case SCRIPT_JMP:
+      case SCRIPT_JEQ:
+      case SCRIPT_JNE:
+      case SCRIPT_JNT:
+        size = 2U;
+        break;
+      case SCRIPT_LOAD:
+      case SCRIPT_AND:
+      case SCRIPT_OR:
+      case SCRIPT_TIMER:
+      case SCRIPT_DELAY:
+        size = 4U;
+        break;
+      case SCRIPT_PINS:
+        size = 6U;
+        break;
+      case SCRIPT_CMP:
+        size = 8U;
+        break;
+      case SCRIPT_CMD:
+        size = ((pos + 1U) < ScriptLength) ? (1U + *op) : 1U;
+        break;
+      default:
+        return (SCRIPT_ERROR_INVALID);
+    }
+    if ((pos + 1U + size) > ScriptLength) {
+      return (SCRIPT_ERROR_INVALID);
+    }
+    *pc = pos + 1U + size;
+
+    switch (opcode) {
+      case SCRIPT_END:
+        *pc = pos;
+        return (SCRIPT_OK);
+
+      case SCRIPT_FAIL:
+        *pc = pos;
+        return (*op);
+
+      case SCRIPT_XFER:
+      case SCRIPT_XFER_ACC:
+        if (opcode == SCRIPT_XFER_ACC) {
+          if ((*op & DAP_TRANSFER_RnW) != 0U) {
+            *pc = pos;
+            return (SCRIPT_ERROR_INVALID);
+          }
+          data = *acc;
+        } else {
+          data = Script_Get(op+1, size-1U);
+        }
+        *ack = Script_Transfer(*op & 0x0FU, &data);
+        if (*ack == DAP_TRANSFER_OK) {
+          if ((*op & DAP_TRANSFER_RnW) != 0U) {
+            *acc = data;
+          }
+        } else if ((*op & SCRIPT_XFER_NOFAIL) == 0U) {
+          *pc = pos;
+          return (SCRIPT_ERROR_TRANSFER);
+        }
+        break;
+
+      case SCRIPT_LOAD:
+        *acc  = Script_Get(op, 4U);
+        break;
+      case SCRIPT_AND:
+        *acc &= Script_Get(op, 4U);
+        break;
+      case SCRIPT_OR:
+        *acc |= Script_Get(op, 4U);
+        break;
+      case SCRIPT_CMP:
+        flag = ((*acc & Script_Get(op, 4U)) == Script_Get(op+4, 4U));
+        break;
+
+      case SCRIPT_JMP:
+      case SCRIPT_JEQ:
+      case SCRIPT_JNE:
+      case SCRIPT_JNT:
+        if ((opcode == SCRIPT_JMP) ||
+            ((opcode == SCRIPT_JEQ) && flag) ||
+            ((opcode == SCRIPT_JNE) && !flag) ||
+            ((opcode == SCRIPT_JNT) && ((TIMESTAMP_GET() - timer_start) < timer))) {
+          *pc = Script_Get(op, 2U);
+        }
+        break;
+
+      case SCRIPT_TIMER:
+      case SCRIPT_DELAY:
+        data = Script_Get(op, 4U);
+        if (data > SCRIPT_TIME_MAX) {
+          *pc = pos;
+          return (SCRIPT_ERROR_INVALID);
+        }
+        data *= TIMESTAMP_TICKS_PER_US;
+        if (opcode == SCRIPT_TIMER) {
+          timer_start = TIMESTAMP_GET();
+          timer       = data;
+          break;
+        }
+        // The delay ends early when the run time limit is reached
+        num = TIMESTAMP_GET();
+        while ((TIMESTAMP_GET() - num) < data) {
+          if (DAP_TransferAbort) {
+            return (SCRIPT_ERROR_ABORT);
+          }
+          if ((TIMESTAMP_GET() - start) > timeout) {
+            return (SCRIPT_ERROR_TIMEOUT);
+          }
+        }
+        break;
+
+      case SCRIPT_PINS:
+      case SCRIPT_CMD:
+        if (opcode == SCRIPT_PINS) {
+          cmd_request[0] = ID_DAP_SWJ_Pins;
+          memcpy(&cmd_request[1], op, 6U);
+          num = 7U;
+        } else {
+          num = *op++;
+          if ((num == 0U) || (num > sizeof(cmd_request)) || (*op == ID_DAP_Script)) {
+            *pc = pos;
+            return (SCRIPT_ERROR_INVALID);
+          }
+          memcpy(cmd_request, op, num);
+        }
+        memset(&cmd_request[num], 0, sizeof(cmd_request) - num);
+        num = DAP_ExecuteCommand(cmd_request, cmd_response);
+        if ((num & 0xFFFFU) > 1U) {
+          *acc = Script_Get(&cmd_response[1], ((num & 0xFFFFU) > 5U) ? 4U : ((num & 0xFFFFU) - 1U));
+        }
+        break;
+    }
+  }
+}
+
+
+// Process Script command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1)
+//           SCRIPT_LOAD_PROGRAM: offset (2), length (1), program data (length)
+//                                (offset 0 starts a new program)
+//           SCRIPT_RUN:          entry (2), run time limit in ms (2, 0 = default)
+// Response: SCRIPT_LOAD_PROGRAM: status (1)
+//           SCRIPT_RUN:          status (1), result (1), stop position (2), ACK (1), ACC (4)
+uint32_t Script_Process (const uint8_t *request, uint8_t *response) {
+  uint32_t offset;
+  uint32_t length;
+  uint32_t timeout;
+  uint32_t result;
+  uint32_t pc;
+  uint32_t acc;
+  uint8_t  ack;
+
+  switch (*request) {
+    case SCRIPT_LOAD_PROGRAM:
+      offset = Script_Get(request+1, 2U);
+      length = *(request+3);
+      if (ScriptRunning || (length > (DAP_PACKET_SIZE - 5U)) || ((offset + length) > SCRIPT_SIZE)) {
+        // Program data is consumed anyway, so it is not taken for commands
+        *response = DAP_ERROR;
+        return (((4U + length) << 16) | 1U);
+      }
+      memcpy(&ScriptProgram[offset], request+4, length);
+      if (offset == 0U) {
+        ScriptLength = 0U;
+      }
+      if ((offset + length) > ScriptLength) {
+        ScriptLength = (uint16_t)(offset + length);
+      }
+      *response = DAP_OK;
+      return (((4U + length) << 16) | 1U);
+
+    case SCRIPT_RUN:
+      pc      = Script_Get(request+1, 2U);
+      timeout = Script_Get(request+3, 2U);
+      if (timeout == 0U) {
+        timeout = SCRIPT_DEFAULT_TIMEOUT;
+      }
+      acc = 0U;
+      ack = 0U;
+      DAP_TransferAbort = 0U;
+      if (ScriptRunning) {
+        // Reached through ExecuteCommands or a Macro run by a CMD of the running program
+        result = SCRIPT_ERROR_INVALID;
+      } else if (DAP_Data.debug_port != DAP_PORT_SWD) {
+        result = SCRIPT_ERROR_TRANSFER;
+      } else {
+        ScriptRunning = 1U;
+        result = Script_Run(timeout * 1000U * TIMESTAMP_TICKS_PER_US, &pc, &acc, &ack);
+        ScriptRunning = 0U;
+      }
+      *(response+0) = (result == SCRIPT_OK) ? DAP_OK : DAP_ERROR;
+      *(response+1) = (uint8_t)result;
+      *(response+2) = (uint8_t)(pc >> 0);
+      *(response+3) = (uint8_t)(pc >> 8);
+      *(response+4) = ack;
+      *(response+5) = (uint8_t)(acc >>  0);
+      *(response+6) = (uint8_t)(acc >>  8);
+      *(response+7) = (uint8_t)(acc >> 16);
+      *(response+8) = (uint8_t)(acc >> 24);
+      return ((5U << 16) | 9U);
+
+    default:
+      *response = DAP_ERROR;
+      return ((1U << 16) | 1U);
+  }
+}
+
+#endif  /* (DAP_SWD != 0) */
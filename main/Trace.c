@@ -0,0 +1,347 @@
+// Trace multiplexer
+// Tags data of the SWO, UART and RTT sources with the Test Domain Timer and multiplexes it as records
+// on the trace characteristic of the stream service, so the host can merge all sources on one
+// timeline without timestamp round trips. Each source spends byte credits granted by the host. Data
+// of a source without credit (or while a batch waits for a BLE buffer) stays on the path of the
+// source (SWO trace buffer, UART driver buffer, RTT buffer in the target), so one busy source cannot
+// flood the link.
+//
+// Batch format:
+//   sequence (1), base timestamp (4)
+//   then for each record: source (1), timestamp difference to base (zigzag varint), length (1), data
+// Sources are TRACE_SOURCE_SWO, TRACE_SOURCE_UART and TRACE_SOURCE_RTT + up buffer index.
+// Timestamps are Test Domain Timer ticks (TIMESTAMP_CLOCK) of the time the probe received the data
+// (SWO and UART) or read it from the target (RTT). Records of different sources are not
+// in time order, so the difference can be negative.
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "hid_dap.h"
+#include "ble_stream.h"
+
+// Maximum time a record waits in a batch (in ms)
+#define TRACE_LATENCY           5U
+
+// Maximum length of a batch
+#define TRACE_FRAME_SIZE        244U
+#define TRACE_HEADER_SIZE       5U
+#define TRACE_RECORD_HEADER     7U              // source, varint (up to 5 bytes), length
+#define TRACE_RECORD_DATA       255U            // Maximum length of record data
+
+// Stack size of the trace task
+#define TRACE_TASK_STACK        2048U
+
+// Trace Control
+#define TRACE_STOP              0U              // Disable all sources
+#define TRACE_ENABLE            1U              // Enable source with initial credit
+#define TRACE_CREDIT            2U              // Add credit to source
+#define TRACE_DISABLE           3U              // Disable source
+#define TRACE_STATUS            4U              // Get status
+
+// Credit classes (RTT up buffers share one credit)
+#define TRACE_CLASS_SWO         0U
+#define TRACE_CLASS_UART        1U
+#define TRACE_CLASS_RTT         2U
+#define TRACE_CLASSES           3U
+
+// Credit of a source which is not limited
+#define TRACE_UNLIMITED         0xFFFFFFFFU
+
+static struct {
+  uint8_t  enabled;                             // Enabled credit classes (bit n = class n)
+  uint8_t  sequence;                            // Sequence number of the next batch
+  uint8_t  pending;                             // Batch is complete but could not be sent yet
+  uint16_t length;                              // Length of the batch (0: empty)
+  uint16_t limit;                               // Maximum length of the batch
+  uint32_t base;                                // Base timestamp of the batch
+  uint32_t opened;                              // Time when the batch was started
+  uint32_t batches;                             // Number of sent batches
+  uint32_t credit[TRACE_CLASSES];               // Remaining credit in bytes
+  uint32_t sent[TRACE_CLASSES];                 // Bytes accepted into batches
+  uint32_t stalls[TRACE_CLASSES];               // Data refused for lack of credit
+  uint8_t  frame[TRACE_FRAME_SIZE];             // Batch
+} Trace;
+
+static SemaphoreHandle_t Trace_Lock;            // Held while the batch is changed
+static TaskHandle_t      Trace_Task;            // Sends batches when the latency expires
+
+
+// Get credit class of a source
+static uint32_t Trace_Class (uint32_t source) {
+  if (source >= TRACE_SOURCE_RTT) {
+    return (TRACE_CLASS_RTT);
+  }
+  return ((source == TRACE_SOURCE_UART) ? TRACE_CLASS_UART : TRACE_CLASS_SWO);
+}
+
+
+// Send the batch (Trace_Lock is held)
+//   return: 1 when the batch was sent (or empty)
+static uint32_t Trace_Flush (void) {
+  if (Trace.length == 0U) {
+    return (1U);
+  }
+
+  if (ble_stream_notify(BLE_STREAM_TRACE, Trace.frame, Trace.length) != 0) {
+    Trace.pending = 1U;   // Retried by the trace task
+    return (0U);
+  }
+
+  Trace.batches++;
+  Trace.sequence++;
+  Trace.pending = 0U;
+  Trace.length  = 0U;
+  return (1U);
+}
+
+
+// Trace task: sends a batch which is not full when the latency expires
+// Sleeps until Trace_Put opens a batch, then until the latency of the batch expires.
+static void Trace_Thread (void *argument) {
+  TickType_t wait;
+  uint32_t   latency;
+  uint32_t   elapsed;
+  (void)     argument;
+
+  latency = TRACE_LATENCY * (TIMESTAMP_CLOCK / 1000U);
+  wait    = portMAX_DELAY;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, wait);
+    xSemaphoreTake(Trace_Lock, portMAX_DELAY);
+    wait = portMAX_DELAY;
+    if (Trace.length != 0U) {
+      elapsed = TIMESTAMP_GET() - Trace.opened;
+      if ((Trace.pending != 0U) || (elapsed >= latency)) {
+        if (Trace_Flush() == 0U) {
+          // Out of buffers: retried on the next tick
+          wait = 1U;
+        }
+      } else {
+        // Wait until the latency expires (at least one tick)
+        wait = pdMS_TO_TICKS(((latency - elapsed) / (TIMESTAMP_CLOCK / 1000U)) + 1U);
+        if (wait == 0U) {
+          wait = 1U;
+        }
+      }
+    }
+    xSemaphoreGive(Trace_Lock);
+  }
+}
+
+
+// Check if data of a source goes to the trace multiplexer
+//   source: TRACE_SOURCE_xxx
+//   return: 1 when the source is enabled and the trace characteristic is subscribed
+uint32_t Trace_Routed (uint32_t source) {
+  if ((Trace.enabled & (1U << Trace_Class(source))) == 0U) {
+    return (0U);
+  }
+  return (ble_stream_is_subscribed(BLE_STREAM_TRACE) ? 1U : 0U);
+}
+
+
+// Add data of a source to the batch
+//   source: TRACE_SOURCE_xxx
+//   data:   pointer to data
+//   num:    number of bytes
+//   time:   timestamp of the data
+//   return: number of bytes taken (the rest stays with the source)
+uint32_t Trace_Put (uint32_t source, const uint8_t *data, uint32_t num, uint32_t time) {
+  uint32_t class;
+  uint32_t taken;
+  uint32_t room;
+  uint32_t diff;
+  uint32_t wake;
+  uint32_t n;
+
+  if ((num == 0U) || (Trace_Routed(source) == 0U)) {
+    return (0U);
+  }
+  class = Trace_Class(source);
+
+  xSemaphoreTake(Trace_Lock, portMAX_DELAY);
+  wake = 0U;
+
+  if ((Trace.credit[class] != TRACE_UNLIMITED) && (num > Trace.credit[class])) {
+    num = Trace.credit[class];
+    if (num == 0U) {
+      Trace.stalls[class]++;
+    }
+  }
+
+  for (taken = 0U; (taken < num) && (Trace.pending == 0U); taken += n) {
+    if (Trace.length == 0U) {
+      Trace.limit = ble_stream_payload_size();
+      if (Trace.limit > TRACE_FRAME_SIZE) {
+        Trace.limit = TRACE_FRAME_SIZE;
+      }
+      if (Trace.limit <= (TRACE_HEADER_SIZE + TRACE_RECORD_HEADER)) {
+        break;
+      }
+      Trace.base     = time;
+      Trace.opened   = TIMESTAMP_GET();
+      Trace.frame[0] = Trace.sequence;
+      Trace.frame[1] = (uint8_t)(time >>  0);
+      Trace.frame[2] = (uint8_t)(time >>  8);
+      Trace.frame[3] = (uint8_t)(time >> 16);
+      Trace.frame[4] = (uint8_t)(time >> 24);
+      Trace.length   = TRACE_HEADER_SIZE;
+      wake = 1U;
+    }
+    room = Trace.limit - Trace.length;
+    if (room <= TRACE_RECORD_HEADER) {
+      n = 0U;
+      Trace_Flush();
+      continue;
+    }
+    n = num - taken;
+    if (n > (room - TRACE_RECORD_HEADER)) {
+      n = room - TRACE_RECORD_HEADER;
+    }
+    if (n > TRACE_RECORD_DATA) {
+      n = TRACE_RECORD_DATA;
+    }
+
+    diff = time - Trace.base;
+    diff = (diff << 1) ^ (uint32_t)((int32_t)diff >> 31);
+    Trace.frame[Trace.length++] = (uint8_t)source;
+    while (diff >= 0x80U) {
+      Trace.frame[Trace.length++] = (uint8_t)(diff | 0x80U);
+      diff >>= 7;
+    }
+    Trace.frame[Trace.length++] = (uint8_t)diff;
+    Trace.frame[Trace.length++] = (uint8_t)n;
+    memcpy(&Trace.frame[Trace.length], &data[taken], n);
+    Trace.length += (uint16_t)n;
+
+    if ((Trace.length + TRACE_RECORD_HEADER) >= Trace.limit) {
+      Trace_Flush();
+    }
+  }
+
+  if (Trace.credit[class] != TRACE_UNLIMITED) {
+    Trace.credit[class] -= taken;
+  }
+  Trace.sent[class] += taken;
+
+  if ((wake != 0U) || (Trace.pending != 0U)) {
+    // The trace task sends the batch when the latency expires or retries a pending batch
+    xTaskNotifyGive(Trace_Task);
+  }
+
+  xSemaphoreGive(Trace_Lock);
+
+  return (taken);
+}
+
+
+// Process Trace command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1), credit class (1, 0 = SWO, 1 = UART, 2 = RTT), credit in bytes (4,
+//           0xFFFFFFFF = unlimited)
+// Response: status (1), enabled classes (1), sent batches (4),
+//           then for each class: remaining credit (4), sent bytes (4), stalls (4)
+uint32_t Trace_Configure (const uint8_t *request, uint8_t *response) {
+  uint32_t control;
+  uint32_t class;
+  uint32_t value;
+  uint32_t n, i;
+
+  control = *(request+0);
+  class   = *(request+1);
+  value   = (uint32_t)(*(request+2) <<  0) |
+            (uint32_t)(*(request+3) <<  8) |
+            (uint32_t)(*(request+4) << 16) |
+            (uint32_t)(*(request+5) << 24);
+
+  *response = DAP_OK;
+
+  if (Trace_Lock == NULL) {
+    Trace_Lock = xSemaphoreCreateMutex();
+    if ((Trace_Lock == NULL) ||
+        (xTaskCreatePinnedToCore(Trace_Thread, "trace", TRACE_TASK_STACK, NULL, CONFIG_STREAM_TASK_PRIORITY,
+                                 &Trace_Task, TASK_CORE(CONFIG_STREAM_TASK_CORE)) != pdPASS)) {
+      if (Trace_Lock != NULL) {
+        vSemaphoreDelete(Trace_Lock);
+        Trace_Lock = NULL;
+      }
+      *response = DAP_ERROR;
+      control   = TRACE_STATUS;
+    }
+  }
+
+  if ((control != TRACE_STOP) && (control != TRACE_STATUS) && (class >= TRACE_CLASSES)) {
+    *response = DAP_ERROR;
+    control   = TRACE_STATUS;
+  }
+
+  if (Trace_Lock != NULL) {
+    xSemaphoreTake(Trace_Lock, portMAX_DELAY);
+  }
+  switch (control) {
+    case TRACE_STOP:
+      Trace.enabled = 0U;
+      Trace.pending = 0U;
+      Trace.length  = 0U;
+      break;
+    case TRACE_ENABLE:
+      Trace.credit[class] = value;
+      Trace.sent[class]   = 0U;
+      Trace.stalls[class] = 0U;
+      Trace.enabled      |= (uint8_t)(1U << class);
+      break;
+    case TRACE_CREDIT:
+      if (Trace.credit[class] != TRACE_UNLIMITED) {
+        n = Trace.credit[class] + value;
+        Trace.credit[class] = ((n < value) || (value == TRACE_UNLIMITED)) ? TRACE_UNLIMITED : n;
+      }
+      break;
+    case TRACE_DISABLE:
+      Trace.enabled &= (uint8_t)~(1U << class);
+      break;
+    case TRACE_STATUS:
+      break;
+    default:
+      *response = DAP_ERROR;
+      break;
+  }
+
+  *(response+1) = Trace.enabled;
+  n = Trace.batches;
+  *(response+2) = (uint8_t)(n >>  0);
+  *(response+3) = (uint8_t)(n >>  8);
+  *(response+4) = (uint8_t)(n >> 16);
+  *(response+5) = (uint8_t)(n >> 24);
+  response += 6;
+  for (i = 0U; i < TRACE_CLASSES; i++) {
+    n = Trace.credit[i];
+    *response++ = (uint8_t)(n >>  0);
+    *response++ = (uint8_t)(n >>  8);
+    *response++ = (uint8_t)(n >> 16);
+    *response++ = (uint8_t)(n >> 24);
+    n = Trace.sent[i];
+    *response++ = (uint8_t)(n >>  0);
+    *response++ = (uint8_t)(n >>  8);
+    *response++ = (uint8_t)(n >> 16);
+    *response++ = (uint8_t)(n >> 24);
+    n = Trace.stalls[i];
+    *response++ = (uint8_t)(n >>  0);
+    *response++ = (uint8_t)(n >>  8);
+    *response++ = (uint8_t)(n >> 16);
+    *response++ = (uint8_t)(n >> 24);
+  }
+  if (Trace_Lock != NULL) {
+    xSemaphoreGive(Trace_Lock);
+  }
+
+  return ((6U << 16) | (6U + (TRACE_CLASSES * 12U)));
+}
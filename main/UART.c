@@ -34,18 +34,28 @@
 #error "UART Communication Port not supported in DAP V1!"
 #endif
 
-#include "Driver_USART.h"
-
-#include "cmsis_os2.h"
 #include <string.h>
-
-#define UART_RX_BLOCK_SIZE    32U   /* Uart Rx Block Size (must be 2^n) */
-
-// USART Driver
-#define _USART_Driver_(n)  Driver_USART##n
-#define  USART_Driver_(n) _USART_Driver_(n)
-extern ARM_DRIVER_USART    USART_Driver_(DAP_UART_DRIVER);
-#define pUSART           (&USART_Driver_(DAP_UART_DRIVER))
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "hid_dap.h"
+#include "ble_nus.h"
+
+// ESP-IDF UART Driver
+// The driver interrupt moves data between the UART FIFOs and its ring buffers in internal RAM. The
+// DAP UART task moves received data on into the receive buffer (DAP_UART_RX_BUFFER_SIZE, which may
+// be in PSRAM and much larger), collects the error events and, while the COM port transport is
+// active, forwards data between the UART and the Nordic UART Service (which takes the role of the
+// USB COM port). Transmit data is written to the ring buffer of the driver (DAP_UART_TX_BUFFER_SIZE).
+#define UART_DRIVER_RX_SIZE   1024U /* Receive ring buffer of the UART driver */
+#define UART_RX_THRESHOLD     32U   /* RX FIFO interrupt threshold in bytes */
+#define UART_RX_TIMEOUT       2U    /* RX timeout interrupt after idle line in symbols */
+#define UART_EVENT_QUEUE      16U   /* Number of UART driver events */
+#define UART_POLL_MS          10U   /* Latency of data written to the NUS service */
+#define UART_TASK_STACK       3072U /* Stack size of the DAP UART task */
+#define UART_COM_BUF_SIZE     512U  /* Largest notification of the COM port */
 
 // UART Configuration
 #if (DAP_UART_USB_COM_PORT != 0)
@@ -58,25 +68,49 @@ static uint8_t  UartTransport = DAP_UART_TRANSPORT_NONE;
 static uint8_t  UartConfigured = 0U;
 static uint8_t  UartReceiveEnabled = 0U;
 static uint8_t  UartTransmitEnabled = 0U;
-static uint8_t  UartTransmitActive = 0U;
-
-// UART TX Buffer
-static uint8_t  UartTxBuf[DAP_UART_TX_BUFFER_SIZE];
-static volatile uint32_t UartTxIndexI = 0U;
-static volatile uint32_t UartTxIndexO = 0U;
-
-// UART RX Buffer
-static uint8_t  UartRxBuf[DAP_UART_RX_BUFFER_SIZE];
-static volatile uint32_t UartRxIndexI = 0U;
-static volatile uint32_t UartRxIndexO = 0U;
 
 // Uart Errors
 static volatile uint8_t  UartErrorRxDataLost = 0U;
 static volatile uint8_t  UartErrorFraming = 0U;
 static volatile uint8_t  UartErrorParity = 0U;
 
-// UART Transmit
-static uint32_t UartTxNum = 0U;
+// UART Driver
+static QueueHandle_t     UartEvents;        /* UART driver event queue */
+static SemaphoreHandle_t UartLock;          /* Held while the COM port is served */
+static TaskHandle_t      UartTask;          /* DAP UART task */
+
+// UART Receive Buffer (filled by the DAP UART task)
+static uint8_t  UartRxBuf[DAP_UART_RX_BUFFER_SIZE] TRACE_BUFFER_ATTR;
+static volatile uint32_t UartRxIndexI = 0U;
+static volatile uint32_t UartRxIndexO = 0U;
+static uint32_t UartRxTime;                 /* Timestamp of the data at UartRxIndexO */
+
+// COM Port data from the target not notified yet
+// Bytes are coalesced until a notification is full or the first byte is UartComLatency old.
+static uint8_t  UartComBuf[UART_COM_BUF_SIZE];
+static uint32_t UartComCount = 0U;
+static uint32_t UartComHeader;              /* Frame header bytes in UartComBuf (0 or 4) */
+static uint32_t UartComTime;                /* Timestamp of the first byte in UartComBuf */
+
+// COM Port settings
+static volatile uint32_t UartComLatency = CONFIG_DAP_UART_LATENCY_MS; /* Deadline in ms */
+static volatile uint8_t  UartComFlags   = 0U;                         /* UART_BRIDGE_FLAG_xxx */
+
+// COM Port counters
+static struct {
+  uint32_t bytes;                           /* Notified bytes (without frame headers) */
+  uint32_t notifications;                   /* Sent notifications */
+  uint32_t dropped;                         /* Bytes dropped while not subscribed */
+  uint32_t deadline;                        /* Notifications sent before full by the deadline */
+  uint32_t latency_max;                     /* Longest time from first byte to notification in us */
+  uint32_t latency_sum;                     /* Sum of latencies of all notifications in us */
+} UartComStats;
+
+// UART Bridge command
+#define UART_BRIDGE_READ            0U      /* Read counters */
+#define UART_BRIDGE_CLEAR           1U      /* Read and clear counters */
+#define UART_BRIDGE_CONFIGURE       2U      /* Set latency and flags, clear counters */
+#define UART_BRIDGE_FLAG_TIMESTAMP  (1U<<0) /* Prefix notifications with TIMESTAMP_GET of the first byte */
 
 // Function prototypes
 static uint8_t  UART_Init (void);
@@ -87,70 +121,107 @@ static uint8_t  UART_Transmit_Enable (void);
 static void     UART_Receive_Disable (void);
 static void     UART_Transmit_Disable (void);
 static void     UART_Receive_Flush (void);
-static void     UART_Transmit_Flush (void);
-static void     UART_Receive (void);
-static void     UART_Transmit (void);
-
-
-// USART Driver Callback function
-//   event: event mask
-static void USART_Callback (uint32_t event) {
-  if (event &  ARM_USART_EVENT_SEND_COMPLETE) {
-    UartTxIndexO += UartTxNum;
-    UartTransmitActive = 0U;
-    UART_Transmit();
-  }
-  if (event &  ARM_USART_EVENT_RECEIVE_COMPLETE) {
-    UartRxIndexI += UART_RX_BLOCK_SIZE;
-    UART_Receive();
-  }
-  if (event &  ARM_USART_EVENT_RX_OVERFLOW) {
-    UartErrorRxDataLost = 1U;
-  }
-  if (event &  ARM_USART_EVENT_RX_FRAMING_ERROR) {
-    UartErrorFraming = 1U;
-  }
-  if (event &  ARM_USART_EVENT_RX_PARITY_ERROR) {
-    UartErrorParity = 1U;
+static uint8_t  UART_Transmit_Flush (void);
+static uint8_t  UART_Config (uint8_t control, uint32_t *baudrate);
+static void     UART_Drain (uint32_t time);
+static uint32_t UART_RxRead (uint8_t *buf, uint32_t num);
+static uint32_t UART_RxCount (void);
+static uint32_t UART_TxFree (void);
+static uint32_t UART_TxCount (void);
+static uint32_t UART_ComPort (void);
+static uint32_t UART_ComTrace (void);
+
+
+// DAP UART task: collects UART driver events and serves the COM port
+static void UART_Thread (void *argument) {
+  uart_event_t event;
+  TickType_t   wait;
+  uint32_t     time;
+  (void)       argument;
+
+  wait = pdMS_TO_TICKS(UART_POLL_MS);
+
+  for (;;) {
+    if (xQueueReceive(UartEvents, &event, wait) == pdTRUE) {
+      // Data is stamped when the driver reports it, not when the COM port is served
+      time = TIMESTAMP_GET();
+      switch (event.type) {
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          UartErrorRxDataLost = 1U;
+          break;
+        case UART_FRAME_ERR:
+          UartErrorFraming = 1U;
+          break;
+        case UART_PARITY_ERR:
+          UartErrorParity = 1U;
+          break;
+        default:
+          break;
+      }
+    } else {
+      time = TIMESTAMP_GET();
+    }
+    xSemaphoreTake(UartLock, portMAX_DELAY);
+    UART_Drain(time);
+    if (UartTransport == DAP_UART_TRANSPORT_USB_COM_PORT) {
+      wait = UART_ComPort();
+    } else {
+      wait = pdMS_TO_TICKS(UART_POLL_MS);
+    }
+    xSemaphoreGive(UartLock);
   }
 }
 
 // Init UART
 //   return: DAP_OK or DAP_ERROR
 static uint8_t UART_Init (void) {
-  int32_t status;
-  uint8_t ret = DAP_ERROR;
 
   UartConfigured = 0U;
   UartReceiveEnabled = 0U;
   UartTransmitEnabled = 0U;
-  UartTransmitActive = 0U;
   UartErrorRxDataLost = 0U;
   UartErrorFraming = 0U;
   UartErrorParity = 0U;
-  UartTxIndexI = 0U;
-  UartTxIndexO = 0U;
+  UartComCount = 0U;
   UartRxIndexI = 0U;
   UartRxIndexO = 0U;
-  UartTxNum = 0U;
 
-  status = pUSART->Initialize(USART_Callback);
-  if (status == ARM_DRIVER_OK) {
-    status = pUSART->PowerControl(ARM_POWER_FULL);
+  if (UartLock == NULL) {
+    UartLock = xSemaphoreCreateMutex();
+    if (UartLock == NULL) {
+      return (DAP_ERROR);
+    }
   }
-  if (status == ARM_DRIVER_OK) {
-    ret = DAP_OK;
+
+  if (uart_driver_install(DAP_UART_DRIVER, UART_DRIVER_RX_SIZE, DAP_UART_TX_BUFFER_SIZE,
+                          UART_EVENT_QUEUE, &UartEvents, 0) != ESP_OK) {
+    return (DAP_ERROR);
+  }
+  if ((uart_set_pin(DAP_UART_DRIVER, CONFIG_PIN_UART_TX, CONFIG_PIN_UART_RX,
+                    UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) ||
+      (uart_set_rx_full_threshold(DAP_UART_DRIVER, UART_RX_THRESHOLD) != ESP_OK) ||
+      (uart_set_rx_timeout(DAP_UART_DRIVER, UART_RX_TIMEOUT) != ESP_OK) ||
+      (xTaskCreatePinnedToCore(UART_Thread, "dap_uart", UART_TASK_STACK, NULL, CONFIG_STREAM_TASK_PRIORITY,
+                               &UartTask, TASK_CORE(CONFIG_STREAM_TASK_CORE)) != pdPASS)) {
+    uart_driver_delete(DAP_UART_DRIVER);
+    return (DAP_ERROR);
   }
 
-  return (ret);
+  return (DAP_OK);
 }
 
 // Un-Init UART
 static void UART_Uninit (void) {
   UartConfigured = 0U;
+  UartReceiveEnabled = 0U;
+  UartTransmitEnabled = 0U;
 
-  pUSART->PowerControl(ARM_POWER_OFF);
-  pUSART->Uninitialize();
+  // Task must not hold the lock while it is deleted
+  xSemaphoreTake(UartLock, portMAX_DELAY);
+  vTaskDelete(UartTask);
+  xSemaphoreGive(UartLock);
+  uart_driver_delete(DAP_UART_DRIVER);
 }
 
 // Get UART Status
@@ -183,114 +254,345 @@ static uint8_t UART_Get_Status (void) {
 // Enable UART Receive
 //   return: DAP_OK or DAP_ERROR
 static uint8_t UART_Receive_Enable (void) {
-  int32_t status;
-  uint8_t ret = DAP_ERROR;
 
   if (UartReceiveEnabled == 0U) {
-    // Flush Buffers
-    UartRxIndexI = 0U;
-    UartRxIndexO = 0U;
-
-    UART_Receive();
-    status = pUSART->Control(ARM_USART_CONTROL_RX, 1U);
-    if (status == ARM_DRIVER_OK) {
-      UartReceiveEnabled = 1U;
-      ret = DAP_OK;
-    }
-  } else {
-    ret = DAP_OK;
+    // Data received while the receiver was disabled is discarded
+    UART_Receive_Flush();
+    UartErrorRxDataLost = 0U;
+    UartErrorFraming = 0U;
+    UartErrorParity = 0U;
+    UartReceiveEnabled = 1U;
   }
 
-  return (ret);
+  return (DAP_OK);
 }
 
 // Enable UART Transmit
 //   return: DAP_OK or DAP_ERROR
 static uint8_t UART_Transmit_Enable (void) {
-  int32_t status;
-  uint8_t ret = DAP_ERROR;
-
-  if (UartTransmitEnabled == 0U) {
-    // Flush Buffers
-    UartTransmitActive = 0U;
-    UartTxIndexI = 0U;
-    UartTxIndexO = 0U;
-    UartTxNum = 0U;
-
-    status = pUSART->Control(ARM_USART_CONTROL_TX, 1U);
-    if (status == ARM_DRIVER_OK) {
-      UartTransmitEnabled = 1U;
-      ret = DAP_OK;
-    }
-  } else {
-    ret = DAP_OK;
-  }
-
-  return (ret);
+  UartTransmitEnabled = 1U;
+  return (DAP_OK);
 }
 
 // Disable UART Receive
 static void UART_Receive_Disable (void) {
-  if (UartReceiveEnabled != 0U) {
-    pUSART->Control(ARM_USART_CONTROL_RX, 0U);
-    pUSART->Control(ARM_USART_ABORT_RECEIVE, 0U);
-    UartReceiveEnabled = 0U;
-  }
+  UartReceiveEnabled = 0U;
 }
 
 // Disable UART Transmit
 static void UART_Transmit_Disable (void) {
-  if (UartTransmitEnabled != 0U) {
-    pUSART->Control(ARM_USART_ABORT_SEND, 0U);
-    pUSART->Control(ARM_USART_CONTROL_TX, 0U);
-    UartTransmitActive = 0U;
-    UartTransmitEnabled = 0U;
-  }
+  UartTransmitEnabled = 0U;
 }
 
 // Flush UART Receive buffer
 static void UART_Receive_Flush (void) {
-  pUSART->Control(ARM_USART_ABORT_RECEIVE, 0U);
-  UartRxIndexI = 0U;
-  UartRxIndexO = 0U;
-  if (UartReceiveEnabled != 0U) {
-    UART_Receive();
-  }
+  xSemaphoreTake(UartLock, portMAX_DELAY);
+  uart_flush_input(DAP_UART_DRIVER);
+  UartRxIndexO = UartRxIndexI;
+  xSemaphoreGive(UartLock);
 }
 
 // Flush UART Transmit buffer
-static void UART_Transmit_Flush (void) {
-  pUSART->Control(ARM_USART_ABORT_SEND, 0U);
-  UartTransmitActive = 0U;
-  UartTxIndexI = 0U;
-  UartTxIndexO = 0U;
-  UartTxNum = 0U;
+//   return: DAP_OK or DAP_ERROR
+static uint8_t UART_Transmit_Flush (void) {
+  // The UART driver cannot take back data from its TX ring buffer, it is sent out
+  if (UART_TxCount() != 0U) {
+    return (DAP_ERROR);
+  }
+  return (DAP_OK);
+}
+
+// Configure UART
+//   control:  control byte of the UART Configure command
+//   baudrate: requested baudrate, actual baudrate on return
+//   return:   0 or DAP_UART_CFG_ERROR_xxx flags
+static uint8_t UART_Config (uint8_t control, uint32_t *baudrate) {
+  uart_config_t config = {
+    .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
+    .source_clk = UART_SCLK_DEFAULT,
+  };
+  uint8_t status = 0U;
+
+  // Data bits (bits 0..2)
+  switch (control & 0x07U) {
+    case 0U: config.data_bits = UART_DATA_8_BITS; break;
+    case 5U: config.data_bits = UART_DATA_5_BITS; break;
+    case 6U: config.data_bits = UART_DATA_6_BITS; break;
+    case 7U: config.data_bits = UART_DATA_7_BITS; break;
+    default: status |= DAP_UART_CFG_ERROR_DATA_BITS; break;
+  }
+  // Parity (bits 4..5)
+  switch ((control >> 4) & 0x03U) {
+    case 0U: config.parity = UART_PARITY_DISABLE; break;
+    case 1U: config.parity = UART_PARITY_EVEN;    break;
+    case 2U: config.parity = UART_PARITY_ODD;     break;
+    default: status |= DAP_UART_CFG_ERROR_PARITY; break;
+  }
+  // Stop bits (bits 6..7)
+  switch ((control >> 6) & 0x03U) {
+    case 0U: config.stop_bits = UART_STOP_BITS_1;   break;
+    case 1U: config.stop_bits = UART_STOP_BITS_2;   break;
+    case 2U: config.stop_bits = UART_STOP_BITS_1_5; break;
+    default: status |= DAP_UART_CFG_ERROR_STOP_BITS; break;
+  }
+
+  if (status == 0U) {
+    config.baud_rate = (int)*baudrate;
+    if ((*baudrate == 0U) ||
+        (uart_param_config(DAP_UART_DRIVER, &config) != ESP_OK) ||
+        (uart_get_baudrate(DAP_UART_DRIVER, baudrate) != ESP_OK)) {
+      *baudrate = 0U;
+    }
+  }
+
+  return (status);
 }
 
-// Receive data from target via UART
-static void UART_Receive (void) {
+// Move received data from the UART driver into the receive buffer (UartLock is held)
+// When the receive buffer is full, data stays in the driver until that overflows too.
+//   time: timestamp of the received data
+static void UART_Drain (uint32_t time) {
+  size_t   count;
   uint32_t index;
+  uint32_t n;
+  int      num;
 
-  index = UartRxIndexI & (DAP_UART_RX_BUFFER_SIZE - 1U);
-  pUSART->Receive(&UartRxBuf[index], UART_RX_BLOCK_SIZE);
+  for (;;) {
+    n = DAP_UART_RX_BUFFER_SIZE - (UartRxIndexI - UartRxIndexO);
+    if ((n == 0U) ||
+        (uart_get_buffered_data_len(DAP_UART_DRIVER, &count) != ESP_OK) || (count == 0U)) {
+      break;
+    }
+    index = UartRxIndexI & (DAP_UART_RX_BUFFER_SIZE - 1U);
+    if (n > (DAP_UART_RX_BUFFER_SIZE - index)) {
+      n = DAP_UART_RX_BUFFER_SIZE - index;
+    }
+    if (n > count) {
+      n = (uint32_t)count;
+    }
+    num = uart_read_bytes(DAP_UART_DRIVER, &UartRxBuf[index], n, 0);
+    if (num <= 0) {
+      break;
+    }
+    if (UartRxIndexI == UartRxIndexO) {
+      UartRxTime = time;
+    }
+    UartRxIndexI += (uint32_t)num;
+  }
 }
 
-// Transmit available data to target via UART
-static void UART_Transmit (void) {
+// Read from the receive buffer
+//   buf:    pointer to buffer for data
+//   num:    maximum number of bytes
+//   return: number of bytes read
+static uint32_t UART_RxRead (uint8_t *buf, uint32_t num) {
   uint32_t count;
   uint32_t index;
+  uint32_t n;
 
-  count = UartTxIndexI - UartTxIndexO;
-  index = UartTxIndexO & (DAP_UART_TX_BUFFER_SIZE - 1U);
+  count = UartRxIndexI - UartRxIndexO;
+  if (num > count) {
+    num = count;
+  }
+  index = UartRxIndexO & (DAP_UART_RX_BUFFER_SIZE - 1U);
+  n = DAP_UART_RX_BUFFER_SIZE - index;
+  if (num <= n) {
+    memcpy(buf, &UartRxBuf[index], num);
+  } else {
+    memcpy(buf,     &UartRxBuf[index], n);
+    memcpy(&buf[n], &UartRxBuf[0],     num - n);
+  }
+  UartRxIndexO += num;
 
-  if (count != 0U) {
-    if ((index + count) <= DAP_UART_TX_BUFFER_SIZE) {
-      UartTxNum = count;
-    } else {
-      UartTxNum = DAP_UART_TX_BUFFER_SIZE - index;
+  return (num);
+}
+
+// Get number of received bytes available to the UART Transfer command
+//   return: number of bytes
+static uint32_t UART_RxCount (void) {
+
+  if (UartReceiveEnabled == 0U) {
+    return (0U);
+  }
+  return (UartRxIndexI - UartRxIndexO);
+}
+
+// Get free space of the UART TX ring buffer
+//   return: number of bytes
+static uint32_t UART_TxFree (void) {
+  size_t count;
+
+  if ((UartTransmitEnabled == 0U) ||
+      (uart_get_tx_buffer_free_size(DAP_UART_DRIVER, &count) != ESP_OK)) {
+    return (0U);
+  }
+  return ((uint32_t)count);
+}
+
+// Get number of bytes in the UART TX ring buffer not sent yet
+//   return: number of bytes
+static uint32_t UART_TxCount (void) {
+  size_t count;
+
+  if (uart_get_tx_buffer_free_size(DAP_UART_DRIVER, &count) != ESP_OK) {
+    return (0U);
+  }
+  return (DAP_UART_TX_BUFFER_SIZE - (uint32_t)count);
+}
+
+// Serve the COM port: data written to the NUS service to the UART, UART data to notifications
+// (UartLock is held)
+//   return: ticks until the COM port needs to be served again
+static uint32_t UART_ComPort (void) {
+  uint8_t  data[BLE_NUS_WRITE_MAX];
+  uint16_t len;
+  uint32_t count;
+  uint32_t size;
+  uint32_t deadline;
+  uint32_t elapsed;
+  uint32_t latency;
+  uint32_t wait;
+  int      num;
+
+  while ((len = ble_nus_receive(data, sizeof(data))) != 0U) {
+    // Blocks while the TX ring buffer is full, which holds back further writes of the peer
+    uart_write_bytes(DAP_UART_DRIVER, data, len);
+  }
+
+  if (Trace_Routed(TRACE_SOURCE_UART)) {
+    return (UART_ComTrace());
+  }
+
+  size = ble_nus_payload_size();
+  if ((size == 0U) || (size > UART_COM_BUF_SIZE)) {
+    size = UART_COM_BUF_SIZE;
+  }
+  deadline = UartComLatency * (TIMESTAMP_CLOCK / 1000U);
+  wait     = pdMS_TO_TICKS(UART_POLL_MS);
+
+  for (;;) {
+    // Fill the notification
+    count = UartRxIndexI - UartRxIndexO;
+    if ((UartComCount < size) && (count != 0U)) {
+      if (UartComCount == 0U) {
+        UartComTime   = UartRxTime;
+        UartComHeader = 0U;
+        if ((UartComFlags & UART_BRIDGE_FLAG_TIMESTAMP) != 0U) {
+          UartComBuf[0] = (uint8_t)(UartComTime >>  0);
+          UartComBuf[1] = (uint8_t)(UartComTime >>  8);
+          UartComBuf[2] = (uint8_t)(UartComTime >> 16);
+          UartComBuf[3] = (uint8_t)(UartComTime >> 24);
+          UartComHeader = 4U;
+        }
+        UartComCount = UartComHeader;
+      }
+      if (count > (size - UartComCount)) {
+        count = size - UartComCount;
+      }
+      UartComCount += UART_RxRead(&UartComBuf[UartComCount], count);
+    }
+    if (UartComCount <= UartComHeader) {
+      UartComCount = 0U;
+      break;
+    }
+
+    if (ble_nus_is_subscribed() == 0) {
+      // Dropped when nobody listens
+      UartComStats.dropped += UartComCount - UartComHeader;
+      UartComCount = 0U;
+      continue;
+    }
+
+    elapsed = TIMESTAMP_GET() - UartComTime;
+    if (UartComCount < size) {
+      if (elapsed < deadline) {
+        // Wait for more data until the deadline (at least one tick)
+        wait = pdMS_TO_TICKS(((deadline - elapsed) / (TIMESTAMP_CLOCK / 1000U)) + 1U);
+        if (wait == 0U) {
+          wait = 1U;
+        }
+        break;
+      }
+      UartComStats.deadline++;
+    }
+
+    if (ble_nus_notify(UartComBuf, (uint16_t)UartComCount) != 0) {
+      // Out of buffers: retried on the next tick
+      wait = 1U;
+      break;
+    }
+    latency = (uint32_t)(((uint64_t)elapsed * 1000000U) / TIMESTAMP_CLOCK);
+    if (UartComStats.latency_max < latency) {
+      UartComStats.latency_max = latency;
+    }
+    UartComStats.latency_sum += latency;
+    UartComStats.bytes       += UartComCount - UartComHeader;
+    UartComStats.notifications++;
+    UartComCount = 0U;
+  }
+
+  return (wait);
+}
+
+// Send UART data as records of the trace multiplexer instead of the NUS service (UartLock is held)
+//   return: ticks until the COM port needs to be served again
+static uint32_t UART_ComTrace (void) {
+  uint32_t n;
+
+  for (;;) {
+    if (UartComCount == 0U) {
+      UartComTime   = UartRxTime;
+      UartComHeader = 0U;
+      UartComCount  = UART_RxRead(UartComBuf, UART_COM_BUF_SIZE);
+      if (UartComCount == 0U) {
+        break;
+      }
+    }
+    n = Trace_Put(TRACE_SOURCE_UART, &UartComBuf[UartComHeader], UartComCount - UartComHeader, UartComTime);
+    UartComStats.bytes += n;
+    UartComCount       -= n;
+    if (UartComCount > UartComHeader) {
+      // Out of credit or buffers: the rest is retried on the next poll
+      memmove(&UartComBuf[UartComHeader], &UartComBuf[UartComHeader + n], UartComCount - UartComHeader);
+      break;
+    }
+    UartComCount = 0U;
+  }
+
+  return (pdMS_TO_TICKS(UART_POLL_MS));
+}
+
+// Activate or deactivate the COM port (Nordic UART Service)
+//   cmd:    1 - activate, 0 - deactivate
+//   return: 0 - Success, 1 - Error
+uint8_t USB_COM_PORT_Activate (uint32_t cmd) {
+  uint32_t baudrate;
+
+  if (cmd == 0U) {
+    UART_Uninit();
+    return (0U);
+  }
+
+  if (UART_Init() != DAP_OK) {
+    return (1U);
+  }
+  baudrate = CONFIG_DAP_UART_BAUDRATE;
+  if ((UART_Config(0U, &baudrate) != 0U) || (baudrate == 0U)) {
+    UART_Uninit();
+    return (1U);
+  }
+  UartConfigured = 1U;
+  UART_Receive_Enable();
+  UART_Transmit_Enable();
+  return (0U);
+}
+
+// Start the UART at boot when the COM port is the default transport
+void UART_Setup (void) {
+  if (UartTransport == DAP_UART_TRANSPORT_USB_COM_PORT) {
+    if (USB_COM_PORT_Activate(1U) != 0U) {
+      UartTransport = DAP_UART_TRANSPORT_NONE;
     }
-    UartTransmitActive = 1U;
-    pUSART->Send(&UartTxBuf[index], UartTxNum);
   }
 }
 
@@ -393,7 +695,6 @@ uint32_t UART_Transport (const uint8_t *request, uint8_t *response) {
 uint32_t UART_Configure (const uint8_t *request, uint8_t *response) {
   uint8_t  control, status;
   uint32_t baudrate;
-  int32_t  result;
 
   if (UartTransport != DAP_UART_TRANSPORT_DAP_COMMAND) {
     status = DAP_UART_CFG_ERROR_DATA_BITS |
@@ -402,41 +703,19 @@ uint32_t UART_Configure (const uint8_t *request, uint8_t *response) {
     baudrate = 0U;  // baudrate error
   } else {
 
-    status   = 0U;
     control  = *request;
     baudrate = (uint32_t)(*(request+1) <<  0) |
                (uint32_t)(*(request+2) <<  8) |
                (uint32_t)(*(request+3) << 16) |
                (uint32_t)(*(request+4) << 24);
 
-    result = pUSART->Control(control |
-                             ARM_USART_MODE_ASYNCHRONOUS |
-                             ARM_USART_FLOW_CONTROL_NONE,
-                             baudrate);
-    if (result == ARM_DRIVER_OK) {
+    status = UART_Config(control, &baudrate);
+    if ((status == 0U) && (baudrate != 0U)) {
       UartConfigured = 1U;
     } else {
       UartConfigured = 0U;
-      switch (result) {
-        case ARM_USART_ERROR_BAUDRATE:
-          status = 0U;
-          baudrate = 0U;
-          break;
-        case ARM_USART_ERROR_DATA_BITS:
-          status = DAP_UART_CFG_ERROR_DATA_BITS;
-          break;
-        case ARM_USART_ERROR_PARITY:
-          status = DAP_UART_CFG_ERROR_PARITY;
-          break;
-        case ARM_USART_ERROR_STOP_BITS:
-          status = DAP_UART_CFG_ERROR_STOP_BITS;
-          break;
-        default:
-          status = DAP_UART_CFG_ERROR_DATA_BITS |
-                   DAP_UART_CFG_ERROR_PARITY    |
-                   DAP_UART_CFG_ERROR_STOP_BITS;
-          baudrate = 0U;
-          break;
+      if (status != 0U) {
+        baudrate = 0U;
       }
     }
   }
@@ -499,7 +778,9 @@ uint32_t UART_Control (const uint8_t *request, uint8_t *response) {
       }
     } 
     if ((control & DAP_UART_CONTROL_TX_BUF_FLUSH) != 0U) {
-      UART_Transmit_Flush();
+      if (UART_Transmit_Flush() != DAP_OK) {
+        ret = DAP_ERROR;
+      }
     }
   }
 
@@ -514,7 +795,6 @@ uint32_t UART_Control (const uint8_t *request, uint8_t *response) {
 //             number of bytes in request (upper 16 bits)
 uint32_t UART_Status (uint8_t *response) {
   uint32_t rx_cnt, tx_cnt;
-  uint32_t cnt;
   uint8_t  status;
 
   if ((UartTransport != DAP_UART_TRANSPORT_DAP_COMMAND) ||
@@ -524,20 +804,12 @@ uint32_t UART_Status (uint8_t *response) {
     status = 0U;
   } else {
 
-    rx_cnt  = UartRxIndexI - UartRxIndexO;
-    rx_cnt += pUSART->GetRxCount();
-    if (rx_cnt > (DAP_UART_RX_BUFFER_SIZE - (UART_RX_BLOCK_SIZE*2))) {
-      // Overflow
-      UartErrorRxDataLost = 1U;
-      rx_cnt = (DAP_UART_RX_BUFFER_SIZE - (UART_RX_BLOCK_SIZE*2));
-      UartRxIndexO = UartRxIndexI - rx_cnt;
-    }
+    xSemaphoreTake(UartLock, portMAX_DELAY);
+    UART_Drain(TIMESTAMP_GET());
+    xSemaphoreGive(UartLock);
 
-    tx_cnt = UartTxIndexI - UartTxIndexO;
-    cnt = pUSART->GetTxCount();
-    if (UartTransmitActive != 0U) {
-      tx_cnt -= cnt;
-    }
+    rx_cnt = UART_RxCount();
+    tx_cnt = UART_TxCount();
 
     status = UART_Get_Status();
   }
@@ -563,11 +835,9 @@ uint32_t UART_Status (uint8_t *response) {
 uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
   uint32_t rx_cnt, tx_cnt;
   uint32_t rx_num, tx_num;
-  uint8_t *rx_data;
   const
   uint8_t *tx_data;
   uint32_t num;
-  uint32_t index;
   uint8_t  status;
 
   if (UartTransport != DAP_UART_TRANSPORT_DAP_COMMAND) {
@@ -583,28 +853,15 @@ uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
     if (rx_cnt > (DAP_PACKET_SIZE - 6U)) {
       rx_cnt = (DAP_PACKET_SIZE - 6U);
     }
-    rx_num  = UartRxIndexI - UartRxIndexO;
-    rx_num += pUSART->GetRxCount();
-    if (rx_num > (DAP_UART_RX_BUFFER_SIZE - (UART_RX_BLOCK_SIZE*2))) {
-      // Overflow
-      UartErrorRxDataLost = 1U;
-      rx_num = (DAP_UART_RX_BUFFER_SIZE - (UART_RX_BLOCK_SIZE*2));
-      UartRxIndexO = UartRxIndexI - rx_num;
-    }
+    xSemaphoreTake(UartLock, portMAX_DELAY);
+    UART_Drain(TIMESTAMP_GET());
+    xSemaphoreGive(UartLock);
+
+    rx_num = UART_RxCount();
     if (rx_cnt > rx_num) {
       rx_cnt = rx_num;
     }
-
-    rx_data = (response+5);
-    index = UartRxIndexO & (DAP_UART_RX_BUFFER_SIZE - 1U);
-    if ((index + rx_cnt) <= DAP_UART_RX_BUFFER_SIZE) {
-      memcpy( rx_data,      &UartRxBuf[index], rx_cnt);
-    } else {
-      num = DAP_UART_RX_BUFFER_SIZE - index;
-      memcpy( rx_data,      &UartRxBuf[index], num);
-      memcpy(&rx_data[num], &UartRxBuf[0],     rx_cnt - num);
-    }
-    UartRxIndexO += rx_cnt;
+    rx_cnt = UART_RxRead((response+5), rx_cnt);
 
     // TX Data
     tx_cnt  = ((uint32_t)(*(request+2) << 0) |
@@ -614,27 +871,17 @@ uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
     if (tx_cnt > (DAP_PACKET_SIZE - 5U)) {
       tx_cnt = (DAP_PACKET_SIZE - 5U);
     }
-    tx_num = UartTxIndexI - UartTxIndexO;
-    num = pUSART->GetTxCount();
-    if (UartTransmitActive != 0U) {
-      tx_num -= num;
-    }
-    if (tx_cnt > (DAP_UART_TX_BUFFER_SIZE - tx_num)) {
-      tx_cnt = (DAP_UART_TX_BUFFER_SIZE - tx_num);
-    }
-
-    index = UartTxIndexI & (DAP_UART_TX_BUFFER_SIZE - 1U);
-    if ((index + tx_cnt) <= DAP_UART_TX_BUFFER_SIZE) {
-      memcpy(&UartTxBuf[index],  tx_data,      tx_cnt);
-    } else {
-      num = DAP_UART_TX_BUFFER_SIZE - index;
-      memcpy(&UartTxBuf[index],  tx_data,      num);
-      memcpy(&UartTxBuf[0],     &tx_data[num], tx_cnt - num);
+    tx_num = UART_TxFree();
+    if (tx_cnt > tx_num) {
+      tx_cnt = tx_num;
     }
-    UartTxIndexI += tx_cnt;
-
-    if (UartTransmitActive == 0U) {
-      UART_Transmit();
+    if (tx_cnt != 0U) {
+      // Fits into the TX ring buffer, does not block
+      num = (uint32_t)uart_write_bytes(DAP_UART_DRIVER, tx_data, tx_cnt);
+      if ((int32_t)num < 0) {
+        num = 0U;
+      }
+      tx_cnt = num;
     }
 
     status = UART_Get_Status();
@@ -649,4 +896,62 @@ uint32_t UART_Transfer (const uint8_t *request, uint8_t *response) {
   return (((4U + tx_cnt) << 16) | (5U + rx_cnt));
 }
 
+// Process UART Bridge command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 16 bits)
+//             number of bytes in request (upper 16 bits)
+//
+// Request:  control (1, UART_BRIDGE_xxx), latency in ms (2), flags (1, UART_BRIDGE_FLAG_xxx)
+// Response: status (1), latency in ms (2), flags (1), notified bytes (4), notifications (4),
+//           dropped bytes (4), notifications sent by the deadline (4), longest latency in us (4),
+//           sum of latencies in us (4)
+uint32_t UART_Bridge (const uint8_t *request, uint8_t *response) {
+  uint32_t stats[6];
+  uint32_t n, i;
+  uint8_t  control;
+
+  *response = DAP_OK;
+
+  control = *request;
+  if (control == UART_BRIDGE_CONFIGURE) {
+    UartComLatency = (uint32_t)(*(request+1) << 0) |
+                     (uint32_t)(*(request+2) << 8);
+    UartComFlags   = *(request+3);
+  } else if (control > UART_BRIDGE_CONFIGURE) {
+    *response = DAP_ERROR;
+  }
+
+  if (UartLock != NULL) {
+    xSemaphoreTake(UartLock, portMAX_DELAY);
+  }
+  stats[0] = UartComStats.bytes;
+  stats[1] = UartComStats.notifications;
+  stats[2] = UartComStats.dropped;
+  stats[3] = UartComStats.deadline;
+  stats[4] = UartComStats.latency_max;
+  stats[5] = UartComStats.latency_sum;
+  if ((control == UART_BRIDGE_CLEAR) || (control == UART_BRIDGE_CONFIGURE)) {
+    memset(&UartComStats, 0, sizeof(UartComStats));
+  }
+  if (UartLock != NULL) {
+    xSemaphoreGive(UartLock);
+  }
+
+  n = UartComLatency;
+  *(response+1) = (uint8_t)(n >> 0);
+  *(response+2) = (uint8_t)(n >> 8);
+  *(response+3) = UartComFlags;
+  response += 4;
+  for (i = 0U; i < 6U; i++) {
+    n = stats[i];
+    *response++ = (uint8_t)(n >>  0);
+    *response++ = (uint8_t)(n >>  8);
+    *response++ = (uint8_t)(n >> 16);
+    *response++ = (uint8_t)(n >> 24);
+  }
+
+  return ((4U << 16) | 28U);
+}
+
 #endif /* DAP_UART */
@@ -0,0 +1,152 @@
+// Nordic UART Service (NUS) for the virtual COM port
+// Data from the target UART is notified on the TX characteristic, data written by the peer to the
+// RX characteristic is queued as messages until the DAP UART task sends it to the target.
+
+#include "ble_nus.h"
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/message_buffer.h"
+
+// Size of the buffer for data written by the peer
+#define RX_BUFFER_SIZE 1024
+
+static const char* TAG = "ble_nus";
+
+static int on_nus_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+static uint16_t tx_handle;
+static int tx_notify_enable;
+static MessageBufferHandle_t rx_buffer;
+static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+static const struct ble_gatt_svc_def gatt_services[] = {
+    // Nordic UART service
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_NUS_UUID128(SVC_UUID16_NUS),
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            // RX characteristic
+            {
+                .uuid = BLE_NUS_UUID128(CHR_UUID16_NUS_RX),
+                .access_cb = on_nus_access,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP
+            },
+            // TX characteristic
+            {
+                .uuid = BLE_NUS_UUID128(CHR_UUID16_NUS_TX),
+                .val_handle = &tx_handle,
+                .access_cb = on_nus_access,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // This indicates end of characteristic array
+            {
+                NULL
+            }
+        }
+    },
+    // This indicates end of service array
+    {
+        .type = 0
+    }
+};
+
+static int on_nus_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t data[BLE_NUS_WRITE_MAX];
+    uint16_t len;
+    int rc;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;    // TX characteristic is never read or written
+    }
+
+    rc = ble_hs_mbuf_to_flat(ctxt->om, data, sizeof(data), &len);
+    if (rc != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    if (xMessageBufferSend(rx_buffer, data, len, 0) == 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;    // Peer should retry later (only reported for Write Request)
+    }
+
+    return 0;
+}
+
+int ble_nus_init(void)
+{
+    int rc;
+
+    rx_buffer = xMessageBufferCreate(RX_BUFFER_SIZE);
+    if (rx_buffer == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    rc = ble_gatts_count_cfg(gatt_services);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = ble_gatts_add_svcs(gatt_services);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+int ble_nus_handle_subscribe_event(struct ble_gap_event *event)
+{
+    assert(event->type == BLE_GAP_EVENT_SUBSCRIBE);
+
+    if (event->subscribe.attr_handle == tx_handle) {
+        tx_notify_enable = event->subscribe.cur_notify;
+        conn_handle = event->subscribe.conn_handle; // Remember connection handle for notification
+
+        ESP_LOGI(TAG, "UART notification %s", (event->subscribe.cur_notify) ? "enabled" : "disabled");
+    }
+
+    return 0;
+}
+
+// Send data from the target UART (dropped when the peer has not subscribed)
+int ble_nus_notify(const void *data, uint16_t len)
+{
+    struct os_mbuf *om;
+
+    if (!tx_notify_enable) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    return ble_gatts_notify_custom(conn_handle, tx_handle, om);  // om is consumed even on error
+}
+
+int ble_nus_is_subscribed(void)
+{
+    return tx_notify_enable;
+}
+
+// Take one message written by the peer (returns 0 when nothing was written)
+uint16_t ble_nus_receive(void *data, uint16_t size)
+{
+    return xMessageBufferReceive(rx_buffer, data, size, 0);
+}
+
+// Maximum length of data which fits in one notification
+uint16_t ble_nus_payload_size(void)
+{
+    uint16_t mtu;
+
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return 0;
+    }
+
+    mtu = ble_att_mtu(conn_handle);
+    return (mtu > 3) ? (mtu - 3) : 0;   // ATT header of Handle Value Notification is 3 bytes
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Nordic UART Service (NUS): de facto standard serial port over BLE, supported by many terminal apps
+// 128-bit UUIDs of the service and its characteristics are 6E40xxxx-B5A3-F393-E0A9-E50E24DCCA9E
+#define BLE_NUS_UUID128(uuid16) BLE_UUID128_DECLARE( \
+    0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, \
+    (uint8_t)((uuid16) & 0x00FF), (uint8_t)(((uuid16) & 0xFF00) >> 8), 0x40, 0x6E)
+
+#define SVC_UUID16_NUS 0x0001
+#define CHR_UUID16_NUS_RX 0x0002    // Written by the peer (data to the target)
+#define CHR_UUID16_NUS_TX 0x0003    // Notified to the peer (data from the target)
+
+// Maximum length of data written by the peer
+#define BLE_NUS_WRITE_MAX 512
+
+struct ble_gap_event;
+
+int ble_nus_init(void);
+
+int ble_nus_handle_subscribe_event(struct ble_gap_event *event);
+
+int ble_nus_notify(const void *data, uint16_t len);
+
+int ble_nus_is_subscribed(void);
+
+uint16_t ble_nus_receive(void *data, uint16_t size);
+
+uint16_t ble_nus_payload_size(void);
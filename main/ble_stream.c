@@ -0,0 +1,196 @@
+// Vendor-specific GATT service for data pushed from the probe without a request of the host
+// (e.g. target state events). Each channel is a notify characteristic.
+// Some channels also accept writes from the peer, which are queued as messages until the DAP task picks them up.
+
+#include "ble_stream.h"
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/message_buffer.h"
+
+// Size of the receive buffer of a writable channel
+#define RX_BUFFER_SIZE 1024
+
+static const char* TAG = "ble_stream";
+
+static int on_stream_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// Value handle and subscription state of each channel
+static uint16_t channel_handles[BLE_STREAM_CHANNEL_COUNT];
+static int channel_notify_enable[BLE_STREAM_CHANNEL_COUNT];
+// Data written by the peer (NULL for notify-only channels)
+static MessageBufferHandle_t channel_rx_buffers[BLE_STREAM_CHANNEL_COUNT];
+static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+static const struct ble_gatt_svc_def gatt_services[] = {
+    // Stream service
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_STREAM_UUID128(SVC_UUID16_STREAM),
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            // Event characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_EVENT),
+                .val_handle = &channel_handles[BLE_STREAM_EVENT],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_EVENT,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // RTT characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_RTT),
+                .val_handle = &channel_handles[BLE_STREAM_RTT],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_RTT,
+                .flags = BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP
+            },
+            // PC sample characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_SAMPLE),
+                .val_handle = &channel_handles[BLE_STREAM_SAMPLE],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_SAMPLE,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // Data logger characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_LOG),
+                .val_handle = &channel_handles[BLE_STREAM_LOG],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_LOG,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // SWO trace characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_SWO),
+                .val_handle = &channel_handles[BLE_STREAM_SWO],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_SWO,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // Trace multiplexer characteristic
+            {
+                .uuid = BLE_STREAM_UUID128(CHR_UUID16_STREAM_TRACE),
+                .val_handle = &channel_handles[BLE_STREAM_TRACE],
+                .access_cb = on_stream_access,
+                .arg = (void *)(intptr_t)BLE_STREAM_TRACE,
+                .flags = BLE_GATT_CHR_F_NOTIFY
+            },
+            // This indicates end of characteristic array
+            {
+                NULL
+            }
+        }
+    },
+    // This indicates end of service array
+    {
+        .type = 0
+    }
+};
+
+static int on_stream_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    int channel = (intptr_t)arg;
+    uint8_t data[BLE_STREAM_WRITE_MAX];
+    uint16_t len;
+    int rc;
+
+    if ((ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) || (channel_rx_buffers[channel] == NULL)) {
+        return BLE_ATT_ERR_UNLIKELY;    // Notify-only characteristics are never read or written
+    }
+
+    rc = ble_hs_mbuf_to_flat(ctxt->om, data, sizeof(data), &len);
+    if (rc != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    if (xMessageBufferSend(channel_rx_buffers[channel], data, len, 0) == 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;    // Peer should retry later (only reported for Write Request)
+    }
+
+    return 0;
+}
+
+int ble_stream_init(void)
+{
+    int rc;
+
+    channel_rx_buffers[BLE_STREAM_RTT] = xMessageBufferCreate(RX_BUFFER_SIZE);
+    if (channel_rx_buffers[BLE_STREAM_RTT] == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    rc = ble_gatts_count_cfg(gatt_services);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = ble_gatts_add_svcs(gatt_services);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+int ble_stream_handle_subscribe_event(struct ble_gap_event *event)
+{
+    assert(event->type == BLE_GAP_EVENT_SUBSCRIBE);
+
+    for (int i = 0; i < BLE_STREAM_CHANNEL_COUNT; i++) {
+        if (event->subscribe.attr_handle == channel_handles[i]) {
+            channel_notify_enable[i] = event->subscribe.cur_notify;
+            conn_handle = event->subscribe.conn_handle; // Remember connection handle for notification
+
+            ESP_LOGI(TAG, "Stream channel %d notification %s", i, (event->subscribe.cur_notify) ? "enabled" : "disabled");
+        }
+    }
+
+    return 0;
+}
+
+// Send data on a channel (dropped when the peer has not subscribed it)
+int ble_stream_notify(int channel, const void *data, uint16_t len)
+{
+    struct os_mbuf *om;
+
+    if (!channel_notify_enable[channel]) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    return ble_gatts_notify_custom(conn_handle, channel_handles[channel], om);  // om is consumed even on error
+}
+
+int ble_stream_is_subscribed(int channel)
+{
+    return channel_notify_enable[channel];
+}
+
+// Take one message written by the peer (returns 0 when nothing was written)
+uint16_t ble_stream_receive(int channel, void *data, uint16_t size)
+{
+    if (channel_rx_buffers[channel] == NULL) {
+        return 0;
+    }
+
+    return xMessageBufferReceive(channel_rx_buffers[channel], data, size, 0);
+}
+
+// Maximum length of data which fits in one notification
+uint16_t ble_stream_payload_size(void)
+{
+    uint16_t mtu;
+
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return 0;
+    }
+
+    mtu = ble_att_mtu(conn_handle);
+    return (mtu > 3) ? (mtu - 3) : 0;   // ATT header of Handle Value Notification is 3 bytes
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// 128-bit UUIDs of the stream service and its characteristics are B1DAxxxx-5A1E-4C3B-9D2E-0F8A6B7C3D21
+#define BLE_STREAM_UUID128(uuid16) BLE_UUID128_DECLARE( \
+    0x21, 0x3D, 0x7C, 0x6B, 0x8A, 0x0F, 0x2E, 0x9D, 0x3B, 0x4C, 0x1E, 0x5A, \
+    (uint8_t)((uuid16) & 0x00FF), (uint8_t)(((uuid16) & 0xFF00) >> 8), 0xDA, 0xB1)
+
+#define SVC_UUID16_STREAM 0x0000
+#define CHR_UUID16_STREAM_EVENT 0x0001
+#define CHR_UUID16_STREAM_RTT 0x0002
+#define CHR_UUID16_STREAM_SAMPLE 0x0003
+#define CHR_UUID16_STREAM_LOG 0x0004
+#define CHR_UUID16_STREAM_SWO 0x0005
+#define CHR_UUID16_STREAM_TRACE 0x0006
+
+// Maximum length of data written to a channel by the peer
+#define BLE_STREAM_WRITE_MAX 256
+
+// Channels of the stream service (one notify characteristic per channel)
+enum ble_stream_channel {
+    BLE_STREAM_EVENT,   // Target state events (halt, reset, errors)
+    BLE_STREAM_RTT,     // RTT channel data (both directions)
+    BLE_STREAM_SAMPLE,  // PC sample batches
+    BLE_STREAM_LOG,     // Data logger records
+    BLE_STREAM_SWO,     // SWO trace data (SWO_Transport 2)
+    BLE_STREAM_TRACE,   // Timestamped records of SWO, UART and RTT (trace multiplexer)
+    BLE_STREAM_CHANNEL_COUNT
+};
+
+struct ble_gap_event;
+
+int ble_stream_init(void);
+
+int ble_stream_handle_subscribe_event(struct ble_gap_event *event);
+
+int ble_stream_notify(int channel, const void *data, uint16_t len);
+
+int ble_stream_is_subscribed(int channel);
+
+uint16_t ble_stream_receive(int channel, void *data, uint16_t size);
+
+uint16_t ble_stream_payload_size(void);
@@ -3,17 +3,29 @@
 
 #include "hid_dap.h"
 
+#include <stdio.h>
+
 #include "esp_log.h"
 #include "host/ble_hs.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "DAP_config.h"   // Must come first, DAP.h depends on its settings
 #include "DAP.h"
-#include "DAP_config.h"
 
 static const char* TAG = "hid_dap";
 
+// Maximum time DAP task keeps running background jobs without blocking (in milliseconds)
+#define DAP_POLL_MAX_BUSY_MS 500
+
+// Number of independent DAP endpoints (each has its own HID service, pins, queue and task)
+#ifdef CONFIG_DAP_INSTANCES
+#define DAP_INSTANCES CONFIG_DAP_INSTANCES
+#else
+#define DAP_INSTANCES 1
+#endif
+
 static const char REPORT_DESCRIPTOR[] = {
     0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined Page 1)
     0x09, 0x01,                    // USAGE (Vendor Usage 1)
@@ -43,95 +55,131 @@ static int on_hid_control_point_access(uint16_t conn_handle, uint16_t attr_handl
 static int on_battery_level_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int on_device_info_pnp_id_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 
-static uint16_t input_report_handle;
-static int input_report_notify_enable = 0;
-static uint16_t conn_handle;
-
-// Input Report data to be sent to PC
-uint8_t input_report_data[DAP_PACKET_SIZE];
-// Output Report data received from PC
-uint8_t output_report_data[DAP_PACKET_SIZE];
+// State of one DAP endpoint
+typedef struct {
+    // DAP state used by DAP.c and the vendor modules (DAP_Instance of the DAP task)
+    DAP_Instance_t dap;
+    // I/O pins (DAP_Pins of the DAP task)
+    DAP_Pins_t pins;
+
+    uint16_t input_report_handle;
+    int input_report_notify_enable;
+    uint16_t conn_handle;
+
+    // Input Report data to be sent to PC
+    uint8_t input_report_data[DAP_PACKET_SIZE];
+    // Output Report data received from PC
+    uint8_t output_report_data[DAP_PACKET_SIZE];
+    // Copy of the next queued request (see DAP_PeekRequest)
+    uint8_t next_request[DAP_PACKET_SIZE];
+
+    // FreeRTOS task handle for DAP task
+    TaskHandle_t dap_task_handle;
+    // Queue for passing data from BLE task to DAP task
+    QueueHandle_t request_queue;
+    // Mutex for input report data (to prevent sending or receiving broken data)
+    SemaphoreHandle_t input_report_mutex;
+} hid_dap_instance_t;
+
+static hid_dap_instance_t instances[DAP_INSTANCES] = {
+    { .pins = { CONFIG_PIN_SWCLK, CONFIG_PIN_SWDIO, CONFIG_PIN_NRESET, DAP_PINS_JTAG } },
+#if DAP_INSTANCES > 1
+    { .pins = { CONFIG_PIN_SWCLK_1, CONFIG_PIN_SWDIO_1, CONFIG_PIN_NRESET_1, DAP_PIN_NONE, DAP_PIN_NONE, DAP_PIN_NONE } },
+#endif
+#if DAP_INSTANCES > 2
+    { .pins = { CONFIG_PIN_SWCLK_2, CONFIG_PIN_SWDIO_2, CONFIG_PIN_NRESET_2, DAP_PIN_NONE, DAP_PIN_NONE, DAP_PIN_NONE } },
+#endif
+};
 
 // FreeRTOS task handle for BLE task
 TaskHandle_t ble_task_handle;
-// FreeRTOS task handle for DAP task
-TaskHandle_t dap_task_handle;
-// Queue for passing data from BLE task to DAP task
-QueueHandle_t request_queue;
-// Mutex for input report data (to prevent sending or receiving broken data)
-SemaphoreHandle_t input_report_mutex;
+// Given by a DAP task when its DAP_Setup is done (instances are set up one after another)
+static SemaphoreHandle_t dap_setup_done;
 
 // Used in DAP_config.h
 gptimer_handle_t gptimer;
+__thread const DAP_Pins_t *DAP_Pins;
+
+// HID service of DAP instance n
+#define HID_DAP_SERVICE(n) \
+    {                                                                                              \
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,                                                         \
+        .uuid = BLE_UUID16_DECLARE(SVC_UUID16_HID),                                                \
+        .characteristics = (struct ble_gatt_chr_def[]) {                                           \
+            /* Input Report (device to PC) */                                                      \
+            {                                                                                      \
+                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT),                                 \
+                .val_handle = &instances[n].input_report_handle,                                   \
+                .access_cb = on_hid_input_report_access,                                           \
+                .arg = &instances[n],                                                              \
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,                              \
+                .descriptors = (struct ble_gatt_dsc_def[]) {                                       \
+                    /* CCCD is not included because it is automatically added by stack */          \
+                    /* Report Reference descriptor */                                              \
+                    {                                                                              \
+                        .uuid = BLE_UUID16_DECLARE(DSC_UUID16_REPORT_REFERENCE),                   \
+                        .access_cb = on_hid_input_report_reference_access,                         \
+                        .att_flags = BLE_ATT_F_READ                                                \
+                    },                                                                             \
+                    /* This indicates end of descriptor array */                                   \
+                    {                                                                              \
+                        NULL                                                                       \
+                    }                                                                              \
+                }                                                                                  \
+            },                                                                                     \
+            /* Output Report (PC to device) */                                                     \
+            {                                                                                      \
+                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT),                                 \
+                .access_cb = on_hid_output_report_access,                                          \
+                .arg = &instances[n],                                                              \
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP, \
+                .descriptors = (struct ble_gatt_dsc_def[]) {                                       \
+                    /* Report Reference descriptor */                                              \
+                    {                                                                              \
+                        .uuid = BLE_UUID16_DECLARE(DSC_UUID16_REPORT_REFERENCE),                   \
+                        .access_cb = on_hid_output_report_reference_access,                        \
+                        .att_flags = BLE_ATT_F_READ                                                \
+                    },                                                                             \
+                    /* This indicates end of descriptor array */                                   \
+                    {                                                                              \
+                        NULL                                                                       \
+                    }                                                                              \
+                }                                                                                  \
+            },                                                                                     \
+            /* Report Map characteristic */                                                        \
+            {                                                                                      \
+                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT_MAP),                             \
+                .access_cb = on_hid_report_map_access,                                             \
+                .flags = BLE_GATT_CHR_F_READ                                                       \
+            },                                                                                     \
+            /* HID Information characteristic */                                                   \
+            {                                                                                      \
+                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_INFORMATION),                            \
+                .access_cb = on_hid_information_access,                                            \
+                .flags = BLE_GATT_CHR_F_READ                                                       \
+            },                                                                                     \
+            /* HID Control Point characteristic */                                                 \
+            {                                                                                      \
+                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_CONTROL_POINT),                          \
+                .access_cb = on_hid_control_point_access,                                          \
+                .flags = BLE_GATT_CHR_F_WRITE_NO_RSP                                               \
+            },                                                                                     \
+            /* This indicates end of characteristic array */                                       \
+            {                                                                                      \
+                NULL                                                                               \
+            }                                                                                      \
+        },                                                                                         \
+    }
 
 static const struct ble_gatt_svc_def gatt_services[] = {
-    // HID service
-    {
-        .type = BLE_GATT_SVC_TYPE_PRIMARY,
-        .uuid = BLE_UUID16_DECLARE(SVC_UUID16_HID),
-        .characteristics = (struct ble_gatt_chr_def[]) {
-            // Input Report (device to PC)
-            {
-                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT),
-                .val_handle = &input_report_handle,
-                .access_cb = on_hid_input_report_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
-                .descriptors = (struct ble_gatt_dsc_def[]) {
-                    // Client Characteristic Configuration descriptor (CCCD) is not included because it is automatically added by stack.
-                    // Report Reference descriptor
-                    {
-                        .uuid = BLE_UUID16_DECLARE(DSC_UUID16_REPORT_REFERENCE),
-                        .access_cb = on_hid_input_report_reference_access,
-                        .att_flags = BLE_ATT_F_READ
-                    },
-                    // This indicates end of descriptor array
-                    {
-                        NULL
-                    }
-                }
-            },
-            // Output Report (PC to device)
-            {
-                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT),
-                .access_cb = on_hid_output_report_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
-                .descriptors = (struct ble_gatt_dsc_def[]) {
-                    // Report Reference descriptor
-                    {
-                        .uuid = BLE_UUID16_DECLARE(DSC_UUID16_REPORT_REFERENCE),
-                        .access_cb = on_hid_output_report_reference_access,
-                        .att_flags = BLE_ATT_F_READ
-                    },
-                    // This indicates end of descriptor array
-                    {
-                        NULL
-                    }
-                }
-            },
-            // Report Map characteristic
-            {
-                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_REPORT_MAP),
-                .access_cb = on_hid_report_map_access,
-                .flags = BLE_GATT_CHR_F_READ
-            },
-            // HID Information characteristic
-            {
-                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_INFORMATION),
-                .access_cb = on_hid_information_access,
-                .flags = BLE_GATT_CHR_F_READ
-            },
-            // HID Control Point characteristic
-            {
-                .uuid = BLE_UUID16_DECLARE(CHR_UUID16_HID_CONTROL_POINT),
-                .access_cb = on_hid_control_point_access,
-                .flags = BLE_GATT_CHR_F_WRITE_NO_RSP
-            },
-            // This indicates end of characteristic array
-            {
-                NULL
-            }
-        },
-    },
+    // HID service (one per DAP instance)
+    HID_DAP_SERVICE(0),
+#if DAP_INSTANCES > 1
+    HID_DAP_SERVICE(1),
+#endif
+#if DAP_INSTANCES > 2
+    HID_DAP_SERVICE(2),
+#endif
     // Battery serice
     {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
@@ -176,9 +224,11 @@ static int on_hid_input_report_access(uint16_t conn_handle, uint16_t attr_handle
 {
     assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);    // Read-only characteristic
 
-    xSemaphoreTake(input_report_mutex, portMAX_DELAY);
-    int rc = os_mbuf_append(ctxt->om, input_report_data, sizeof(input_report_data));
-    xSemaphoreGive(input_report_mutex);
+    hid_dap_instance_t *instance = arg;
+
+    xSemaphoreTake(instance->input_report_mutex, portMAX_DELAY);
+    int rc = os_mbuf_append(ctxt->om, instance->input_report_data, sizeof(instance->input_report_data));
+    xSemaphoreGive(instance->input_report_mutex);
 
     return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
@@ -198,6 +248,8 @@ static int on_hid_input_report_reference_access(uint16_t conn_handle, uint16_t a
 
 static int on_hid_output_report_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
+    hid_dap_instance_t *instance = arg;
+    uint8_t *output_report_data = instance->output_report_data;
     int rc;
 
     switch (ctxt->op) {
@@ -205,20 +257,20 @@ static int on_hid_output_report_access(uint16_t conn_handle, uint16_t attr_handl
         // See Apache Mynewt tutorial https://mynewt.apache.org/latest/tutorials/ble/bleprph/bleprph-sections/bleprph-chr-access.html#write-access
         if (os_mbuf_len(ctxt->om) == DAP_PACKET_SIZE + 1) {
             // Workaround for Linux host which adds Report ID even if there is only one Output Report
-            rc = os_mbuf_copydata(ctxt->om, 1, sizeof(output_report_data), output_report_data); // Skip first byte
+            rc = os_mbuf_copydata(ctxt->om, 1, DAP_PACKET_SIZE, output_report_data); // Skip first byte
         } else {
-            rc = ble_hs_mbuf_to_flat(ctxt->om, output_report_data, sizeof(output_report_data), NULL);   // Don't skip first byte
+            rc = ble_hs_mbuf_to_flat(ctxt->om, output_report_data, DAP_PACKET_SIZE, NULL);   // Don't skip first byte
         }
         if (output_report_data[0] == ID_DAP_TransferAbort) {
-            DAP_TransferAbort = 1U; // DAP_TransferAbort command is handled without queueing
+            instance->dap.abort = 1U;   // DAP_TransferAbort command is handled without queueing
         } else {
             // Send received data to DAP task
-            xQueueSend(request_queue, output_report_data, 0);   // Overflow is ignoread silently
+            xQueueSend(instance->request_queue, output_report_data, 0);   // Overflow is ignoread silently
         }
         return (rc == 0) ? 0 : BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
     
     case BLE_GATT_ACCESS_OP_READ_CHR:
-        rc = os_mbuf_append(ctxt->om, output_report_data, sizeof(output_report_data));
+        rc = os_mbuf_append(ctxt->om, output_report_data, DAP_PACKET_SIZE);
         return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     
     default:
@@ -296,25 +348,93 @@ static int on_device_info_pnp_id_access(uint16_t conn_handle, uint16_t attr_hand
     return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
 
+// Send response to PC as Input Report
+static void send_response(hid_dap_instance_t *instance, const uint8_t *response)
+{
+    xSemaphoreTake(instance->input_report_mutex, portMAX_DELAY);
+    memcpy(instance->input_report_data, response, sizeof(instance->input_report_data));
+    xSemaphoreGive(instance->input_report_mutex);
+
+    if (instance->input_report_notify_enable) {
+        // Notify new input report data to the subscribed peer
+        ble_gatts_notify(instance->conn_handle, instance->input_report_handle);
+    }
+}
+
+// Used in DAP.c to look ahead at the next queued request of the calling DAP task (returns NULL if there is none)
+const uint8_t *DAP_PeekRequest(void)
+{
+    hid_dap_instance_t *instance = &instances[DAP_Instance->index];
+
+    if (xQueuePeek(instance->request_queue, instance->next_request, 0) != pdTRUE) {
+        return NULL;
+    }
+    return instance->next_request;
+}
+
 static void dap_task(void *pvParameters)
 {
-    static uint8_t request[DAP_PACKET_SIZE];
-    static uint8_t response[DAP_PACKET_SIZE];
+    hid_dap_instance_t *instance = pvParameters;
+    QueueHandle_t request_queue = instance->request_queue;
+    uint8_t request[DAP_PACKET_SIZE];
+    // Two response buffers, a response whose last read is carried into the next command is held in one of them
+    uint8_t response[2][DAP_PACKET_SIZE];
+    int current = 0;    // Response buffer of the next command
+    int held = -1;      // Response buffer waiting for the next command (-1 if none)
+    uint32_t poll_wait = DAP_POLL_IDLE;     // Time until next background job (in microseconds)
+    TickType_t last_block = xTaskGetTickCount();    // Last time this task was blocked
+    TickType_t timeout;
+
+    // DAP code of this task works on the state and pins of its instance
+    DAP_Instance = &instance->dap;
+    DAP_Pins = &instance->pins;
 
     DAP_Setup();
+    xSemaphoreGive(dap_setup_done);
 
     for (;;) {
-        xQueueReceive(request_queue, request, portMAX_DELAY);   // No timeout
+        if (poll_wait == DAP_POLL_IDLE) {
+            timeout = portMAX_DELAY;    // No background job
+        } else {
+            timeout = pdMS_TO_TICKS((poll_wait + 999) / 1000);
+            if ((timeout == 0) && (poll_wait != 0)) {
+                timeout = 1;    // Waits shorter than a tick are rounded up instead of polling the queue
+            }
+            if ((timeout == 0) && ((xTaskGetTickCount() - last_block) >= pdMS_TO_TICKS(DAP_POLL_MAX_BUSY_MS))) {
+                timeout = 1;    // Let lower priority tasks (including IDLE task for watchdog) run
+            }
+        }
+        if (timeout != 0) {
+            last_block = xTaskGetTickCount();
+        }
 
-        DAP_ExecuteCommand(request, response);
+        if (xQueueReceive(request_queue, request, timeout) == pdTRUE) {
+            DAP_ExecuteCommand(request, response[current]);
 
-        xSemaphoreTake(input_report_mutex, portMAX_DELAY);
-        memcpy(input_report_data, response, sizeof(input_report_data));
-        xSemaphoreGive(input_report_mutex);
+            if (held >= 0) {
+                // Held response was completed by this command
+                send_response(instance, response[held]);
+                held = -1;
+            }
+            if (DAP_TransferCarried()) {
+                held = current;
+                current ^= 1;
+            } else {
+                send_response(instance, response[current]);
+            }
+        }
 
-        if (input_report_notify_enable) {
-            // Notify new input report data to the subscribed peer
-            ble_gatts_notify(conn_handle, input_report_handle);
+        // Background jobs (e.g. target monitoring) only run when no command is waiting
+        if (uxQueueMessagesWaiting(request_queue) == 0) {
+            if (held >= 0) {
+                // Should not happen (reads are only carried into a queued command), but never lose a response
+                DAP_TransferFlush();
+                send_response(instance, response[held]);
+                held = -1;
+            }
+            poll_wait = DAP_ProcessVendorPoll();
+        } else {
+            poll_wait = 0;
         }
     }
 }
@@ -334,10 +454,29 @@ int hid_dap_init(void)
     }
 
     ble_task_handle = xTaskGetCurrentTaskHandle();
-    request_queue = xQueueCreate(DAP_PACKET_COUNT, DAP_PACKET_SIZE);
-    input_report_mutex = xSemaphoreCreateMutex();
-    // DAP processing is done in another FreeRTOS task
-    xTaskCreate(dap_task, "dap", 4096, NULL, 2, &dap_task_handle);
+    dap_setup_done = xSemaphoreCreateBinary();
+
+    for (int n = 0; n < DAP_INSTANCES; n++) {
+        hid_dap_instance_t *instance = &instances[n];
+        char name[configMAX_TASK_NAME_LEN];
+        BaseType_t core;
+
+        instance->dap.index = n;
+        instance->request_queue = xQueueCreate(DAP_PACKET_COUNT, DAP_PACKET_SIZE);
+        instance->input_report_mutex = xSemaphoreCreateMutex();
+
+        // DAP processing is done in another FreeRTOS task, several instances run in parallel on different cores
+        if ((DAP_INSTANCES > 1) || (TASK_CORE(CONFIG_DAP_TASK_CORE) != tskNO_AFFINITY)) {
+            core = (TASK_CORE(CONFIG_DAP_TASK_CORE) == tskNO_AFFINITY) ? n : (CONFIG_DAP_TASK_CORE + n);
+            core %= portNUM_PROCESSORS;
+        } else {
+            core = tskNO_AFFINITY;
+        }
+        snprintf(name, sizeof(name), (n == 0) ? "dap" : "dap%d", n);
+        xTaskCreatePinnedToCore(dap_task, name, 4096, instance, CONFIG_DAP_TASK_PRIORITY, &instance->dap_task_handle, core);
+        // Wait until the instance has set up its pins and the shared timestamp timer
+        xSemaphoreTake(dap_setup_done, portMAX_DELAY);
+    }
 
     return 0;
 }
@@ -346,11 +485,15 @@ int hid_dap_handle_subscribe_event(struct ble_gap_event *event)
 {
     assert(event->type == BLE_GAP_EVENT_SUBSCRIBE);
 
-    if (event->subscribe.attr_handle == input_report_handle) {
-        input_report_notify_enable = event->subscribe.cur_notify;
-        conn_handle = event->subscribe.conn_handle; // Remember connection handle for notification
+    for (int n = 0; n < DAP_INSTANCES; n++) {
+        hid_dap_instance_t *instance = &instances[n];
+
+        if (event->subscribe.attr_handle == instance->input_report_handle) {
+            instance->input_report_notify_enable = event->subscribe.cur_notify;
+            instance->conn_handle = event->subscribe.conn_handle;   // Remember connection handle for notification
 
-        ESP_LOGI(TAG, "Input report notification %s", (event->subscribe.cur_notify) ? "enabled" : "disabled");
+            ESP_LOGI(TAG, "Input report notification of DAP %d %s", n, (event->subscribe.cur_notify) ? "enabled" : "disabled");
+        }
     }
 
     return 0;
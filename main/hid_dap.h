@@ -5,6 +5,9 @@
 
 #define LITTLE_ENDIAN_16BIT(value) (uint8_t)(value & 0x00FF), (uint8_t)((value & 0xFF00) >> 8)
 
+// Core affinity of a task from a Kconfig core option (-1 or a core the chip does not have = any core)
+#define TASK_CORE(core) ((((core) < 0) || ((core) >= portNUM_PROCESSORS)) ? tskNO_AFFINITY : (core))
+
 #define SVC_UUID16_HID 0x1812
 #define SVC_UUID16_BATTERY 0x180F
 #define SVC_UUID16_DEVICE_INFO 0x180A
@@ -19,6 +19,8 @@
 #include "DAP_config.h"
 #include "DAP.h"
 #include "hid_dap.h"
+#include "ble_stream.h"
+#include "ble_nus.h"
 
 static const char* TAG = "main";
 
@@ -140,6 +142,12 @@ int on_adv_event(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_SUBSCRIBE:
         rc = hid_dap_handle_subscribe_event(event);
         assert(rc == 0);
+        rc = ble_stream_handle_subscribe_event(event);
+        assert(rc == 0);
+#if (DAP_UART != 0)
+        rc = ble_nus_handle_subscribe_event(event);
+        assert(rc == 0);
+#endif
         break;
     
     case BLE_GAP_EVENT_DISCONNECT:
@@ -191,7 +199,7 @@ void ble_host_task(void *pvParameters)
 
     nimble_port_run();
 
-    nimble_port_freertos_deinit();
+    vTaskDelete(NULL);
 }
 
 void ble_store_config_init(void);
@@ -239,6 +247,18 @@ void app_main(void)
     rc = hid_dap_init();
     assert(rc == 0);
 
-    // Start BLE task
-    nimble_port_freertos_init(ble_host_task);
+    rc = ble_stream_init();
+    assert(rc == 0);
+
+#if (DAP_UART != 0)
+    rc = ble_nus_init();
+    assert(rc == 0);
+
+    // Serve the target UART on the Nordic UART Service from boot
+    UART_Setup();
+#endif
+
+    // Start BLE task (same as nimble_port_freertos_init, but with configurable core and priority)
+    xTaskCreatePinnedToCore(ble_host_task, "nimble_host", CONFIG_BT_NIMBLE_HOST_TASK_STACK_SIZE, NULL,
+                            CONFIG_BLE_HOST_TASK_PRIORITY, NULL, TASK_CORE(CONFIG_BLE_HOST_TASK_CORE));
 }